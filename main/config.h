@@ -6,6 +6,8 @@
 *******************	I N C L U D E   D E P E N D E N C I E S	*******************
 ******************************************************************************/
 
+#include "motion.h"			// generated motion parameters, see makefile
+
 #include <avr/io.h>
 #include <stdint.h>
 
@@ -16,7 +18,6 @@
 // SYSTEMS' FREQUENCIES
 #define F_CPU	16000000UL		// 16MHz ceramic resonator, no prescaler
 #define BAUD 	115200UL		// A standard baud rate for serial interface
-#define F_MOTOR (16000000 / 8)	// Speed Timer Frequency. Prescaler 8
 
 // Miscelanous global definitions
 #define TRUE	1
@@ -28,6 +29,6 @@
 
 // Debug
 #define DEBUG(x) 	uart_send_string(x)
-#define DEBUG_P(x) 	uart_send_string(PSTR(x))
+#define DEBUG_P(x) 	uart_send_string_p(PSTR(x))
 
 #endif /* CONFIG_H_ */
\ No newline at end of file
@@ -0,0 +1,428 @@
+
+/*
+* UART command console.
+* Received bytes are stored by the UART RX ISR into a line buffer. Once a 
+* full line is received, it is parsed and executed in place by the console
+* background task, which runs from the menu loops (see wait_millis()). Thus,
+* the slider can be driven through the serial port while the menus run.
+*
+* Commands: one letter, and decimal arguments separated by spaces. Positions
+* and steps are eighth-steps, speeds and accelerations are percentages.
+*	M <pos>					move to absolute position
+*	R <steps>				move relative to current position
+*	V <speed>				speed control, signed speed
+*	A <accel>				acceleration (motor halted). Resets the deceleration
+*	D <decel> [stop]		deceleration (motor halted), and emergency
+*							deceleration of the smooth stops
+*	P <L|Q|S|E>				speed profile: linear, quadratic, sine or ease
+*							in-out (motor halted)
+*	S [H]					stop smoothly, or hard stop
+*	H <ms>					driver hold time after a movement: 0 releases
+*							at once, 65535 holds for ever
+*	Q <pos> [speed [ms]]	add a step to the program: position, max speed,
+*							and dwell before the movement starts
+*	G						run the program (steps are kept). If synced, it's
+*							armed instead: the master broadcasts the start,
+*							slaves wait for it (see sync.c)
+*	C						clear the program
+*	T						stream mode: the following bytes are stream blocks
+*							until the stream ends (see stream.c). Not synced
+*	Y [M|S]					sync master, slave, or sync off
+*	?						status, console statistics, and RAM: free now,
+*							stack high water mark and stack never used
+* Every command is answered with "ok" or "err". Lines with anything else
+* than spaces after the arguments, and numbers beyond 32 bits, are errors:
+* nothing is executed.
+*/
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "console.h"
+
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+/******************************************************************************
+****************** V A R I A B L E S   D E F I N I T I O N S ******************
+******************************************************************************/
+
+// Two line buffers: one is filled by the RX ISR while the other one is
+// being executed.
+static char line[2][CONSOLE_LINE_LEN];
+static uint8_t fill;				// buffer being filled by the ISR
+static uint8_t len;					// bytes in the buffer being filled
+volatile static int8_t pending = -1;// buffer ready to be executed, or -1
+static uint32_t t_first;			// micros() at the first byte of the line
+volatile static uint32_t t_line;	// the same, for the pending line
+volatile static uint16_t dropped;	// lines lost: too long, or too fast
+
+static struct motor_cmd_s prog[CONSOLE_PROG_LEN];
+static uint8_t prog_len;
+
+// statistics
+static uint16_t cmds;				// commands since the last report
+static uint32_t t_report;			// uptime() at the last report
+static uint32_t lat_last;			// first command byte to first step, us
+static uint32_t lat_max;
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static void console_task(void);
+static int8_t console_exec(char *s);
+static int8_t prog_run(void);
+static void prog_start(uint8_t arg);
+static int8_t parse_int(char **s, int32_t *v);
+static char parse_char(char **s);
+static int8_t parse_end(char *s);
+static void send_num(const char *label, int32_t v);
+static void status_report(void);
+
+/*===========================================================================*/
+void console_init(void)
+{
+	pending = -1;
+	fill = 0;
+	len = 0;
+	prog_len = 0;
+	t_report = uptime();
+	background_set(console_task);
+	uart_rx_isr(ENABLE);
+}
+
+/*-----------------------------------------------------------------------------
+--------------------- I N T E R N A L   F U N C T I O N S ---------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+/*
+* Console background task. Executes the received line, if any.
+* If the command starts a movement, the latency from the first byte of the
+* line to the first step is recorded: the time it took to be received and
+* executed, plus the first step period.
+*/
+static void console_task(void)
+{
+	struct motor_status_s s;
+	uint8_t halted;
+	int8_t x;
+
+	sync_task();
+
+	if (pending < 0) return;
+
+	motor_get_status(&s);
+	halted = (s.state == SPEED_HALT);
+
+	x = console_exec(line[pending]);
+	cmds++;
+
+	motor_get_status(&s);
+	if (halted && (s.state != SPEED_HALT) && (s.state != SPEED_DWELL)) {
+		lat_last = (micros() - t_line) + (s.cn / (F_MOTOR / 1000000UL));
+		if (lat_last > lat_max) lat_max = lat_last;
+	}
+
+	pending = -1;		// buffer released
+	if (x < 0) uart_send_string_p(PSTR("\n\rerr"));
+	else uart_send_string_p(PSTR("\n\rok"));
+}
+
+/*===========================================================================*/
+/*
+* Parses and executes a command line, in place. All the arguments are
+* checked before anything is executed.
+*/
+static int8_t console_exec(char *s)
+{
+	int32_t v, w;
+	struct motor_cmd_s c;
+	char cmd = *s++;
+	char a;
+	int8_t x = 0;
+
+	switch (cmd) {
+
+		case 'M':
+		case 'R':
+			if ((parse_int(&s, &v) < 0) || (parse_end(s) < 0)) return -1;
+			motor_move_to_pos(v, (cmd == 'M') ? ABS : REL, TRUE);
+			break;
+
+		case 'V':
+			if ((parse_int(&s, &v) < 0) || (v > 100) || (v < -100)) return -1;
+			if (parse_end(s) < 0) return -1;
+			motor_move_at_speed((int8_t)v);
+			break;
+
+		case 'A':
+			if ((parse_int(&s, &v) < 0) || (v < 0) || (v > 100)) return -1;
+			if (parse_end(s) < 0) return -1;
+			x = motor_set_accel_percent((uint8_t)v);
+			break;
+
+		case 'D':
+			if ((parse_int(&s, &v) < 0) || (v < 0) || (v > 100)) return -1;
+			if (parse_int(&s, &w) < 0) w = -1;
+			else if ((w < 0) || (w > 100)) return -1;
+			if (parse_end(s) < 0) return -1;
+			x = motor_set_decel_percent((uint8_t)v);
+			if ((x == 0) && (w >= 0)) x = motor_set_stop_percent((uint8_t)w);
+			break;
+
+		case 'P':
+			a = parse_char(&s);
+			if ((parse_end(s) < 0) || motor_working()) return -1;
+			if (a == 'L') motor_set_speed_profile(PROFILE_LINEAR);
+			else if (a == 'Q') motor_set_speed_profile(PROFILE_QUADRATIC);
+			else if (a == 'S') motor_set_speed_profile(PROFILE_SINE);
+			else if (a == 'E') motor_set_speed_profile(PROFILE_SMOOTH);
+			else return -1;
+			break;
+
+		case 'S':
+			a = parse_char(&s);
+			if (parse_end(s) < 0) return -1;
+			if (a == 'H') motor_stop(HARD_STOP);
+			else motor_stop(SOFT_STOP);
+			break;
+
+		case 'H':
+			if ((parse_int(&s, &v) < 0) || (v < 0) || (v > 0xFFFF)) return -1;
+			if (parse_end(s) < 0) return -1;
+			drv_set_hold((uint16_t)v);
+			break;
+
+		case 'Q':
+			if (prog_len >= CONSOLE_PROG_LEN) return -1;
+			if (parse_int(&s, &v) < 0) return -1;
+			c.pos = v;
+			c.speed = 0;
+			c.dwell = 0;
+			if (parse_int(&s, &w) == 0) {
+				if ((w < 0) || (w > 100)) return -1;
+				c.speed = (int8_t)w;
+				if (parse_int(&s, &w) == 0) {
+					if ((w < 0) || (w > 0xFFFF)) return -1;
+					c.dwell = (uint16_t)w;
+				}
+			}
+			if (parse_end(s) < 0) return -1;
+			c.accel = MOTOR_CMD_KEEP;
+			c.profile = MOTOR_CMD_KEEP;
+			c.ctl = POSITION_CONTROL;
+			prog[prog_len++] = c;
+			break;
+
+		case 'G':
+			if (parse_end(s) < 0) return -1;
+			if (motor_queue_free() < prog_len) return -1;
+			if (sync_get_mode() != SYNC_OFF) x = sync_arm(prog_start);
+			else x = prog_run();
+			break;
+
+		case 'C':
+			if (parse_end(s) < 0) return -1;
+			prog_len = 0;
+			break;
+
+		case 'T':
+			// the master beacons would get into the host's stream credits
+			if ((parse_end(s) < 0) || (sync_get_mode() != SYNC_OFF)) return -1;
+			x = stream_open();
+			break;
+
+		case 'Y':
+			a = parse_char(&s);
+			if (parse_end(s) < 0) return -1;
+			if (a == 'M') sync_set(SYNC_MASTER);
+			else if (a == 'S') sync_set(SYNC_SLAVE);
+			else sync_set(SYNC_OFF);
+			break;
+
+		case '?':
+			if (parse_end(s) < 0) return -1;
+			status_report();
+			break;
+
+		default:
+			x = -1;
+			break;
+	}
+
+	return x;
+}
+
+/*===========================================================================*/
+/*
+* Pushes the program into the motor queue
+*/
+static int8_t prog_run(void)
+{
+	for (uint8_t i = 0; i < prog_len; i++) {
+		if (motor_queue_push(&prog[i]) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/*===========================================================================*/
+/*
+* Armed program start, at the shared instant (deferred work, see sync.c)
+*/
+static void prog_start(uint8_t arg)
+{
+	prog_run();
+}
+
+/*===========================================================================*/
+/*
+* Decimal integer, after any leading spaces. The pointer is moved past it.
+* Returns -1 if there's no number, if it doesn't fit in 32 bits (signed), or
+* if it's followed by anything but a space or the end of the line. The
+* pointer isn't moved then.
+*/
+static int8_t parse_int(char **s, int32_t *v)
+{
+	char *p = *s;
+	uint8_t neg = FALSE;
+	uint32_t r = 0, max;
+	uint8_t d;
+
+	while (*p == ' ') p++;
+	if (*p == '-') {
+		neg = TRUE;
+		p++;
+	}
+	max = neg ? 0x80000000UL : 0x7FFFFFFFUL;
+
+	if ((*p < '0') || (*p > '9')) return -1;
+	while ((*p >= '0') && (*p <= '9')) {
+		d = *p - '0';
+		if (r > 214748364UL) return -1;		// r * 10 beyond 2^31
+		r *= 10;
+		if (r > max - d) return -1;
+		r += d;
+		p++;
+	}
+	if ((*p != ' ') && (*p != '\0')) return -1;
+
+	*v = neg ? (int32_t)(0 - r) : (int32_t)r;
+	*s = p;
+
+	return 0;
+}
+
+/*===========================================================================*/
+/*
+* Single letter argument, after any leading spaces. The pointer is moved
+* past it. Returns '\0' at the end of the line.
+*/
+static char parse_char(char **s)
+{
+	char c;
+
+	while (**s == ' ') (*s)++;
+	c = **s;
+	if (c != '\0') (*s)++;
+
+	return c;
+}
+
+/*===========================================================================*/
+/*
+* End of the arguments: returns -1 if there's anything left but spaces
+*/
+static int8_t parse_end(char *s)
+{
+	while (*s == ' ') s++;
+
+	return (*s == '\0') ? 0 : -1;
+}
+
+/*===========================================================================*/
+static void send_num(const char *label, int32_t v)
+{
+	char str[12];
+
+	ltoa(v, str, 10);
+	uart_send_string_p(label);
+	uart_send_string(str);
+}
+
+/*===========================================================================*/
+/*
+* Status report: motion status, and console statistics since the last report
+*/
+static void status_report(void)
+{
+	struct motor_status_s s;
+	uint32_t t = uptime();
+	uint32_t cps = 0;
+
+	if (t != t_report)
+		cps = ((uint32_t)cmds * 1000) / (t - t_report);
+
+	motor_get_status(&s);
+	send_num(PSTR("\n\rpos: "), s.position);
+	send_num(PSTR(" target: "), s.target);
+	send_num(PSTR(" state: "), s.state);
+	send_num(PSTR(" speed: "), motor_get_speed_percent());
+	send_num(PSTR(" queue: "), motor_queue_free());
+	send_num(PSTR(" fault: "), motor_fault());
+	send_num(PSTR("\n\rcmd/s: "), cps);
+	send_num(PSTR(" latency us: "), lat_last);
+	send_num(PSTR(" max: "), lat_max);
+	send_num(PSTR(" dropped: "), dropped);
+	send_num(PSTR("\n\rsync: "), sync_get_mode());
+	send_num(PSTR(" locked: "), sync_locked());
+	send_num(PSTR(" error us: "), sync_get_error());
+	send_num(PSTR("\n\rram free: "), ram_free());
+	send_num(PSTR(" stack peak: "), stack_peak());
+	send_num(PSTR(" unused: "), stack_unused());
+
+	cmds = 0;
+	t_report = t;
+}
+
+/******************************************************************************
+*******************************************************************************
+
+					I N T E R R U P T   H A N D L E R S
+
+*******************************************************************************
+******************************************************************************/
+
+/*===========================================================================*/
+/*
+* UART byte received. Lines end with CR or LF, empty lines are ignored.
+* If the previous line wasn't executed yet, the new one is dropped.
+*/
+ISR(USART_RX_vect)
+{
+	char c = UDR0;
+
+	if (sync_rx(c)) return;			// sync frames, slaves only
+	if (stream_rx(c)) return;		// stream mode
+
+	if ((c == '\r') || (c == '\n')) {
+		if (len == 0) return;
+		if ((pending >= 0) || (len >= CONSOLE_LINE_LEN)) {
+			dropped++;
+		} else {
+			line[fill][len] = '\0';
+			t_line = t_first;
+			pending = fill;
+			fill ^= 1;
+		}
+		len = 0;
+	} else if (len < CONSOLE_LINE_LEN) {
+		if (len == 0) t_first = micros();
+		if (len < CONSOLE_LINE_LEN - 1) line[fill][len] = c;
+		len++;
+	}
+}
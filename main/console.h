@@ -0,0 +1,30 @@
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "config.h"
+#include "motor.h"
+#include "sync.h"
+#include "uart.h"
+#include "util.h"
+
+#include <stdint.h>
+
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+#define CONSOLE_LINE_LEN	32
+#define CONSOLE_PROG_LEN	(MOTOR_QUEUE_LEN - 1)	// fits the motor queue
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+void console_init(void);
+
+#endif /* CONSOLE_H */
@@ -0,0 +1,137 @@
+
+/*
+* Deferred work module.
+* Interrupt handlers must be short: anything slow (driver enable delays, 
+* UART messages...) is posted here as a function + argument, and executed
+* shortly after from a "software interrupt" (auxiliary timer, Timer 0).
+*
+* Deferred work runs with interrupts enabled, thus the motor timer ISR and
+* all other ISRs may preempt it, but it still runs before the main loop gets
+* back the CPU. Works are executed in the same order they were posted.
+*/
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "defer.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+_Static_assert(!(DEFER_QUEUE_LEN & (DEFER_QUEUE_LEN - 1)), "Queue length must be a power of 2");
+
+#define QUEUE_MASK		(DEFER_QUEUE_LEN - 1)
+#define DEFER_TICK_US	4		// auxiliary timer tick
+
+/******************************************************************************
+****************** V A R I A B L E S   D E F I N I T I O N S ******************
+******************************************************************************/
+
+static struct {
+	defer_fn_t fn;
+	uint8_t arg;
+} queue[DEFER_QUEUE_LEN];
+
+volatile static uint8_t queue_head;
+volatile static uint8_t queue_tail;
+volatile static uint8_t armed;		// software interrupt pending or running
+volatile static uint8_t latency;	// worst dispatch latency, timer ticks
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*===========================================================================*/
+void defer_init(void)
+{
+	timer_aux_init();
+	queue_head = 0;
+	queue_tail = 0;
+	armed = FALSE;
+	latency = 0;
+}
+
+/*===========================================================================*/
+/*
+* Posts a function to be executed later, outside of the calling ISR.
+* Can be called from any context. Returns -1 if the queue is full.
+*/
+int8_t defer(defer_fn_t fn, uint8_t arg)
+{
+	int8_t x = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint8_t next = (queue_head + 1) & QUEUE_MASK;
+
+		if (next == queue_tail) {
+			x = -1;
+		} else {
+			queue[queue_head].fn = fn;
+			queue[queue_head].arg = arg;
+			queue_head = next;
+			if (!armed) {
+				armed = TRUE;
+				timer_aux_set(ENABLE, 1);	// triggers on the next tick
+			}
+		}
+	}
+
+	return x;
+}
+
+/*===========================================================================*/
+/*
+* Worst time elapsed from posting some work until it started to be dispatched,
+* in microseconds. The auxiliary timer keeps counting from the moment it is
+* started (when work is posted) until its ISR is actually served.
+*/
+uint16_t defer_latency_max(void)
+{
+	return (uint16_t)latency * DEFER_TICK_US;
+}
+
+/*===========================================================================*/
+void defer_latency_clear(void)
+{
+	latency = 0;
+}
+
+/******************************************************************************
+*******************************************************************************
+
+					I N T E R R U P T   H A N D L E R S
+
+*******************************************************************************
+******************************************************************************/
+
+/*===========================================================================*/
+/*
+* Software interrupt. One-shot: the timer is stopped first, and the queue is
+* emptied with interrupts enabled. Work posted meanwhile is also executed
+* here, without triggering the timer again.
+*/
+ISR(TIMER0_COMPA_vect) 
+{
+	defer_fn_t fn;
+	uint8_t arg;
+	uint8_t t = timer_aux_get();
+
+	timer_aux_set(DISABLE, 0);
+	if (t > latency) latency = t;
+
+	while (queue_tail != queue_head) {
+		fn = queue[queue_tail].fn;
+		arg = queue[queue_tail].arg;
+		queue_tail = (queue_tail + 1) & QUEUE_MASK;
+
+		sei();
+		fn(arg);
+		cli();
+	}
+	armed = FALSE;
+}
@@ -0,0 +1,36 @@
+
+#ifndef DEFER_H
+#define DEFER_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "config.h"
+#include "timers.h"
+
+#include <stdint.h>
+
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+#define DEFER_QUEUE_LEN		8		// power of 2
+
+/******************************************************************************
+***************** S T R U C T U R E   D E C L A R A T I O N S ****************
+******************************************************************************/
+
+// Deferred work: a function and its argument
+typedef void (*defer_fn_t)(uint8_t arg);
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+void defer_init(void);
+int8_t defer(defer_fn_t fn, uint8_t arg);
+uint16_t defer_latency_max(void);
+void defer_latency_clear(void);
+
+#endif /* DEFER_H */
@@ -10,8 +10,17 @@
 #include "driver.h"
 
 #include <avr/io.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 
+/******************************************************************************
+****************** V A R I A B L E S   D E F I N I T I O N S ******************
+******************************************************************************/
+
+volatile static uint8_t enabled;	// driver ENable pin asserted
+volatile static uint16_t hold;		// 1ms ticks left before the release
+static uint16_t hold_ms = DRV_HOLD_DEFAULT;
+
 /******************************************************************************
 ******************* F U N C T I O N   D E F I N I T I O N S *******************
 ******************************************************************************/
@@ -91,17 +100,81 @@ void drv_dir(uint8_t dir, volatile uint8_t *var)
 /*===========================================================================*/
 /*
 * Driver ENABLE/DISABLE
-* Toggles driver ENable pin
+* Toggles driver ENable pin. Any pending release is cancelled.
+* Enabling waits for the driver to settle before the first step, unless it
+* was already enabled (i.e. still holding after the previous movement). 
+* Disabling doesn't wait, thus it can be called from an ISR.
 */
 void drv_set(uint8_t state)
 {
-	if (state) {
-		DRV_EN_PORT &= ~(1<<DRV_EN_PIN);
-	} else {
-		DRV_EN_PORT |= (1<<DRV_EN_PIN);
+	uint8_t was;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		hold = 0;
+		was = enabled;
+		enabled = state;
+		if (state) DRV_EN_PORT &= ~(1<<DRV_EN_PIN);
+		else DRV_EN_PORT |= (1<<DRV_EN_PIN);
+	}
+	if (state && !was) _delay_us(100);
+}
+
+/*===========================================================================*/
+/*
+* Driver emergency disable
+* Same as drv_set(DISABLE): kept for the fault paths. The motor shaft is 
+* released at once, whatever the hold policy.
+*/
+void drv_halt(void)
+{
+	drv_set(DISABLE);
+}
+
+/*===========================================================================*/
+/*
+* Driver release, at the end of a movement. Called from ISRs.
+* Hold policy: the motor keeps its holding torque for the configured hold 
+* time, then the driver is disabled by drv_tick(). A movement started 
+* meanwhile (drv_set(ENABLE)) cancels the release, and doesn't need to wait
+* for the driver to settle. DRV_HOLD_NONE releases at once, DRV_HOLD_ALWAYS
+* never does.
+*/
+void drv_release(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (enabled) {
+			if (hold_ms == DRV_HOLD_NONE) drv_set(DISABLE);
+			else if (hold_ms != DRV_HOLD_ALWAYS) hold = hold_ms;
+		}
 	}
-	_delay_us(100);
+}
+
+/*===========================================================================*/
+/*
+* Hold policy: time the driver stays enabled after a movement, in ms. 
+* Takes effect on the next release.
+*/
+void drv_set_hold(uint16_t ms)
+{
+	hold_ms = ms;
+}
+
+/*===========================================================================*/
+uint16_t drv_get_hold(void)
+{
+	return hold_ms;
+}
 
+/*===========================================================================*/
+/*
+* Driver hold countdown. Called from the 1ms general timer ISR.
+*/
+void drv_tick(void)
+{
+	if (hold && (--hold == 0)) {
+		DRV_EN_PORT |= (1<<DRV_EN_PIN);
+		enabled = FALSE;
+	}
 }
 
 /*===========================================================================*/
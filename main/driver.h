@@ -40,6 +40,11 @@
 #define DRV_STEP_PIN	PORTB0
 #define DRV_DIR_PIN		PORTB1
 
+// Hold policy: time the driver stays enabled after a movement, in ms
+#define DRV_HOLD_NONE		0
+#define DRV_HOLD_ALWAYS		0xFFFF
+#define DRV_HOLD_DEFAULT	500
+
 /******************************************************************************
 ******************** F U N C T I O N   P R O T O T Y P E S ********************
 ******************************************************************************/
@@ -47,7 +52,12 @@
 void drv_step_mode(uint8_t mode);
 void drv_dir(uint8_t dir, volatile uint8_t *var);
 void drv_set(uint8_t state);
+void drv_halt(void);
 void drv_reset(void);
+void drv_release(void);
+void drv_set_hold(uint16_t ms);
+uint16_t drv_get_hold(void);
+void drv_tick(void);
 
 #endif /* DRIVER_H */
 
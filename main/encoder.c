@@ -9,6 +9,7 @@
 ******************************************************************************/
 
 #include "encoder.h"
+#include "motor.h"
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
@@ -257,6 +258,9 @@ ISR(INT0_vect){
 
 	if(PIND & (1<<PIND3)) encoder.dir = CW;
 	else encoder.dir = CCW;
+
+	// handwheel: the motor follows right away. Ignored out of that mode
+	motor_handwheel_feed((encoder.dir == CW) ? 1 : -1);
 }
 
 /*===========================================================================*/
@@ -270,10 +274,10 @@ ISR(INT0_vect){
 */
 ISR(PCINT1_vect){
     if((!SWITCH) && (!limit_switch)) {
+    	// slider crashing against the switch: stop right here, not when
+    	// the main loop gets to poll the flag.
+    	motor_halt();
     	limit_switch = TRUE;
-    	// Here, there must be a more elaborate piece of code to handle
-    	// the slider crushing against the switch. Maybe implement a shutdown
-    	// and a reset condition.
     }
     if((!BUTTON) && (!btn.lock))
         btn.query = TRUE;
@@ -29,7 +29,7 @@ void boot(void)
 	ports_init();
 	timer_speed_init();
 	timer_general_init();
-	timer_aux_init();
+	defer_init();
 	encoder_init();
 	limit_switch_init();
 	lcd_init();
@@ -37,6 +37,7 @@ void boot(void)
 	motor_init();
 	
 	uart_set(ENABLE);
+	console_init();
 	timer_general_set(ENABLE);
 
 	// Messasges:
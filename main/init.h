@@ -7,6 +7,8 @@
 ******************************************************************************/
 
 #include "config.h"
+#include "console.h"
+#include "defer.h"
 #include "driver.h"
 #include "encoder.h"
 #include "lcd.h"
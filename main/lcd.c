@@ -16,6 +16,7 @@
 #include "lcd.h"
 
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <stdlib.h>
 #include <util/delay.h>
 
@@ -122,6 +123,21 @@ void lcd_write_str(char *c)
 	}
 }
 
+/*===========================================================================*/
+/*
+* Write a whole string stored in program memory. Stop when finding NULL
+* character. Every literal on screen goes this way: none is copied to SRAM.
+*/
+void lcd_write_str_p(const char *c)
+{
+	char ch;
+
+	while((ch = pgm_read_byte(c)) != '\0'){
+		lcd_write_char(ch);
+		c++;
+	}
+}
+
 /*===========================================================================*/
 /*
 * Place cursor in the given row / column.
@@ -159,20 +175,20 @@ void lcd_screen(screen_t screen)
 
 		case SCREEN_WELCOME:
 			lcd_set_cursor(0,2);
-			lcd_write_str("Slider PRO");
+			lcd_write_str_p(PSTR("Slider PRO"));
 			lcd_set_cursor(1,1);
-			lcd_write_str("David Logreira");
+			lcd_write_str_p(PSTR("David Logreira"));
 			break;
 
 		case SCREEN_HOMING:
 			lcd_clear_screen();
 			lcd_set_cursor(0,3);
-			lcd_write_str("< Homing >");
+			lcd_write_str_p(PSTR("< Homing >"));
 			break;
 
 		case SCREEN_HOMING_DONE:
 			lcd_set_cursor(1,5);
-			lcd_write_str("DONE!");
+			lcd_write_str_p(PSTR("DONE!"));
 			_delay_ms(1000);
 			break;
 	
@@ -180,142 +196,135 @@ void lcd_screen(screen_t screen)
 			pro = motor_get_profile();
 			lcd_clear_screen();
 			lcd_set_cursor(1,0);
-			lcd_write_str("Pos:");
+			lcd_write_str_p(PSTR("Pos:"));
 			lcd_set_cursor(1,8);
-			lcd_write_str("mm");
-			if (pro == PROFILE_LINEAR) {
-				lcd_set_cursor(0,10);
-				lcd_write_str("linear");
-			} else if (pro == PROFILE_QUADRATIC) {
-				lcd_set_cursor(0,7);
-				lcd_write_str("quadratic");
-			}
+			lcd_write_str_p(PSTR("mm"));
+			lcd_write_profile(pro);
 			break;
 
 		case SCREEN_MOTOR_SPEED:
 			pro = motor_get_profile();
 			lcd_clear_screen();
 			lcd_set_cursor(1,0);
-			lcd_write_str("Speed:");
-			lcd_set_cursor(1,11);
-			lcd_write_str("cms/s");
-			if (pro == PROFILE_LINEAR) {
-				lcd_set_cursor(0,10);
-				lcd_write_str("linear");
-			} else if (pro == PROFILE_QUADRATIC) {
-				lcd_set_cursor(0,7);
-				lcd_write_str("quadratic");
-			}
+			lcd_write_str_p(PSTR("Speed:"));
+			lcd_set_cursor(1,12);
+			lcd_write_str_p(PSTR("mm/s"));
+			lcd_write_profile(pro);
 			break;
 
 		case SCREEN_CHOOSE_ACTION:
 			lcd_clear_screen();
-			lcd_write_str(">Create Movement");
+			lcd_write_str_p(PSTR(">Create Movement"));
 			lcd_set_cursor(1,0);
-			lcd_write_str(" Manual Movement");
+			lcd_write_str_p(PSTR(" Manual Movement"));
 			break;
 
 		case SCREEN_CHOOSE_CONTROL_TYPE:
 			lcd_clear_screen();
-			lcd_write_str(">Position ctl.");
+			lcd_write_str_p(PSTR(">Position ctl."));
 			lcd_set_cursor(1,0);
-			lcd_write_str(" Speed ctl.");
+			lcd_write_str_p(PSTR(" Speed ctl."));
 			break;
 
 		case SCREEN_CHOOSE_SPEED_PROFILE:
-			lcd_clear_screen();
-			lcd_write_str("> Linear");
-			lcd_set_cursor(1,0);
-			lcd_write_str("  Quadratic");
+			lcd_update_profile(0);
 			break;
 
 		case SCREEN_FAIL_MESSAGE:
 			lcd_clear_screen();
-			lcd_write_str(" ...ooops =(");
+			lcd_write_str_p(PSTR(" ...ooops =("));
 			lcd_set_cursor(1,0);
-			lcd_write_str(" <ERROR>");
+			lcd_write_str_p(PSTR(" <ERROR>"));
 			break;
 
 		case SCREEN_INITIAL_POSITION:
 			lcd_clear_screen();
 			lcd_set_cursor(0,0);
-			lcd_write_str("Initial");
+			lcd_write_str_p(PSTR("Initial"));
 			lcd_set_cursor(1,0);
-			lcd_write_str("Pos:");
+			lcd_write_str_p(PSTR("Pos:"));
 			lcd_set_cursor(1,8);
-			lcd_write_str("mm");
+			lcd_write_str_p(PSTR("mm"));
 			break;
 
 		case SCREEN_FINAL_POSITION:
 			lcd_clear_screen();
 			lcd_set_cursor(0,0);
-			lcd_write_str("Final");
+			lcd_write_str_p(PSTR("Final"));
 			lcd_set_cursor(1,0);
-			lcd_write_str("Pos:");
+			lcd_write_str_p(PSTR("Pos:"));
 			lcd_set_cursor(1,8);
-			lcd_write_str("mm");
+			lcd_write_str_p(PSTR("mm"));
 			break;
 
 		case SCREEN_CHOOSE_TIME:
 			lcd_clear_screen();
 			lcd_set_cursor(0,0);
-			lcd_write_str("Duration:");
+			lcd_write_str_p(PSTR("Duration:"));
 			break;
 
 		case SCREEN_CHOOSE_REPS:
 			lcd_clear_screen();
 			lcd_set_cursor(0,0);
-			lcd_write_str("Repetitions:");
+			lcd_write_str_p(PSTR("Repetitions:"));
 			lcd_set_cursor(1,0);
-			lcd_write_str("    times");
+			lcd_write_str_p(PSTR("    times"));
 			break;
 
 		case SCREEN_CHOOSE_LOOP:
 			lcd_clear_screen();
 			lcd_set_cursor(0,0);
-			lcd_write_str("Loop:");
+			lcd_write_str_p(PSTR("Loop:"));
 			lcd_set_cursor(1,0);
-			lcd_write_str(" FALSE");
+			lcd_write_str_p(PSTR(" FALSE"));
 			break;
 
 		case SCREEN_CHOOSE_ACCEL:
 			lcd_clear_screen();
 			lcd_set_cursor(0,0);
-			lcd_write_str("Accel:");
+			lcd_write_str_p(PSTR("Accel:"));
 			lcd_set_cursor(1,0);
-			lcd_write_str("    %");
+			lcd_write_str_p(PSTR("    %"));
 			break;
 
 		case SCREEN_WAIT_TO_GO:
 			lcd_clear_screen();
 			lcd_set_cursor(0,0);
-			lcd_write_str("  PRESS TO GO!  ");
+			lcd_write_str_p(PSTR("  PRESS TO GO!  "));
 			lcd_set_cursor(1,0);
-			lcd_write_str(" cam @ init pos ");
+			lcd_write_str_p(PSTR(" cam @ init pos "));
 			break;
 
 		case SCREEN_GO:
 			lcd_clear_screen();
 			lcd_set_cursor(0,0);
-			lcd_write_str("> GO!!!");
+			lcd_write_str_p(PSTR("> GO!!!"));
 			lcd_set_cursor(1,0);
-			lcd_write_str("time:");
+			lcd_write_str_p(PSTR("time:"));
 			break;		
 
 		case SCREEN_FINISHED:
 			lcd_set_cursor(0,0);
-			lcd_write_str("> FINISHED");
+			lcd_write_str_p(PSTR("> FINISHED"));
 			lcd_set_cursor(0,12);
-			lcd_write_str("100%");
+			lcd_write_str_p(PSTR("100%"));
 			lcd_set_cursor(1,10);
-			lcd_write_str("reset?");
+			lcd_write_str_p(PSTR("reset?"));
 			break;		
 
 		case SCREEN_STOP:
 			lcd_set_cursor(0,0);
-			lcd_write_str("> STOPPED  ");
+			lcd_write_str_p(PSTR("> STOPPED  "));
 			lcd_set_cursor(1,10);
-			lcd_write_str("reset?");
+			lcd_write_str_p(PSTR("reset?"));
+			break;
+
+		case SCREEN_RAM:
+			lcd_clear_screen();
+			lcd_set_cursor(0,0);
+			lcd_write_str_p(PSTR("RAM free:"));
+			lcd_set_cursor(1,0);
+			lcd_write_str_p(PSTR("Stack peak:"));
 			break;				
 	}
 }
@@ -323,61 +332,35 @@ void lcd_screen(screen_t screen)
 /*===========================================================================*/
 /*
 * Updates the speed at which the motor is moving.
-* Input units are steps/second. It is converted to mm/sec, and displayed.
+* Input units are 0.1mm/s (see units_speed()), displayed with one decimal.
 */
 void lcd_update_speed(uint16_t speed)
 {
-	// used to convert OCR1A value to cms_per_second
-	float freq, rps, f_speed;
-	// used to display speed
-	uint8_t integer, decimal;
-	char integer_str[5], decimal_str[5];
-	float float_part;
-	// system constants
-	static const float f_motor = (float)F_MOTOR;
-	static const float steps_per_rev = (float)STEPS_PER_REV;
-	static const float cms_per_rev = (float)CMS_PER_REV;
-
-	f_speed = (float)speed;
-	if(speed != 0){
-		freq = f_motor/(f_speed + 1.0);		// pulses frequency
-		rps = freq / steps_per_rev;			// revolutions per second
-		f_speed = rps * cms_per_rev;		// centimeters per second
-	}
-
-	integer = (uint8_t)f_speed;				// Extract integer part
-	float_part = f_speed - (float)integer;	// Extract floating part
-	decimal = (uint8_t)(float_part * 100.0);// two decimal digits
-
-	itoa(integer, integer_str, 10);			// convert integer part to string
-	itoa(decimal, decimal_str, 10);			// convert decimal part to string
+	char str[6];
 
 	lcd_set_cursor(1,6);
-	lcd_write_str("     ");
+	lcd_write_str_p(PSTR("     "));
 	lcd_set_cursor(1,6);
-	lcd_write_str(integer_str);
+	utoa(speed / 10, str, 10);
+	lcd_write_str(str);
 	lcd_write_char('.');
-	if(decimal < 10)
-		lcd_write_char('0');	
-	lcd_write_str(decimal_str);
+	utoa(speed % 10, str, 10);
+	lcd_write_str(str);
 }
 
 /*===========================================================================*/
 /*
 * Updates the current slider position.
-* Input units are N° of steps, and it converts it into millimeters.
+* Input units are millimeters (see units_mm()).
 */
-void lcd_update_position(int32_t pos)
+void lcd_update_position(int16_t pos)
 {
-	// used to display speed
-	char str[5];
-	
-	pos =	pos / ((STEPS_PER_REV / CMS_PER_REV) / 10);
+	char str[7];
 
 	itoa(pos, str, 10);			// convert to string
 	
 	lcd_set_cursor(1,4);
-	lcd_write_str("    ");
+	lcd_write_str_p(PSTR("    "));
 	if (pos < 10) lcd_set_cursor(1,7);			// one digit
 	else if (pos < 100) lcd_set_cursor(1,6);	// two digits
 	else if (pos < 1000) lcd_set_cursor(1,5);	// three digits
@@ -385,6 +368,27 @@ void lcd_update_position(int32_t pos)
 	lcd_write_str(str);
 }
 
+/*===========================================================================*/
+/*
+* Handwheel gear, as the slider travel per encoder detent: 0.1mm resolution.
+* Top left corner of the position screen.
+*/
+void lcd_update_gear(uint16_t steps)
+{
+	char str[6];
+	uint16_t t = (uint32_t)steps * 100 / (STEPS_PER_REV / CMS_PER_REV);
+
+	lcd_set_cursor(0,0);
+	lcd_write_str_p(PSTR("       "));
+	lcd_set_cursor(0,0);
+	utoa(t / 10, str, 10);
+	lcd_write_str(str);
+	lcd_write_char('.');
+	utoa(t % 10, str, 10);
+	lcd_write_str(str);
+	lcd_write_str_p(PSTR("mm"));
+}
+
 /*===========================================================================*/
 /*
 * Displays the movement duaration values.
@@ -397,7 +401,7 @@ void lcd_update_time(float time)
 	char str[6];
 
 	lcd_set_cursor(1,0);
-	lcd_write_str("      ");
+	lcd_write_str_p(PSTR("      "));
 	lcd_set_cursor(1,0);
 	if (time < 60.0) {
 		// display as is
@@ -438,12 +442,53 @@ void lcd_update_reps(uint8_t r)
 	char str[6];
 
 	lcd_set_cursor(1,0);
-	lcd_write_str("    ");
+	lcd_write_str_p(PSTR("    "));
 	lcd_set_cursor(1,1);
 	itoa((int16_t)r, str, 10);
 	lcd_write_str(str);
 }
 
+/*===========================================================================*/
+/*
+* Speed profile list: 4 options, two per screen. 'i' is the option selected,
+* from 0 (first profile) to 3.
+*/
+void lcd_update_profile(uint8_t i)
+{
+	static const char names[][12] PROGMEM = {
+		"Linear", "Quadratic", "Sine", "Ease in-out"
+	};
+	uint8_t first = i & ~1;
+
+	lcd_clear_screen();
+	lcd_write_str_p((i == first) ? PSTR("> ") : PSTR("  "));
+	lcd_write_str_p(names[first]);
+	lcd_set_cursor(1,0);
+	lcd_write_str_p((i != first) ? PSTR("> ") : PSTR("  "));
+	lcd_write_str_p(names[first + 1]);
+}
+
+/*===========================================================================*/
+/*
+* Speed profile name, right aligned on the first row of the motor screens.
+*/
+void lcd_write_profile(uint8_t pro)
+{
+	if (pro == PROFILE_LINEAR) {
+		lcd_set_cursor(0,10);
+		lcd_write_str_p(PSTR("linear"));
+	} else if (pro == PROFILE_QUADRATIC) {
+		lcd_set_cursor(0,7);
+		lcd_write_str_p(PSTR("quadratic"));
+	} else if (pro == PROFILE_SINE) {
+		lcd_set_cursor(0,12);
+		lcd_write_str_p(PSTR("sine"));
+	} else if (pro == PROFILE_SMOOTH) {
+		lcd_set_cursor(0,12);
+		lcd_write_str_p(PSTR("ease"));
+	}
+}
+
 /*===========================================================================*/
 /*
 * Toggles between TRUE or FALSE
@@ -451,8 +496,8 @@ void lcd_update_reps(uint8_t r)
 void lcd_update_loop(uint8_t l)
 {
 	lcd_set_cursor(1,1);
-	if (l) lcd_write_str("TRUE ");
-	else lcd_write_str("FALSE");
+	if (l) lcd_write_str_p(PSTR("TRUE "));
+	else lcd_write_str_p(PSTR("FALSE"));
 }
 
 /*===========================================================================*/
@@ -467,7 +512,7 @@ void lcd_update_time_moving(uint16_t t)
 	char str[6];
 
 	lcd_set_cursor(1,5);
-	lcd_write_str("      ");
+	lcd_write_str_p(PSTR("      "));
 	lcd_set_cursor(1,5);
 
 	if (t < 60) {
@@ -508,7 +553,7 @@ void lcd_update_percent(int8_t percentage)
 	char str[5];
 
 	lcd_set_cursor(0,12);
-	lcd_write_str("   ");
+	lcd_write_str_p(PSTR("   "));
 	lcd_set_cursor(0,12);
 
 	itoa(percentage, str, 10);
@@ -516,6 +561,27 @@ void lcd_update_percent(int8_t percentage)
 	lcd_write_char('%');
 }
 
+/*===========================================================================*/
+/*
+* RAM debug screen: free RAM and stack high water mark, in bytes.
+*/
+void lcd_update_ram(uint16_t free, uint16_t peak)
+{
+	char str[6];
+
+	lcd_set_cursor(0,12);
+	lcd_write_str_p(PSTR("    "));
+	lcd_set_cursor(0,12);
+	utoa(free, str, 10);
+	lcd_write_str(str);
+
+	lcd_set_cursor(1,12);
+	lcd_write_str_p(PSTR("    "));
+	lcd_set_cursor(1,12);
+	utoa(peak, str, 10);
+	lcd_write_str(str);
+}
+
 /*===========================================================================*/
 /*
 * Miscelaneous. Just writes LOOP (as opposed to writting the percentage)
@@ -523,5 +589,5 @@ void lcd_update_percent(int8_t percentage)
 void lcd_write_loop(void)
 {
 	lcd_set_cursor(0,11);
-	lcd_write_str("LOOP ");
+	lcd_write_str_p(PSTR("LOOP "));
 }
\ No newline at end of file
@@ -41,7 +41,8 @@ typedef enum {
 	SCREEN_GO,
 	SCREEN_FINISHED,
 	SCREEN_STOP,
-	SCREEN_FAIL_MESSAGE
+	SCREEN_FAIL_MESSAGE,
+	SCREEN_RAM
 } screen_t;
 
 /******************************************************************************
@@ -52,17 +53,22 @@ void lcd_send_byte(uint8_t rs, uint8_t data);
 void lcd_init(void);
 void lcd_write_char(char c);
 void lcd_write_str(char *c);
+void lcd_write_str_p(const char *c);
 void lcd_set_cursor(uint8_t row, uint8_t column);
 void lcd_clear_screen(void);
 
 void lcd_screen(screen_t screen);
 void lcd_update_speed(uint16_t speed);
-void lcd_update_position(int32_t pos);
+void lcd_update_position(int16_t pos);
+void lcd_update_gear(uint16_t steps);
 void lcd_update_time(float t);
 void lcd_update_reps(uint8_t r);
 void lcd_update_loop(uint8_t l);
+void lcd_update_profile(uint8_t i);
+void lcd_write_profile(uint8_t pro);
 void lcd_update_time_moving(uint16_t t);
 void lcd_update_percent(int8_t percentage);
+void lcd_update_ram(uint16_t free, uint16_t peak);
 
 void lcd_write_loop(void);
 
@@ -83,6 +83,11 @@ int main(void)
 		*		- Linear profile
 		*		- Quadratic profile
 		*/
+		// Limit switch hit outside of the homing cycle: the motor was already
+		// halted by the switch ISR, and the slider position can't be trusted
+		if (motor_fault() && (system_state != STATE_HOMING))
+			system_state = STATE_FAIL;
+
 		switch(system_state){
 
 			/* 
@@ -103,7 +108,7 @@ int main(void)
 			*		the rotary encoder
 			*/
 			case STATE_CHOOSE_ACTION:		// Automatic or Manual movement
-				if (choose_action()) system_state = STATE_MANUAL_MOVEMENT;	// Manual Movement
+				if (menu_run(MENU_ACTION)) system_state = STATE_MANUAL_MOVEMENT;	// Manual Movement
 				else system_state = STATE_CREATE_MOVEMENT;					// Create Movement
 				break;
 
@@ -114,21 +119,23 @@ int main(void)
 				* 	- Position control: encoder varies the slider position 
 				* 	- Speed control: encoder varies the slider speed
 				*/
-				x = choose_control_type();
+				x = menu_run(MENU_CONTROL_TYPE);
 				if (x < 0) {
 					system_state = STATE_CHOOSE_ACTION;
 					break;
 				}
 
 				/*
-				* CHOOSE SPEED PROFILE: Two options are displayed:
+				* CHOOSE SPEED PROFILE: Four options are displayed:
 				* 	- Linear: Speed increases/decreases linearly
 				* 	- Quadratic: Speed increases/decreases as in a squared function
 				* 		This profile is less sensible at low speeds and more
 				*		sensible at high speeds
+				*	- Sine & Ease in-out: easing curves. Only movements started
+				*		from standstill follow them.
 				*/
 				// STATE_CHOOSE_SPEED_PROFILE
-				if(choose_speed_profile() < 0) {
+				if(menu_run(MENU_SPEED_PROFILE) < 0) {
 					system_state = STATE_CHOOSE_ACTION;
 					break;
 				}
@@ -181,13 +188,25 @@ int main(void)
 					automatic.final_pos = x;
 				}
 
+				/*
+				* SPEED PROFILE: ramps (linear, quadratic) or easing curves
+				* (sine, ease in-out) for the whole movement. Chosen before
+				* the acceleration, which depends on it.
+				*/
+				if (menu_run(MENU_SPEED_PROFILE) < 0) {
+					system_state = STATE_CHOOSE_ACTION;
+					break;
+				} else {
+					automatic.profile = motor_get_profile();
+				}
+
 				/*
 				* ACCELERATION: percentage of acceleration range.
 				* Maximum and minimum acceleration are constrained by physical
 				* and mathematical restrictions of the motor and the algorithm
 				* respectively.
 				*/
-				x = user_set_accel();
+				x = menu_run(MENU_ACCEL);
 				if (x < 0) {
 					system_state = STATE_CHOOSE_ACTION;
 					break;
@@ -214,7 +233,7 @@ int main(void)
 				* If reps > 1: slider moves back and forth from init to final
 				* 	position, once per repetition selected.
 				*/
-				x = user_set_reps();
+				x = menu_run(MENU_REPS);
 				if (x < 0) {
 					system_state = STATE_CHOOSE_ACTION;
 					break;
@@ -227,7 +246,7 @@ int main(void)
 				* final position, and back again to initial position, and repeat
 				* this cycle forever, ignoring the REPEAT parameter
 				*/
-				x = user_set_loop();
+				x = menu_run(MENU_LOOP);
 				if (x < 0) {
 					system_state = STATE_CHOOSE_ACTION;
 					break;
@@ -270,8 +289,9 @@ int main(void)
 			* screen message
 			*/
 			case STATE_FAIL:
-				fail_message();
-				system_state = STATE_CHOOSE_ACTION;
+				menu_run(MENU_FAIL);
+				if (motor_fault()) system_state = STATE_HOMING;
+				else system_state = STATE_CHOOSE_ACTION;
 				break;
 			
 			default:
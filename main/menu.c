@@ -1,10 +1,13 @@
-
 /*
 * This file contains all the system states' functions that handle the motor
 * movement configuration menus, but the motor itself is not movig with these
 * functions.
 * This is in constrast to the move.c file that includes the system states 
 * functions where the motor is moving.
+*
+* Most menus just choose a value with the encoder: they're descriptors in
+* program memory (menus[]), all of them run by the same loop (menu_run()).
+* Menus with their own logic share its event loop step (menu_event()).
 */
 
 /******************************************************************************
@@ -16,20 +19,40 @@
 #include <avr/pgmspace.h>
 #include <util/delay.h>
 #include <stdlib.h>
+#include <string.h>
 
 /******************************************************************************
 *******************	C O N S T A N T S  D E F I N I T I O N S ******************
 ******************************************************************************/
 
-// Used to store the possible time values that the user will choose from, to
-// set the duration for every movement. Half of them are sequential and half
-// of them are not. The code cost of implementing one part of the range using
-// counters and the other part using vectors is higher than to have all of
-// the values stored in the same place. 
-static const uint16_t t[] PROGMEM = {
-	1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20,
-	30, 45, 60, 80, 100, 120, 180, 300, 600, 1200, 2400, 3600, 7200, 14400,
-	21600, 28800, 36000, 43200
+// The possible time values that the user will choose from, to set the
+// duration for every movement, are stored in the motion_t[] vector. It is
+// generated at build time, cut at the longest movement the slider can do.
+// Half of them are sequential and half of them are not. The code cost of
+// implementing one part of the range using counters and the other part using
+// vectors is higher than to have all of the values stored in the same place. 
+#define T_LEN	(sizeof(motion_t)/sizeof(uint16_t))
+
+// Menu flags
+#define MENU_WRAP		0x01	// the value wraps around the range: toggles
+#define MENU_BACK		0x02	// a long press goes back
+#define MENU_RAM		0x04	// a long press shows the RAM debug screen
+
+/******************************************************************************
+***************** S T R U C T U R E   D E C L A R A T I O N S ****************
+******************************************************************************/
+
+// Menu descriptor: a value chosen with the encoder
+struct menu_s {
+	uint8_t screen;				// screen_t preset drawn on entry
+	int8_t init;				// value on entry
+	int8_t min;
+	int8_t max;
+	int8_t step;				// value change per encoder detent
+	uint8_t flags;
+	void (*show)(uint8_t v);	// value display, or NULL
+	void (*apply)(uint8_t v);	// value applied as it's chosen, or NULL
+	const char *name;			// debug trace, program memory
 };
 
 /******************************************************************************
@@ -37,188 +60,137 @@ static const uint16_t t[] PROGMEM = {
 ******************************************************************************/
 
 static int32_t find_speed_from_time(float a, float t, float x);
+static void show_cursor(uint8_t v);
+static void set_profile(uint8_t v);
+static void set_accel(uint8_t v);
+static void ram_screen(void);
 
-/*===========================================================================*/
-/*
-* User chooses what to do:
-* - Create a movement
-* - Perform a manual movement
-* Both options are presented on the LCD. Option is selected using the rotary 
-* encoder plus the switch included with the encoder. 
-*/
-int8_t choose_action(void)
-{
-	uint8_t toggle = FALSE;
-	uint16_t x;
-	struct btn_s *btn = button_get();
-	struct enc_s *encoder = encoder_get();
-
-	lcd_screen(SCREEN_CHOOSE_ACTION);
-	DEBUG_P("\n\r> Automatic or Manual Action");
-
-	while(TRUE){
+/******************************************************************************
+****************** V A R I A B L E S   D E F I N I T I O N S ******************
+******************************************************************************/
 
-		// timing for loop execution
-		clear_millis();
-		x = 0;
-		while(!x) x = millis();
+static const char name_action[] PROGMEM = "\n\r> Automatic or Manual Action";
+static const char name_control[] PROGMEM = "\n\r> Position or Speed Control";
+static const char name_profile[] PROGMEM = "\n\r> Speed profile";
+static const char name_reps[] PROGMEM = "\n\r> Repetitions";
+static const char name_loop[] PROGMEM = "\n\r> Loop";
+static const char name_accel[] PROGMEM = "\n\r> Acceleration";
+static const char name_fail[] PROGMEM = "\n\r> Fail";
 
-		// lcd options
-		if(encoder->update){
-			encoder->update = FALSE;
-			toggle ^= 1;
-			if(toggle){
-				lcd_set_cursor(0,0);
-				lcd_write_str(" ");
-				lcd_set_cursor(1,0);
-				lcd_write_str(">");
-			} else {
-				lcd_set_cursor(0,0);
-				lcd_write_str(">");
-				lcd_set_cursor(1,0);
-				lcd_write_str(" ");
-			}
-		}
-		
-		// Check encoder button
-		if(btn->query) button_check();
-		
-		// Check action to be taken
-		if((btn->action) && (btn->state == BTN_RELEASED) && (!btn->delay1)){
-			btn->action = FALSE;
-			break;
-		}
-	}	
+/*
+* Menus, in menu_t order:
+* - Action: create a movement (0), or perform a manual movement (1). A long
+*	press shows the RAM debug screen
+* - Control type: position control (0), or speed control (1)
+* - Speed profile: listed in PROFILE_xxx order. Linear and quadratic ramps, 
+*	sine and ease in-out easing curves for the whole movement. Manual moves
+*	only ease from standstill, see motor.c
+* - Repetitions: from 1 to 20. One repetition moves from the initial to the
+*	final position; more than one go back to the initial position each time.
+* - Loop: if TRUE, the N° of repetitions is ignored and the movement is
+*	performed indefinitely.
+* - Acceleration: percentage of the acceleration range, 0% means MINIMUM 
+*	acceleration and 100% means MAXIMUM (see motor.c)
+* - Fail: just waits for the user to press the button
+*/
+static const struct menu_s menus[] PROGMEM = {
+	[MENU_ACTION] = {SCREEN_CHOOSE_ACTION, 0, 0, 1, 1, MENU_WRAP | MENU_RAM,
+		show_cursor, NULL, name_action},
+	[MENU_CONTROL_TYPE] = {SCREEN_CHOOSE_CONTROL_TYPE, 0, 0, 1, 1,
+		MENU_WRAP | MENU_BACK, show_cursor, NULL, name_control},
+	[MENU_SPEED_PROFILE] = {SCREEN_CHOOSE_SPEED_PROFILE, 0, 0, 3, 1, MENU_BACK,
+		lcd_update_profile, set_profile, name_profile},
+	[MENU_REPS] = {SCREEN_CHOOSE_REPS, 1, 1, 20, 1, MENU_BACK,
+		lcd_update_reps, NULL, name_reps},
+	[MENU_LOOP] = {SCREEN_CHOOSE_LOOP, FALSE, 0, 1, 1, MENU_WRAP | MENU_BACK,
+		lcd_update_loop, NULL, name_loop},
+	[MENU_ACCEL] = {SCREEN_CHOOSE_ACCEL, 100, 0, 100, 5, MENU_BACK,
+		lcd_update_reps, set_accel, name_accel},
+	[MENU_FAIL] = {SCREEN_FAIL_MESSAGE, 0, 0, 0, 0, 0,
+		NULL, NULL, name_fail},
+};
 
-	return toggle;
-}
+_Static_assert(sizeof(menus) / sizeof(menus[0]) == MENUS, "Menu descriptors");
 
 /*===========================================================================*/
 /*
-* Select control type:
-* - position control
-* - speed control
-* Both options are presented on the LCD. Option is selected using the rotary 
-* encoder plus the switch included with the encoder. 
+* Shared event loop of all the menus, one step: sleeps until the next 1ms 
+* tick (the background task runs meanwhile, see wait_millis()), and checks
+* the encoder and its button. Returns a single event: encoder detents come
+* first, button actions are kept until they're returned.
 */
-int8_t choose_control_type(void)
+uint8_t menu_event(void)
 {
-	int8_t toggle = FALSE;
-	uint16_t x;
 	struct btn_s *btn = button_get();
 	struct enc_s *encoder = encoder_get();
-	
-	// LCD screen
-	lcd_screen(SCREEN_CHOOSE_CONTROL_TYPE);
-	DEBUG_P("\n\r> Position or Speed Control");
 
-	while(TRUE){
+	clear_millis();
+	wait_millis();
 
-		// timing for loop execution
-		clear_millis();
-		x = 0;
-		while(!x) x = millis();
-		
-		// lcd options
-		if(encoder->update){
-			encoder->update = FALSE;
-			toggle ^= 1;
-			if(toggle){		// Speed control
-				lcd_set_cursor(0,0);
-				lcd_write_str(" ");
-				lcd_set_cursor(1,0);
-				lcd_write_str(">");
-			} else {		// Position control
-				lcd_set_cursor(0,0);
-				lcd_write_str(">");
-				lcd_set_cursor(1,0);
-				lcd_write_str(" ");
-			}
-		}
-		
-		// Check encoder button
-		if(btn->query) button_check();
-		
-		// Check action to be taken
-		if((btn->action) && (btn->state == BTN_RELEASED) && (!btn->delay1)){
-			btn->action = FALSE;
-			break;
-		}
-		if((btn->action) && (btn->delay3)){
-			btn->action = FALSE;
-			toggle = -1;
-			break;
-		}
+	// Check encoder button
+	if(btn->query) button_check();
+
+	if(encoder->update){
+		encoder->update = FALSE;
+		return (encoder->dir == CW) ? MENU_EVT_CW : MENU_EVT_CCW;
+	}
+	if((btn->action) && (btn->state == BTN_RELEASED) && (!btn->delay1)){
+		btn->action = FALSE;
+		return MENU_EVT_PRESS;
+	}
+	if((btn->action) && (btn->delay3)){
+		btn->action = FALSE;
+		return MENU_EVT_HOLD;
 	}
 
-	return toggle;
+	return MENU_EVT_NONE;
 }
 
 /*===========================================================================*/
 /*
-* Select movement type:
-* - linear movement: increments/decrements are based on a fixed amount
-* - exponential movement: increments/decrements are variable with a quadratic
-*	profile
-* Both options are presented on the LCD. Option is selected using the rotary 
-* encoder plus the switch included with the encoder. 
+* Runs a menu: a value chosen with the encoder, within the range of its
+* descriptor, and confirmed with a short press of the encoder button. A long
+* press goes back (returns -1), if the menu allows it.
+* The value is displayed and applied as it's chosen, and once on entry.
 */
-int8_t choose_speed_profile(void)
+int8_t menu_run(menu_t id)
 {
-	int8_t toggle = FALSE;
-	uint16_t x;
-	struct btn_s *btn = button_get();
-	struct enc_s *encoder = encoder_get();
-	
-	// LCD screen
-	lcd_screen(SCREEN_CHOOSE_SPEED_PROFILE);
-	DEBUG_P("\n\r> Linear or Quadratic profile");
+	struct menu_s m;
+	int8_t v;
+	uint8_t ev;
 
-	// default profile: Linear
-	motor_set_speed_profile(PROFILE_LINEAR);
+	memcpy_P(&m, &menus[id], sizeof(m));
+	v = m.init;
+
+	lcd_screen(m.screen);
+	uart_send_string_p(m.name);
+	if (m.show) m.show(v);
+	if (m.apply) m.apply(v);
 
 	while(TRUE){
 
-		// timing for loop execution
-		clear_millis();
-		x = 0;
-		while(!x) x = millis();
-		
-		// lcd options
-		if(encoder->update){
-			encoder->update = FALSE;
-			toggle ^= 1;
-			if(toggle){
-				lcd_set_cursor(0,0);
-				lcd_write_str(" ");
-				lcd_set_cursor(1,0);
-				lcd_write_str(">");
-				motor_set_speed_profile(PROFILE_QUADRATIC);
-			} else {
-				lcd_set_cursor(0,0);
-				lcd_write_str(">");
-				lcd_set_cursor(1,0);
-				lcd_write_str(" ");
-				motor_set_speed_profile(PROFILE_LINEAR);
-			}
-		}
-		
-		// Check encoder button
-		if(btn->query) button_check();
-		
-		// Check action to be taken
-		if((btn->action) && (btn->state == BTN_RELEASED) && (!btn->delay1)){
-			btn->action = FALSE;
+		ev = menu_event();
+
+		if ((ev == MENU_EVT_CW) || (ev == MENU_EVT_CCW)) {
+			if (m.min == m.max) continue;
+			v += (ev == MENU_EVT_CW) ? m.step : -m.step;
+			if (v > m.max) v = (m.flags & MENU_WRAP) ? m.min : m.max;
+			else if (v < m.min) v = (m.flags & MENU_WRAP) ? m.max : m.min;
+			if (m.show) m.show(v);
+			if (m.apply) m.apply(v);
+		} else if (ev == MENU_EVT_PRESS) {
 			break;
-		}
-		if((btn->action) && (btn->delay3)){
-			btn->action = FALSE;
-			toggle = -1;
+		} else if ((ev == MENU_EVT_HOLD) && (m.flags & MENU_BACK)) {
+			v = -1;
 			break;
+		} else if ((ev == MENU_EVT_HOLD) && (m.flags & MENU_RAM)) {
+			ram_screen();
+			lcd_screen(m.screen);
+			if (m.show) m.show(v);
 		}
 	}
 
-	return toggle;
+	return v;
 }
 
 /*-----------------------------------------------------------------------------
@@ -235,8 +207,8 @@ int8_t choose_speed_profile(void)
 * - Minimum time allowed: computed and shown to the user, based on the initial,
 * final point, and the acceleration value previously set by the user.
 * - Maximum time allowed: computed and shown to the user, based on the initial,
-* final point, and the maximum value that the timer-compare register can store,
-* without changing the timer operating frequency.
+* final point, and the longest period the motor timer can run (maximum
+* timer-compare register value at the coarsest timer prescaler).
 *
 * NOTE: time selected only accounts for the time spent in one single movement,
 * that is, movement from initial to final position (or vice-versa). It doesn't
@@ -247,9 +219,7 @@ int32_t user_set_time(int32_t xi, int32_t xo)
 	uint8_t i = 0;
 	float time;
 	int32_t speed = 0;
-	uint16_t x;
-	struct btn_s *btn = button_get();
-	struct enc_s *encoder = encoder_get();
+	uint8_t ev;
 
 	DEBUG_P("\n\r> Time duration");
 
@@ -276,44 +246,54 @@ int32_t user_set_time(int32_t xi, int32_t xo)
 	float x_ramp = ac * pow(t_ramp, 2.0) / 2.0;
 	float x_tot = fabs(xo - xi);		// absolute value
 	float t_min;
-
-	if (x_tot > 2.0 * x_ramp)
+	uint8_t pro = motor_get_profile();
+	float ease_v = (pro == PROFILE_SINE) ? EASE_SINE_V : EASE_SMOOTH_V;
+	float ease_a = (pro == PROFILE_SINE) ? EASE_SINE_A : EASE_SMOOTH_A;
+
+	if (PROFILE_EASING(pro)) {
+		// Easing profiles: no constant speed phase. Peak speed and peak
+		// acceleration, both proportional to the distance, bound the time.
+		t_min = ease_v * x_tot / SPEED_MAX;
+		if (sqrt(ease_a * x_tot / ac) > t_min)
+			t_min = sqrt(ease_a * x_tot / ac);
+	} else if (x_tot > 2.0 * x_ramp) {
 		t_min = (2.0 * t_ramp) + (x_tot - (2.0 * x_ramp)) / SPEED_MAX;
-	else
+	} else {
 		t_min = 2.0 * sqrt((2.0 * (x_tot / 2.0)) / ac);
+	}
 
 	/*
 	* Compute maximum time allowed based on the minimum speed at which the
-	* slider is able to move (maximum OCR1A value, w/out changing f)
+	* slider is able to move (maximum OCR1A value, at the coarsest prescaler)
 	*/
 	float t_max = x_tot / SPEED_MIN;
 		
 	//DEBUG CODE:
 	char str[12];
 	ltoa((int32_t)ac, str, 10);
-	DEBUG("\n\rac: ");
+	DEBUG_P("\n\rac: ");
 	DEBUG(str);
 	dtostre(t_ramp, str, 3, 0x00);
-	DEBUG("\n\rt_ramp: ");
+	DEBUG_P("\n\rt_ramp: ");
 	DEBUG(str);
 	ltoa((int32_t)x_ramp, str, 10);
-	DEBUG("\n\rx_ramp: ");
+	DEBUG_P("\n\rx_ramp: ");
 	DEBUG(str);
 	ltoa((int32_t)x_tot, str, 10);
-	DEBUG("\n\rx_tot: ");
+	DEBUG_P("\n\rx_tot: ");
 	DEBUG(str);
 	dtostre(t_min, str, 3, 0x00);
-	DEBUG("\n\rt_min: ");
+	DEBUG_P("\n\rt_min: ");
 	DEBUG(str);
 	dtostre(t_max, str, 3, 0x00);
-	DEBUG("\n\rt_max: ");
+	DEBUG_P("\n\rt_max: ");
 	DEBUG(str);
 
-	// Choose the minimum index allowed from the "t[]" vector.
+	// Choose the minimum index allowed from the "motion_t[]" vector.
 	// minimum index is the value of minimum time (in seconds) rounded to 
 	// the lower integer
-	for (uint8_t m = 0; m < sizeof(t)/sizeof(uint16_t); m++) {
-		float v = pgm_read_word(&t[m]);
+	for (uint8_t m = 0; m < T_LEN; m++) {
+		float v = pgm_read_word(&motion_t[m]);
 		if (v > t_min) {
 			if (m > 0) i = m - 1;
 			else i = 0;
@@ -328,53 +308,43 @@ int32_t user_set_time(int32_t xi, int32_t xo)
 
 	while(TRUE){
 
-		// timing for loop execution
-		clear_millis();
-		x = 0;
-		while(!x) x = millis();
+		ev = menu_event();
 		
 		// lcd options
-		if (encoder->update) {
-			encoder->update = FALSE;
-			float v = (float)pgm_read_word(&t[i]);
-			if (encoder->dir == CW) {
-				if (i < sizeof(t)/sizeof(uint16_t))
+		if ((ev == MENU_EVT_CW) || (ev == MENU_EVT_CCW)) {
+			float v = (float)pgm_read_word(&motion_t[i]);
+			if (ev == MENU_EVT_CW) {
+				if (i < (T_LEN - 1))
 					if (v < t_max)
 						i++;
-			} else if (encoder->dir == CCW) {
+			} else {
 				if (i > 0)
 					if (v > t_min)
 						i--;
 			}
 
 			// Check allowed time range
-			v = (float)pgm_read_word(&t[i]);
+			v = (float)pgm_read_word(&motion_t[i]);
 			if (v >= t_max)	time = t_max;
 			else if (v <= t_min) time = t_min;
 			else time = v;
 
 			lcd_update_time(time);
-		}
-		
-		// Check encoder button
-		if(btn->query) button_check();
-		
-		// Check action to be taken
-		if((btn->action) && (btn->state == BTN_RELEASED) && (!btn->delay1)){
-			btn->action = FALSE;
+		} else if (ev == MENU_EVT_PRESS) {
 			break;
-		}
-		if((btn->action) && (btn->delay3)){
-			btn->action = FALSE;
+		} else if (ev == MENU_EVT_HOLD) {
 			speed = -1;
 			break;
 		}
 	}
 
-	// Find the speed value from the duration the user selected.
+	// Find the speed value from the duration the user selected. Easing
+	// movements last as long as their peak speed allows.
 	if (speed != -1) {
-		if (time == t_min)
-			speed = SPEED_MAX;
+		if (PROFILE_EASING(pro))
+			speed = (int32_t)(ease_v * x_tot / time * AUTO_SPEED_SCALE);
+		else if (time == t_min)
+			speed = SPEED_MAX * AUTO_SPEED_SCALE;
 		else
 			speed = find_speed_from_time(ac, time, x_tot);
 	}
@@ -382,209 +352,6 @@ int32_t user_set_time(int32_t xi, int32_t xo)
 	return speed;
 }
 
-/*===========================================================================*/
-/*
-* Repetitions: User can choose from 1 to 20 repetitions.
-* reps = 1: Slider will only move from initial to final position.
-* reps > 1: Slider will move from initia to final position, and back to initial
-*	position. This cycle accounts for 1 repetition. It will be repeated the N°
-* 	of times the user may choose.
-*/
-int8_t user_set_reps(void)
-{
-	int8_t i = 1;
-	uint16_t x;
-	struct btn_s *btn = button_get();
-	struct enc_s *encoder = encoder_get();
-	
-	// LCD screen
-	lcd_screen(SCREEN_CHOOSE_REPS);
-	lcd_update_reps(i);
-	DEBUG_P("\n\r> Repetitions");
-
-	while(TRUE){
-
-		// timing for loop execution
-		clear_millis();
-		x = 0;
-		while(!x) x = millis();
-		
-		// lcd options
-		if (encoder->update) {
-			encoder->update = FALSE;
-			if (encoder->dir == CW) {
-				if (i < 20)
-					i++;
-			} else if (encoder->dir == CCW) {
-				if (i > 1)
-					i--;
-			}
-			lcd_update_reps(i);
-		}
-		
-		// Check encoder button
-		if(btn->query) button_check();
-		
-		// Check action to be taken
-		if((btn->action) && (btn->state == BTN_RELEASED) && (!btn->delay1)){
-			btn->action = FALSE;
-			break;
-		}
-		if((btn->action) && (btn->delay3)){
-			btn->action = FALSE;
-			i = -1;
-			break;
-		}
-	}
-
-	return i;
-}
-
-/*===========================================================================*/
-/*
-* Loop flag: 
-* - If loop is TRUE, then the N° of repetitions is ignored and the movement is
-* performed indefinitely.
-* - If loop is FALSE, then the movement is only performed according to the N°
-* of repetitions selected.
-*/
-int8_t user_set_loop(void)
-{
-	uint8_t toggle = FALSE;
-	uint16_t x;
-	struct btn_s *btn = button_get();
-	struct enc_s *encoder = encoder_get();
-	
-	// LCD screen
-	lcd_screen(SCREEN_CHOOSE_LOOP);
-	DEBUG_P("\n\r> Loop");
-
-	while(TRUE){
-
-		// timing for loop execution
-		clear_millis();
-		x = 0;
-		while(!x) x = millis();
-		
-		// lcd options
-		if(encoder->update){
-			encoder->update = FALSE;
-			toggle ^= 1;
-			lcd_update_loop(toggle);
-		}
-		
-		// Check encoder button
-		if(btn->query) button_check();
-		
-		// Check action to be taken
-		if((btn->action) && (btn->state == BTN_RELEASED) && (!btn->delay1)){
-			btn->action = FALSE;
-			break;
-		}
-		if((btn->action) && (btn->delay3)){
-			btn->action = FALSE;
-			toggle = -1;
-			break;
-		}
-	}
-
-	return toggle;
-}
-
-/*===========================================================================*/
-/*
-* Acceleration: 
-* Acceleration values are NOT arbitrarily chosen. This function sets the
-* acceleration value en a percentage scale where 0% means MINIMUM acceleration
-* and 100% means MAXIMUM acceleration.
-*
-* Acceleration cannot obviously be zero, nor it can be arbitrarily high. Further
-* explanation can be found in the motor.c module
-*/
-int8_t user_set_accel(void)
-{
-	int8_t i = 100;
-	uint16_t x;
-	struct btn_s *btn = button_get();
-	struct enc_s *encoder = encoder_get();
-	
-	// LCD screen
-	lcd_screen(SCREEN_CHOOSE_ACCEL);
-	lcd_update_reps(i);
-	DEBUG_P("\n\r> Acceleration");
-
-	motor_set_accel_percent(i);
-
-	while(TRUE){
-
-		// timing for loop execution
-		clear_millis();
-		x = 0;
-		while(!x) x = millis();
-		
-		// lcd options
-		if(encoder->update){
-			encoder->update = FALSE;
-			if (encoder->dir == CW) {
-				if (i < 100) i += 5;
-				else i = 100;
-			} else if (encoder->dir == CCW) {
-				if (i > 1) i -= 5;
-				else i = 0;
-			}
-			lcd_update_reps(i);
-			motor_set_accel_percent(i);
-		}
-		
-		// Check encoder button
-		if(btn->query) button_check();
-		
-		// Check action to be taken
-		if((btn->action) && (btn->state == BTN_RELEASED) && (!btn->delay1)){
-			btn->action = FALSE;
-			break;
-		}
-		if((btn->action) && (btn->delay3)){
-			btn->action = FALSE;
-			i = -1;
-			break;
-		}
-	}
-
-	return i;
-}
-
-/*===========================================================================*/
-/*
-* Fail screen: It just displays a fail message and waits for the user to press
-* the rotary encoder button to exit back to the initial menu.
-*/
-void fail_message(void){
-
-	uint16_t x;
-	struct btn_s *btn = button_get();
-
-	// LCD screen message
-	lcd_screen(SCREEN_FAIL_MESSAGE);
-
-	while(TRUE){
-
-		// timing for loop execution
-		clear_millis();
-		x = 0;
-		while(!x) x = millis();
-		
-		// Check encoder button
-		if(btn->query) button_check();
-		
-		// Check action to be taken
-		if((btn->action) && (btn->state == BTN_RELEASED) && (!btn->delay1)){
-			btn->action = FALSE;
-			break;
-		}
-	}
-}
-
 /*-----------------------------------------------------------------------------
 --------------------- I N T E R N A L   F U N C T I O N S ---------------------
 -----------------------------------------------------------------------------*/
@@ -604,6 +371,9 @@ void fail_message(void){
 * (1) x_tot = ((1/2)*a*t1^2)*2 + v_max*t2 ; v_max = a*t1
 * (2) T = 2*t1 + t2
 * Solving (1) and (2) for t1 and t2, v_max can be determined.
+*
+* Speed is returned in AUTO_SPEED_SCALE units, which keep the resolution of
+* the slowest speeds.
 */
 static int32_t find_speed_from_time(float a, float t, float x)
 {
@@ -617,7 +387,53 @@ static int32_t find_speed_from_time(float a, float t, float x)
 	float root = sqrt(_b2 - _4ac);
 	float t1 = ((-1.0 * _b) - root) / (2.0 * _a);
 
-	int32_t v = (int32_t)(t1 * a);
+	int32_t v = (int32_t)(t1 * a * AUTO_SPEED_SCALE);
 
 	return v;
-}
\ No newline at end of file
+}
+
+/*===========================================================================*/
+/*
+* Two options menu cursor: '>' on the option selected, first or second row
+*/
+static void show_cursor(uint8_t v)
+{
+	lcd_set_cursor(0,0);
+	lcd_write_char(v ? ' ' : '>');
+	lcd_set_cursor(1,0);
+	lcd_write_char(v ? '>' : ' ');
+}
+
+/*===========================================================================*/
+static void set_profile(uint8_t v)
+{
+	motor_set_speed_profile(PROFILE_LINEAR + v);
+}
+
+/*===========================================================================*/
+static void set_accel(uint8_t v)
+{
+	motor_set_accel_percent(v);
+}
+
+/*===========================================================================*/
+/*
+* RAM debug screen: free RAM and stack high water mark (see util.c), updated
+* twice a second, until the button is pressed.
+*/
+static void ram_screen(void)
+{
+	uint16_t t = 500;
+	uint8_t ev;
+
+	lcd_screen(SCREEN_RAM);
+	uart_send_string_p(PSTR("\n\r> RAM"));
+
+	do {
+		ev = menu_event();
+		if (++t >= 500) {
+			t = 0;
+			lcd_update_ram(ram_free(), stack_peak());
+		}
+	} while ((ev != MENU_EVT_PRESS) && (ev != MENU_EVT_HOLD));
+}
@@ -15,21 +15,36 @@
 #include "uart.h"
 
 /******************************************************************************
-****************** F U N C T I O N   D E C L A R A T I O N S ******************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
 ******************************************************************************/
 
-int8_t choose_action(void);
+// Menus run by menu_run(). See menus[] in menu.c
+typedef enum {
+	MENU_ACTION,			// create (0) or manual (1) movement
+	MENU_CONTROL_TYPE,		// position (0) or speed (1) control
+	MENU_SPEED_PROFILE,		// PROFILE_xxx, set as it's chosen
+	MENU_REPS,
+	MENU_LOOP,
+	MENU_ACCEL,				// percent, set as it's chosen
+	MENU_FAIL,				// fail message
+	MENUS
+} menu_t;
+
+// Menu events, see menu_event()
+#define MENU_EVT_NONE		0
+#define MENU_EVT_CW			1		// encoder detents
+#define MENU_EVT_CCW		2
+#define MENU_EVT_PRESS		3		// short press, once released
+#define MENU_EVT_HOLD		4		// long press, while held
+
+/******************************************************************************
+****************** F U N C T I O N   D E C L A R A T I O N S ******************
+******************************************************************************/
 
-// Manual movement related functions
-int8_t choose_control_type(void);
-int8_t choose_speed_profile(void);
+uint8_t menu_event(void);
+int8_t menu_run(menu_t id);
 
 // Automatic movement related functions
 int32_t user_set_time(int32_t xi, int32_t xo);
-int8_t user_set_reps(void);
-int8_t user_set_loop(void);
-int8_t user_set_accel(void);
-
-void fail_message(void);
 
 #endif /* MENU_H */
\ No newline at end of file
@@ -11,6 +11,9 @@
 * Interrupt Service Routines, which I think presents some advantages with
 * respect to the popular AccelStepper Arduino library, which is based on
 * polling to achieve smooth movements.
+*
+* Easing profiles (sine, smooth) don't follow the ramp recurrence: the whole
+* movement is timed after a normalized curve instead, see ease_start().
 */
 
 /******************************************************************************
@@ -19,8 +22,9 @@
 
 #include "motor.h"
 
-#include <stdlib.h>
 #include <math.h>
+#include <stdlib.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
 #include <avr/interrupt.h>
 #include <stdint.h>
@@ -30,12 +34,34 @@
 *******************	C O N S T A N T S  D E F I N I T I O N S ******************
 ******************************************************************************/
 
-#define SPEED_UP	0xF1
-#define SPEED_FLAT	0xF2
-#define SPEED_DOWN	0xF3
-#define SPEED_HALT 	0xF0
+_Static_assert(MOTION_USTEPS == 8, "Motor module works in eighth-steps");
+_Static_assert(!(MOTOR_QUEUE_LEN & (MOTOR_QUEUE_LEN - 1)), "Queue length must be a power of 2");
+
+_Static_assert(!(MOTOR_EVENT_LEN & (MOTOR_EVENT_LEN - 1)), "Event ring length must be a power of 2");
+
+#define QUEUE_MASK		(MOTOR_QUEUE_LEN - 1)
+#define EVENT_MASK		(MOTOR_EVENT_LEN - 1)
+
+// Deferred work, see motor_job()
+#define JOB_LOG_POS			0x02
+#define DWELL_TICKS		((uint32_t)(F_MOTOR / 1000) - 1)	// 1ms
+
+// Handwheel: eighth-steps short of the braking distance the target may be,
+// and still be landed on right away
+#define HANDWHEEL_SLACK	8
+
+// Handwheel: first pulse after a detent, from rest. Driver direction setup
+#define HANDWHEEL_LEAD	((uint32_t)(F_MOTOR / 10000) - 1)	// 100us
 
-#define CMIN_EIGHTH_STEPPING 	249.0
+// Microstep switching thresholds, as eighth-step timer periods. Speeding up,
+// a coarser mode is selected below the _UP period. Slowing down, the finer
+// mode is restored above the _DN period.
+#define CN_QUARTER_UP	((uint32_t)(F_MOTOR / USTEP_SPEED_QUARTER) - 1)
+#define CN_HALF_UP		((uint32_t)(F_MOTOR / USTEP_SPEED_HALF) - 1)
+#define CN_FULL_UP		((uint32_t)(F_MOTOR / USTEP_SPEED_FULL) - 1)
+#define CN_QUARTER_DN	((uint32_t)(F_MOTOR / (USTEP_SPEED_QUARTER * USTEP_HYSTERESIS)) - 1)
+#define CN_HALF_DN		((uint32_t)(F_MOTOR / (USTEP_SPEED_HALF * USTEP_HYSTERESIS)) - 1)
+#define CN_FULL_DN		((uint32_t)(F_MOTOR / (USTEP_SPEED_FULL * USTEP_HYSTERESIS)) - 1)
 
 /******************************************************************************
 ****************** V A R I A B L E S   D E F I N I T I O N S ******************
@@ -50,15 +76,60 @@ volatile static uint8_t state;		// state variable
 
 volatile static int32_t current_pos;
 volatile static int32_t target_pos;
+static int32_t brake_pos;			// deceleration starts once reached
 volatile static uint8_t dir;
 
-static int32_t queue_pos;
-static int8_t queue_speed;
-static uint8_t queue_full;
+// Motion command queue. Commands are added by the foreground (head) and 
+// consumed by the motor timer ISR (tail), as each movement completes.
+static struct motor_cmd_s queue[MOTOR_QUEUE_LEN];
+volatile static uint8_t queue_head;
+volatile static uint8_t queue_tail;
+static uint16_t dwell;				// milliseconds left before the next command
+
+// Motion events. Stamped by the motor timer ISR (head), read by the 
+// foreground (tail). If the ring is full, newest events are dropped.
+static struct motor_event_s event[MOTOR_EVENT_LEN];
+volatile static uint8_t event_head;
+volatile static uint8_t event_tail;
+static uint8_t event_state;			// state at the last event check
+static uint8_t event_dir;			// direction of the last movement
+static int32_t start_pos;			// position where the movement started
+static defer_fn_t event_hook;
 
 static uint8_t speed_stop;
+static int8_t speed_set;			// speed control setpoint, signed %
+static uint8_t reverse;				// flag: speed control reversal pending
+static float cmin_reverse;			// max speed once reversed
+static uint16_t hw_gear;			// handwheel eighth-steps per detent, 0: off
 static uint8_t speed_profile;
 static uint8_t ctl;
+static int16_t accel;				// steps/s^2, cached for motor_get_accel()
+static int16_t decel;				// steps/s^2, cached for motor_get_decel()
+static uint16_t decel_ratio;		// decel ramp steps per accel ramp step, Q12
+static uint16_t accel_ratio;		// and back, Q12
+static float stop_k;				// emergency stop: f^2 / (2 * deceleration)
+volatile static uint8_t fault;		// limit switch hit. Latched until cleared
+static uint8_t stream_flags;		// block flags of the sample being timed
+
+// Easing movement, see ease_start()
+static uint8_t ease;				// flag: easing movement in progress
+static const uint16_t *ease_table;	// time vs position fraction (PROGMEM)
+static uint32_t ease_len;			// movement length, eighth-steps
+static uint32_t ease_step;			// table index per eighth-step, 16.16
+static float ease_scale;			// movement duration, timer ticks / 2^32
+
+// Microstep switching. Values are eighth-steps per driver pulse: 1, 2, 4, 8
+volatile static uint8_t ustep;		// pulse being timed (driver pins already set)
+static uint8_t ustep_next;			// following pulse (driver pins pending)
+static uint8_t ustep_phase;			// driver translator index, in eighth-steps
+static uint32_t cp;					// timer period before the 'ustep' pulse
+static uint32_t cn_ticks;			// cn as integer timer ticks
+
+// Status snapshot, published by a sequence counter: odd while being written.
+// The motor timer ISR is the main writer. Foreground writers must publish
+// with interrupts disabled, so readers never need to disable them.
+volatile static struct motor_status_s status;
+volatile static uint8_t status_seq;
 
 static const float f = F_MOTOR;
 
@@ -67,17 +138,50 @@ static const float f = F_MOTOR;
 ******************************************************************************/
 
 static void compute_c_position(void);
+static void compute_c_ease(void);
+static void compute_c_handwheel(void);
+static void handwheel_idle(void);
+static void position_done(void);
 static void pulse(void);
 static void queue_position_motion(int32_t p);
-static void queue_speed_motion(int8_t s);
+static int8_t queue_put(const struct motor_cmd_s *c);
+static uint8_t queue_next(void);
+static void queue_blend(void);
+static void position_start(void);
+static void position_redirect(void);
+static uint8_t speed_start(int8_t s);
+static uint8_t speed_start_allowed(uint8_t d);
+static void speed_reverse(void);
+static void turn_around(void);
+static void event_post(uint8_t type);
+static void event_check(void);
+static void motor_job(uint8_t job);
 static float get_cmin(uint8_t percent);
 static void next_cn(void);
+static void ustep_reset(void);
+static void ustep_update(void);
+static void brake_pos_set(void);
+static uint8_t brake_pos_reached(void);
+static uint16_t brake_dist(void);
+static void ramp_set(uint8_t s);
+static void ramp_stop(void);
+static void status_publish(void);
+static void stream_set(uint16_t c, uint8_t flags);
+static void stream_step(void);
+static void ease_start(void);
+static void ease_cancel(void);
+static uint16_t ease_steps(float c);
+static void ease_ramp(uint16_t steps);
+static void quadratic_start(void);
+static uint32_t ease_time(uint32_t s);
 
 /*===========================================================================*/
 /*
 * Sets initial motor parameters.
-* Sets stepping mode as EIGHTH STEPPING. Even though any other stepping mode
-* can be selected, all subsequent calculations are based on this stepping mode.
+* Sets stepping mode as EIGHTH STEPPING. All subsequent calculations are based
+* on this stepping mode. At high speeds the driver is switched to coarser
+* stepping modes (see ustep_update()), but positions and speeds are still
+* accounted in eighth-steps.
 *
 * Eighth stepping mode was chosen as a compromise between some factors:
 * - pros:
@@ -87,25 +191,31 @@ static void next_cn(void);
 *	- reasonable acceleration
 * - cons:
 *	- less time for the CPU between interrupts (i.e. for calculations)
-*	- limited max speed
+*	- limited max speed (overcome by microstep switching)
 * 	- way more heat dissipation in the driver MOSFETS (bigger heatsink required)
 */
 void motor_init(void)
 {
 	drv_reset();
-	drv_step_mode(MODE_EIGHTH_STEP);
+	ustep_phase = 0;		// translator at its home state after reset
+	ustep_reset();
 	drv_dir(CW, &dir);
+	event_dir = dir;
 	
 	current_pos = 0;
 	target_pos = 0;
 
 	// minimum counter value to get max speed
-	cmin = CMIN_EIGHTH_STEPPING;
+	cmin = CMIN_SPEED_MAX;
 	motor_set_speed_profile(PROFILE_LINEAR);
+	motor_set_stop_percent(100);
 	cn = c0;
 	n = 0;
 	state = SPEED_HALT;
-	queue_full = FALSE;
+	queue_head = 0;
+	queue_tail = 0;
+	fault = FALSE;
+	status_publish();
 }
 
 /*===========================================================================*/
@@ -113,17 +223,16 @@ void motor_init(void)
 * Sets speed profile
 * 	- linear profile
 *	- quadratic profile
+*	- sine & smooth easing profiles
 * Any change in speed profile requires recalculation of c0, which is performed
 * within motor_set_accel_percent(). Thus, notice that after every speed profile
 * change, acceleration is always maximum
 */
 void motor_set_speed_profile(uint8_t p)
 {
-	if (p == PROFILE_LINEAR) {
-		speed_profile = PROFILE_LINEAR;
-	} else if (p == PROFILE_QUADRATIC) {
-		speed_profile = PROFILE_QUADRATIC;
-	}
+	if ((p == PROFILE_LINEAR) || (p == PROFILE_QUADRATIC) || PROFILE_EASING(p))
+		speed_profile = p;
+
 	// whenever the speed profile is chose, maximum acceleration is chosen
 	motor_set_accel_percent(100);
 }
@@ -141,13 +250,7 @@ int8_t motor_set_maxspeed_percent(uint8_t speed)
 	// Updates cannot happen while motor is moving!
 	if ((speed > 100) || (speed == 0) || (state != SPEED_HALT)) return -1;
 
-	float a, b;
-
-	a = (float)speed;
-	a = a / 100.0;			// percentage
-	b = SPEED_MAX * a;		// Fraction of max speed
-
-	motor_set_maxspeed(b);
+	cmin = get_cmin(speed);
 
 	return 0;
 }
@@ -163,8 +266,8 @@ int8_t motor_set_maxspeed(float speed)
 {
 /*
 * Check for minimum speed: 
-* 	- max cmin: 2^16 - 1
-*	- speed min: f_timer / (max_cmin + 1) = 30,52Hz
+* 	- max cmin: 2^23 - 1 (OCR1A range stretched by the timer prescalers)
+*	- speed min: f_timer / (max_cmin + 1) = 0,24Hz
 */
 	if (speed > SPEED_MIN)
 		cmin = (f / speed) - 1.0;
@@ -182,38 +285,90 @@ int8_t motor_set_maxspeed(float speed)
 *	produce the required torque to move the motor shaft
 * min value: the size of the OCR1A register. For a given Timer frequency, 
 * 	lower acceleration values may represent cn values greater than the maximum
-* 	that can be stored in OCR1A.
-* This function changes the value of acceleration and re-computes c0 only
-* for the linear ramp speed profile.
+* 	that can be stored in OCR1A. Those would still run with a coarser timer
+*	prescaler, but at a lower resolution for the first ramp steps.
+* This function changes the value of acceleration and re-computes c0 for
+* the speed profile in use.
+*
+* c0 values (0.676 * f * sqrt(2 / a), corrected based on David Austin paper)
+* and the resulting accelerations are precomputed at build time, thus, this
+* function is cheap enough to be called on every encoder detent. The 
+* quadratic profile takes as long as the linear one to reach max speed with
+* the same acceleration (see tools/motion_gen.c): its mean acceleration.
+* Easing profiles take the linear ramp figures: it's their peak acceleration,
+* and the ramp they fall back to (see ease_cancel()).
+*
+* The deceleration is set to the same rate: see motor_set_decel_percent() to
+* set it apart, afterwards.
 */	
-int8_t motor_set_accel_percent(uint8_t accel) 
+int8_t motor_set_accel_percent(uint8_t percent) 
 {
 	// check for a valid value and state
 	// Updates cannot happen while motor is moving!
-	if ((accel > 100) || (state != SPEED_HALT)) return -1;
+	if ((percent > 100) || (state != SPEED_HALT)) return -1;
+
+	if ((speed_profile == PROFILE_LINEAR) || PROFILE_EASING(speed_profile)) {
+		c0 = (float)pgm_read_word(&motion_c0[percent]);
+		accel = (int16_t)pgm_read_word(&motion_accel[percent]);
+	} else if (speed_profile == PROFILE_QUADRATIC) {
+		// c0 = f * pow((3.0 / j), (1.0/3.0)) is way above OCR1A: the first
+		// ramp periods run at a coarser timer prescaler (timer_speed_set()),
+		// and the ramp is handed over to the base one once cn fits.
+		c0 = (float)pgm_read_dword(&motion_c0q[percent]);
+		accel = (int16_t)pgm_read_word(&motion_accel_q[percent]);
+	}
+	decel = accel;
+	decel_ratio = 4096;
+	accel_ratio = 4096;
+
+	return 0;
+}
 
-	float a, b;
+/*===========================================================================*/
+/*
+* Deceleration, apart from the acceleration: same range and tables. Must be
+* set after the acceleration, which resets it.
+*
+* Ramps down run the same recurrence as the ramps up (next_cn()), with n 
+* counting the steps left to stop instead: the rate only changes how many 
+* steps that is for a given speed. Thus, only the ratio between both ramp 
+* lengths is needed, to switch n over whenever the motor starts or stops
+* slowing down (see ramp_set()). For the same speed, the ramp length goes
+* as 1 / a for the linear ramp (c0 as 1 / sqrt(a)), and as 1 / sqrt(j) for
+* the quadratic one (c0 as 1 / cbrt(j)).
+*/
+int8_t motor_set_decel_percent(uint8_t percent)
+{
+	float c, r;
 
-	a = (float)accel;
-	a = a / 100.0;		// percentage
-	b = ((ACCEL_MAX - ACCEL_MIN) * a) + ACCEL_MIN;	// acceleration within the allowed range
+	if ((percent > 100) || (state != SPEED_HALT)) return -1;
 
-	if (speed_profile == PROFILE_LINEAR) {
-		c0 = 0.676 * f * sqrt(2.0 / b);		// Correction based on David Austin paper
-	} else if (speed_profile == PROFILE_QUADRATIC) {
-		// c0 = f * pow((3.0 / a), (1.0/3.0));	// way too high
-		// using the formula produces way too high integers. Thus, only
-		// possible value is the maximum OCR1A can store
-		c0 = 65535.0;
+	if ((speed_profile == PROFILE_LINEAR) || PROFILE_EASING(speed_profile)) {
+		c = (float)pgm_read_word(&motion_c0[percent]) / c0;
+		r = c * c;
+		decel = (int16_t)pgm_read_word(&motion_accel[percent]);
+	} else {
+		c = (float)pgm_read_dword(&motion_c0q[percent]) / c0;
+		r = c * sqrt(c);
+		decel = (int16_t)pgm_read_word(&motion_accel_q[percent]);
 	}
-	// max c0 value is (2^16)-1
-	if (c0 > 65535.0) c0 =  65535.0;
+	decel_ratio = (uint16_t)(r * 4096.0 + 0.5);
+	accel_ratio = (uint16_t)(4096.0 / r + 0.5);
+
+	return 0;
+}
+
+/*===========================================================================*/
+/*
+* Emergency deceleration: the rate motor_stop(SOFT_STOP) brakes at, whatever
+* the ramps in use, unless they already stop sooner. A linear ramp: percent
+* of the acceleration range. It can be changed at any time.
+*/
+int8_t motor_set_stop_percent(uint8_t percent)
+{
+	if (percent > 100) return -1;
 
-	//debug
-	char str[6];
-	ltoa((int32_t)c0, str, 10);
-	uart_send_string("\n\rc0: ");
-	uart_send_string(str);
+	stop_k = (f * f) / (2.0 * (float)pgm_read_word(&motion_accel[percent]));
 
 	return 0;
 }
@@ -221,39 +376,48 @@ int8_t motor_set_accel_percent(uint8_t accel)
 /*===========================================================================*/
 /*
 * Returns acceleration value in units of steps/sec^2. 
-* The constant 0.676 accounts for a correction aimed at getting the right
-* acceleration value, since the same constant was used when computing c0.
+* It is the acceleration matching c0, cached whenever c0 changes.
 */
 int16_t motor_get_accel(void)
 {
-	float f_mot = (float)F_MOTOR;
-	float acc =  2.0 * pow((f_mot / ((c0 + 1) / 0.676)), 2.0);
-
-	return (int16_t)acc;
+	return accel;
 }
 
 /*===========================================================================*/
-uint16_t motor_get_speed(void)
+int16_t motor_get_decel(void)
 {
-	return timer_speed_get();
+	return decel;
 }
 
 /*===========================================================================*/
-int8_t motor_get_speed_percent(void)
+/*
+* Returns the current speed as an eighth-step timer period, whatever the
+* stepping mode the driver is running. Zero if the motor is stopped.
+*/
+uint32_t motor_get_speed(void)
 {
-	float percent = 0.0;
+	struct motor_status_s s;
 
-	// If timer is disabled, do nothing.
-	if (timer_speed_check()) {
-		uint16_t s = motor_get_speed();
-		float pulses = f / (float)(s + 1);
+	motor_get_status(&s);
+	if ((s.state == SPEED_HALT) || (s.state == SPEED_DWELL)) return 0;
+	return s.cn;
+}
 
-		percent = 100.0 * pulses / SPEED_MAX;
-		if (dir == CCW)
-			percent *= -1.0;
+/*===========================================================================*/
+int8_t motor_get_speed_percent(void)
+{
+	int8_t percent = 0;
+	struct motor_status_s s;
+
+	motor_get_status(&s);
+	// If motor is stopped, do nothing.
+	if ((s.state != SPEED_HALT) && (s.state != SPEED_DWELL)) {
+		percent = (int8_t)units_speed_percent(s.cn);
+		if (s.dir == CCW)
+			percent = -percent;
 	}
 
-	return (int8_t)percent;
+	return percent;
 }
 
 /*===========================================================================*/
@@ -265,36 +429,99 @@ uint8_t motor_get_profile(void)
 /*===========================================================================*/
 int32_t motor_get_position(void)
 {
-	return current_pos;
+	struct motor_status_s s;
+
+	motor_get_status(&s);
+	return s.position;
+}
+
+/*===========================================================================*/
+/*
+* Motion status snapshot. The motor timer ISR may update the status while
+* it is being copied, in which case the copy is just repeated: interrupts
+* are never disabled, thus stepping is not delayed by status readers.
+*/
+void motor_get_status(struct motor_status_s *s)
+{
+	uint8_t seq;
+
+	do {
+		seq = status_seq;
+		*s = status;
+	} while ((seq & 1) || (seq != status_seq));
 }
 
 /*===========================================================================*/
 void motor_set_position(int32_t p)
 {
-	current_pos = p;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		current_pos = p;
+		status_publish();
+	}
 }
 
 /*===========================================================================*/
 uint8_t motor_get_dir(void)
 {
-	return dir;
+	struct motor_status_s s;
+
+	motor_get_status(&s);
+	return s.dir;
 }
 
 /*===========================================================================*/
 /*
 * Stopping the motor. It can be a sudden stop, or a smooth one.
+* A sudden stop also discards all queued commands. A smooth one does not.
+* A smooth stop brakes at the emergency deceleration (motor_set_stop_percent()),
+* or along the deceleration ramp if it stops sooner.
+*
+* The step counts are computed (float) from a snapshot of the current speed
+* before interrupts are disabled: the ISR may take a step meanwhile, and the
+* speed is one period off at most. Only n and the target are then set.
 */ 
 void motor_stop(uint8_t type) 
 {
-	if (type == SOFT_STOP) {
-		if (state != SPEED_HALT) {
-			if (dir == CW) target_pos = current_pos + (int32_t)n;
-			else target_pos = current_pos - (int32_t)n;
+	float c, s;
+	uint16_t d, e, r;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		c = cn + 1.0;
+	}
+	// steps to stop from the current speed, and easing ramp length
+	s = stop_k / (c * c);
+	e = (s < 65534.0) ? (uint16_t)s + 1 : 0xFFFF;
+	r = ease_steps(c);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (ease) ease_ramp(r);
+		reverse = FALSE;
+		if (state == SPEED_STREAM) {
+			// a stream can't be slowed down: both stops end it right away
+			speed_stop = TRUE;
+		} else if (type == SOFT_STOP) {
+			if (state != SPEED_HALT) {
+				d = brake_dist();
+				if (state != SPEED_DWELL) {
+					if (e < d) {
+						ramp_set(SPEED_DOWN);
+						n = e;
+						d = e;
+					}
+				}
+				if (dir == CW) target_pos = current_pos + (int32_t)d;
+				else target_pos = current_pos - (int32_t)d;
+				if (ctl == SPEED_CONTROL) speed_stop = TRUE;
+			}
+		} else if (type == HARD_STOP) {
+			// target position is overwritten with the next step, which may span
+			// several eighth-steps if the driver runs a coarser stepping mode.
+			if (dir == CW) target_pos = current_pos + ustep;
+			else if (dir == CCW) target_pos = current_pos - ustep;
+			queue_tail = queue_head;
 		}
-	} else if (type == HARD_STOP) {
-		// target position is overwritten with the next step.
-		if (dir == CW) target_pos = current_pos + 1;
-		else if (dir == CCW) target_pos = current_pos - 1;
+		brake_pos_set();
+		status_publish();
 	}
 }
 
@@ -304,6 +531,60 @@ uint8_t motor_working(void)
 	return timer_speed_check();
 }
 
+/*===========================================================================*/
+/*
+* Emergency stop. Called from the limit switch ISR, thus it stops the motor
+* right away instead of waiting for the main loop to poll the switch: the
+* step timer is stopped, the driver released, and any queued movement is
+* discarded. No further movements are accepted until the fault is cleared.
+*
+* Only a handful of register writes: the latency from the switch closing to
+* the last step is the PCINT1 ISR entry, plus any ISR already running.
+*/
+void motor_halt(void)
+{
+	timer_speed_set(DISABLE, 0);
+	TIFR1 = (1<<OCF1A);		// discard a step that may be already pending
+	drv_halt();
+	state = SPEED_HALT;
+	queue_tail = queue_head;
+	target_pos = current_pos;
+	cn = c0;
+	n = 0;
+	ustep_reset();
+	fault = TRUE;
+	ease = FALSE;
+	reverse = FALSE;
+	if (ctl == STREAM_CONTROL) {
+		ctl = POSITION_CONTROL;
+		stream_close(STREAM_STOPPED);
+	} else if (ctl == HANDWHEEL_CONTROL) {
+		ctl = POSITION_CONTROL;
+		hw_gear = 0;
+	}
+	event_post(MOTOR_EVT_DONE);
+	status_publish();
+}
+
+/*===========================================================================*/
+uint8_t motor_fault(void)
+{
+	return fault;
+}
+
+/*===========================================================================*/
+/*
+* Fault recovery. Re-arms the limit switch, so it must only be called once
+* the slider is known to be in a safe place (i.e. homing).
+*/
+void motor_fault_clear(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		fault = FALSE;
+		*limit_switch_get() = FALSE;
+	}
+}
+
 /*===========================================================================*/
 /*
 * Position control function
@@ -328,86 +609,53 @@ uint8_t motor_working(void)
 */
 void motor_move_to_pos(int32_t p, uint8_t mode, uint8_t limits)
 {
-	ctl = POSITION_CONTROL;
+	int32_t pos, t;
+	uint8_t moving;
 
-	// If slider limits flag is TRUE, then check the slider position to avoid
-	// crashing. If FALSE, do not check limits. Useful for HOMING cycle.
-	if (limits) {
-		if (mode == ABS) {
-			// Check valid target position (avoid crashing the slider)
-			if ((p <= MAX_COUNT) && (p >= 0))
-				target_pos = p;
-			else if (p > MAX_COUNT)
-				target_pos = MAX_COUNT;
-			else if (p < 0)
-				target_pos = 0;
-		} else if (mode == REL) {
-			int32_t np = current_pos + p;
-			// Check valid target position (avoid crashing the slider)
-			if ((np <= MAX_COUNT) && (np >= 0))
-				target_pos = np;
-			else if (np > MAX_COUNT)
-				target_pos = MAX_COUNT;
-			else if (np < 0)
-				target_pos = 0;
+	if (fault) return;		// limit switch hit: no movement until cleared
+	if (state == SPEED_STREAM) return;	// stop the stream first
+	if (state == SPEED_DWELL) motor_queue_flush();	// move right now
+
+	ctl = POSITION_CONTROL;
+	reverse = FALSE;
+
+	// The step ISR updates the position and reads the target meanwhile: both
+	// are 32-bit. The position is read once, and if moving, the new target is
+	// stored and the movement redirected in the same atomic section.
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		pos = current_pos;
+		t = (mode == REL) ? pos + p : p;
+		// If slider limits flag is TRUE, then check the slider position to 
+		// avoid crashing. If FALSE, do not check limits. Useful for HOMING.
+		if (limits) {
+			if (t > MAX_COUNT) t = MAX_COUNT;
+			else if (t < 0) t = 0;
+		}
+		moving = (state != SPEED_HALT);
+		// discard if position is the same as target
+		if (moving && (t != pos)) {
+			target_pos = t;
+			position_redirect();
 		}
-	} else {
-		if (mode == ABS) target_pos = p;
-		else if (mode == REL) target_pos = current_pos + p;
 	}
-
-	if (target_pos == current_pos) return;	//discard if position is the same as target
-
-	// Determine how's the motor moving:
-	if (state == SPEED_HALT) {
-		
-		if (target_pos > current_pos) drv_dir(CW, &dir);
-		else drv_dir(CCW, &dir);
-			
-		drv_set(ENABLE);
-		cn = c0;
-		timer_speed_set(ENABLE, (uint16_t)cn);
-		pulse();
-		compute_c_position();	// computes the next cn for the next cycle
-		state = SPEED_UP;
-		queue_full = FALSE;
-
-	} else {
-		// All possible cases of target position vs current position & movement direction:
-		//	- target_pos >= current_pos: moving CW - towards the final position - check closeness to target
-		//								moving CCW - away from the final position
-		//	- target_pos < current_pos: moving CW - away from the final position
-		//								moving CCW - towards the final position - check closeness to target
-		// 
-		if (target_pos >= current_pos) {
-			if (dir == CW) {
-				if ((target_pos - current_pos) < (int32_t)n) {	// motor too close to target to stop
-					ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {	// No interrupt should occur
-						queue_position_motion(target_pos);
-						motor_stop(SOFT_STOP);
-					}
-				}
-			} else {
-				ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {		//No interrupt should occur
-					queue_position_motion(target_pos);
-					motor_stop(SOFT_STOP);
-				}
-			}
-		} else {
-			if (dir == CW) {
-				ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {		//No interrupt should occur
-					queue_position_motion(target_pos);
-					motor_stop(SOFT_STOP);
-				}
-			} else {
-				if (abs(target_pos - current_pos) < (int32_t)n) {	// motor too close to target to stop
-					ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {		//No interrupt should occur
-						queue_position_motion(target_pos);
-						motor_stop(SOFT_STOP);
-					}
-				}
-			}
+	if (moving) return;
+
+	// Halted: the position can't change until the motor starts. If it's the
+	// target already, the movement is completed
+	if (t == pos) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			target_pos = t;
+			start_pos = pos;
+			event_post(MOTOR_EVT_DONE);
 		}
+		return;
+	}
+
+	drv_set(ENABLE);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		target_pos = t;
+		position_start();
+		status_publish();
 	}
 }
 
@@ -417,6 +665,8 @@ void motor_move_to_pos(int32_t p, uint8_t mode, uint8_t limits)
 * This is a blocking control function, meaning that it uses the non-blocking
 * counterpart, and polls the motor state until it is completely halted to 
 * finish execution.
+* Returns -1 if the movement was cut short by the limit switch, which halts
+* the motor from its own ISR. See motor_halt()
 *
 * Parameters:
 *	- p: new position value
@@ -425,21 +675,10 @@ void motor_move_to_pos(int32_t p, uint8_t mode, uint8_t limits)
 */
 int8_t motor_move_to_pos_block(int32_t pos, uint8_t mode, uint8_t limits) 
 {
-	int8_t x = 0;
-	volatile uint8_t *p = limit_switch_get();
-
 	motor_move_to_pos(pos, mode, limits);
-	while(state != SPEED_HALT) {
-		if ((*p)) {
-			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {		//No interrupt should occur
-				motor_stop(HARD_STOP);
-				(*p) = FALSE;
-				x = -1;
-			}
-			break;
-		}
-	}
-	return x;
+	while(state != SPEED_HALT) cpu_idle();
+
+	return (fault ? -1 : 0);
 }
 
 /*===========================================================================*/
@@ -450,20 +689,22 @@ int8_t motor_move_to_pos_block(int32_t pos, uint8_t mode, uint8_t limits)
 * ISR computations to keep moving the motor at the right speed and taking care
 * of the slider rail limits.
 *
-* There's a catch: if the motor is already moving, the movement is not reset
-* but instead a new speed is computed and, depending on the new target speed
-* relative to the current speed, the slider may need to stop and move in the
-* opposite direction. In these cases, two movements need to be done, thus the
-* second movement is queuded, and executed once the first (stop) movement is
-* executed. The second movement does not require a call to this function, but
-* its automatically issued by means of an auxiliary ISR that triggers once the
-* first movement finishes.
+* The speed is a signed setpoint: if the motor is already moving, the movement
+* is not reset, but the motor speeds up or slows down towards the new speed, 
+* at the current acceleration. If the new speed goes the opposite way, the
+* motor slows down to the slowest ramp speed and the motor timer ISR carries
+* on the other way right away, see speed_reverse(): the timer is never
+* stopped, and nothing is queued. A zero setpoint stops the motor.
 *
 * Parameters:
 *	- p: new speed value 
 */
 void motor_move_at_speed(int8_t s)
 {
+	if (fault) return;		// limit switch hit: no movement until cleared
+	if (state == SPEED_STREAM) return;	// stop the stream first
+	if (state == SPEED_DWELL) motor_queue_flush();	// move right now
+
 	ctl = SPEED_CONTROL;
 
 	float c;
@@ -480,62 +721,269 @@ void motor_move_at_speed(int8_t s)
 	}
 	
 	if (state == SPEED_HALT) {
-		if (s != 0) {
-			if (newdir == CW) drv_dir(CW, &dir);
-			else if (newdir == CCW) drv_dir(CCW, &dir);
-			// Check limits before starting motion.
-			if (((current_pos >= 0) && (current_pos < MAX_COUNT) && (dir == CW)) ||
-				((current_pos > 0) && (current_pos <= MAX_COUNT) && (dir == CCW))) {
-				drv_set(ENABLE);
-				cn = c0;
-				timer_speed_set(ENABLE, (uint16_t)cn);
-				state = SPEED_UP;
-				speed_stop = FALSE;
-				cmin = c;
+		// Check limits before starting motion.
+		if ((s != 0) && speed_start_allowed(newdir)) {
+			drv_set(ENABLE);
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				speed_start(s);
+				status_publish();
 			}
 		}
 	} else {
-		if (s == 0) {					// if target speed is 0
-			state = SPEED_DOWN;
-			speed_stop = TRUE;
-		} else {
-			if (newdir == CW) {
-				if (dir == CW) {		// if new speed goes in the same rotation direction
-					if (c < cmin) {
-						cmin = c;
-						state = SPEED_UP;
-					} else if (c > cmin){
-						c_target = c;
-						state = SPEED_DOWN;
-					}
-				} else if (dir == CCW) {	// if new speed goes in opposite rotation direction
-					ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {		//No interrupt should occur
-						state = SPEED_DOWN;
-						speed_stop = TRUE;
-						queue_speed_motion(s);
-						motor_stop(SOFT_STOP);
-					}
-				}
-			} else if (newdir == CCW) {
-				if (dir == CW) {
-					ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {		//No interrupt should occur
-						state = SPEED_DOWN;
-						speed_stop = TRUE;
-						queue_speed_motion(s);
-						motor_stop(SOFT_STOP);
-					}
-				} else if (dir == CCW) {	// if new speed goes in opposite rotation direction
-					if (c < cmin) {
-						cmin = c;
-						state = SPEED_UP;
-					} else if (c > cmin){
-						c_target = c;
-						state = SPEED_DOWN;
-					}
-				}
-			}	
-		}	
+		// a new speed supersedes any queued command and any pending
+		// reversal. The rail end is the target again. The current speed
+		// (cn) is updated by the ISR: no interrupt should occur.
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			queue_tail = queue_head;
+			ease_cancel();
+			speed_set = s;
+			speed_stop = FALSE;
+			reverse = FALSE;
+			target_pos = (dir == CW) ? MAX_COUNT : 0;
+
+			if (s == 0) {					// if target speed is 0
+				ramp_set(SPEED_DOWN);
+				speed_stop = TRUE;
+			} else if (newdir != dir) {		// opposite rotation direction
+				ramp_set(SPEED_DOWN);
+				speed_stop = TRUE;
+				reverse = TRUE;
+				cmin_reverse = c;
+			} else if (c < cn) {			// same direction, faster
+				cmin = c;
+				ramp_set(SPEED_UP);
+			} else if (c > cn) {			// same direction, slower
+				c_target = c;
+				ramp_set(SPEED_DOWN);
+			}
+			brake_pos_set();
+		}
+	}
+}
+
+/*===========================================================================*/
+/*
+* Speed control setpoint, signed percentage. Zero if the motor is halted, or
+* not under speed control. Speed changes can be issued relative to it, no
+* need to wait for the motor to reach the previous one.
+*/
+int8_t motor_get_speed_setpoint(void)
+{
+	if ((ctl != SPEED_CONTROL) || (state == SPEED_HALT)) return 0;
+	return speed_set;
+}
+
+/*===========================================================================*/
+/*
+* Handwheel mode (electronic handwheel, MPG). Every encoder detent moves the
+* target 'gear' eighth-steps, right from the encoder ISR, see 
+* motor_handwheel_feed(). The motor timer ISR tracks the target within the
+* speed & acceleration limits: it speeds up, slows down, or turns around as
+* the target moves, without ever stopping the timer or queueing anything. 
+* The driver is kept enabled between movements: the slider holds still at
+* the target.
+*
+* Only entered from standstill. A new gear may be set at any time, and gear 
+* 0 leaves the mode once the target is reached: the driver is released then.
+* Returns -1 if the mode can't be entered.
+*/
+int8_t motor_handwheel(uint16_t gear)
+{
+	uint8_t idle = FALSE;
+
+	if (fault || (state == SPEED_STREAM)) return -1;
+
+	if (ctl != HANDWHEEL_CONTROL) {
+		if ((gear == 0) || (state != SPEED_HALT)) return -1;
+		motor_queue_flush();
+		drv_set(ENABLE);
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			ctl = HANDWHEEL_CONTROL;
+			ease = FALSE;
+			reverse = FALSE;
+			target_pos = current_pos;
+			hw_gear = gear;
+			status_publish();
+		}
+		return 0;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		hw_gear = gear;
+		if ((gear == 0) && (state == SPEED_HALT)) {
+			ctl = POSITION_CONTROL;
+			idle = TRUE;
+		}
+	}
+	if (idle) drv_release();
+
+	return 0;
+}
+
+/*===========================================================================*/
+/*
+* Handwheel detents, signed. Called from the encoder ISR: the target moves
+* right away, and if the motor is halted, it starts moving right away too. 
+* The first step comes HANDWHEEL_LEAD timer ticks later, see position_start().
+* Ignored out of handwheel mode.
+*/
+void motor_handwheel_feed(int8_t detents)
+{
+	int32_t p;
+
+	if ((ctl != HANDWHEEL_CONTROL) || (hw_gear == 0) || fault) return;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		p = target_pos + (int32_t)detents * (int32_t)hw_gear;
+		if (p > MAX_COUNT) p = MAX_COUNT;
+		else if (p < 0) p = 0;
+		target_pos = p;
+
+		if ((state == SPEED_HALT) && (target_pos != current_pos))
+			position_start();
+		status_publish();
+	}
+}
+
+/*===========================================================================*/
+/*
+* Motion command queue
+* Commands are executed in order, each one as soon as the previous one
+* completes: the next movement is started from the motor timer ISR itself,
+* thus the gap between both is just the first step period (c0). If the motor
+* is halted, the command is started right away.
+*
+* Target positions are always checked against the slider boundaries.
+* Returns -1 if the queue is full, or if the motor is in fault state.
+*/
+int8_t motor_queue_push(const struct motor_cmd_s *c)
+{
+	struct motor_cmd_s cmd = *c;
+	uint8_t started = TRUE;
+	int8_t x = -1;
+
+	if (fault) return -1;		// limit switch hit: no movement until cleared
+	if (state == SPEED_STREAM) return -1;
+
+	// Check valid target position (avoid crashing the slider)
+	if (cmd.pos > MAX_COUNT) cmd.pos = MAX_COUNT;
+	else if (cmd.pos < 0) cmd.pos = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		x = queue_put(&cmd);
+	}
+
+	if ((x == 0) && (state == SPEED_HALT)) {
+		drv_set(ENABLE);
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			started = queue_next();
+			status_publish();
+		}
+		if (!started) drv_release();
+	}
+
+	return x;
+}
+
+/*===========================================================================*/
+uint8_t motor_queue_free(void)
+{
+	return (MOTOR_QUEUE_LEN - 1) - ((queue_head - queue_tail) & QUEUE_MASK);
+}
+
+/*===========================================================================*/
+/*
+* Discards all queued commands, and the dwell in progress if any. The
+* movement in progress, if any, is not affected.
+*/
+void motor_queue_flush(void)
+{
+	uint8_t dwelling = FALSE;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		queue_tail = queue_head;
+		if (state == SPEED_DWELL) {
+			timer_speed_set(DISABLE, 0);
+			state = SPEED_HALT;
+			status_publish();
+			dwelling = TRUE;
+		}
+	}
+	if (dwelling) drv_release();
+}
+
+/*===========================================================================*/
+/*
+* Motion events: oldest event first. Returns -1 if there's none.
+* Sequencers may read events instead of polling the position: arrival is
+* reported even if the position is then changed (i.e. by a queued move).
+*/
+int8_t motor_event_get(struct motor_event_s *e)
+{
+	if (event_tail == event_head) return -1;
+
+	*e = event[event_tail];
+	event_tail = (event_tail + 1) & EVENT_MASK;
+
+	return 0;
+}
+
+/*===========================================================================*/
+void motor_event_flush(void)
+{
+	event_tail = event_head;
+}
+
+/*===========================================================================*/
+/*
+* Event hook: function executed as deferred work (see defer.c) whenever an
+* event is stamped, with the event type as argument. It runs as soon as the
+* motor timer ISR returns, no need to wait for the next menu loop. NULL to 
+* remove it.
+*/
+void motor_event_hook(defer_fn_t fn)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		event_hook = fn;
+	}
+}
+
+/*===========================================================================*/
+/*
+* Stream playback start. The motor timer ISR takes the samples from the
+* stream double buffer until it ends (see stream.c). Streams are played back
+* in eighth-steps, with no microstep switching. Called out of interrupt 
+* context once the first blocks are received.
+* Returns -1 if the motor is not halted or in fault state, or if there's no
+* sample to be played back.
+*/
+int8_t motor_stream_start(void)
+{
+	uint16_t c;
+	uint8_t f;
+	int8_t x = -1;
+
+	if (fault || (state != SPEED_HALT)) return -1;
+
+	drv_set(ENABLE);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if ((state == SPEED_HALT) && (stream_pop(&c, &f) == STREAM_SAMPLE)) {
+			ustep_reset();
+			ctl = STREAM_CONTROL;
+			speed_stop = FALSE;
+			n = 0;
+			target_pos = current_pos;
+			stream_set(c, f);
+			state = SPEED_STREAM;
+			timer_speed_set(ENABLE, cn_ticks);
+			event_post(MOTOR_EVT_START);
+			status_publish();
+			x = 0;
+		}
 	}
+	if (x < 0) drv_release();
+
+	return x;
 }
 
 /*-----------------------------------------------------------------------------
@@ -563,19 +1011,28 @@ void motor_move_at_speed(int8_t s)
 */
 static void compute_c_position(void)
 {
-	int32_t steps_ahead = labs(target_pos - current_pos);
+	int32_t steps_ahead;
+	uint8_t braking = brake_pos_reached();
+
+	// Before braking, check whether the next queued command just extends
+	// this movement. Then, there's no need to stop.
+	if (braking && (queue_tail != queue_head)) {
+		queue_blend();
+		braking = brake_pos_reached();
+	}
 
-	if (steps_ahead > (int32_t)n) {
-		if (cn <= cmin) state = SPEED_FLAT;
-		else state = SPEED_UP;
+	if (!braking) {
+		if (cn <= cmin) ramp_set(SPEED_FLAT);
+		else ramp_set(SPEED_UP);
 	} else {
-		state = SPEED_DOWN;
+		ramp_set(SPEED_DOWN);
 	}
 	
 	switch (state) {
 
 		case SPEED_UP:
-			n++;
+			n += ustep;
+			brake_pos_set();
 			next_cn();
 			if (cn <= cmin) {
 				cn = cmin;
@@ -585,27 +1042,16 @@ static void compute_c_position(void)
 
 		case SPEED_FLAT:
 			cn = cmin;
-			if (steps_ahead <= (int32_t)n) {
-				state = SPEED_DOWN;
-				next_cn();
-			}
 			break;
 
 		case SPEED_DOWN:
+			// only while braking is the distance to the target needed
+			if (dir == CW) steps_ahead = target_pos - current_pos;
+			else steps_ahead = current_pos - target_pos;
+			if (steps_ahead < 0) steps_ahead = 0;
 			n = (uint16_t)steps_ahead;
-			if (n > 0) {
-				next_cn();
-			} else {
-				cn = c0;
-				timer_speed_set(DISABLE, (uint16_t)c0);	
-				state = SPEED_HALT;
-				
-				drv_set(DISABLE);
-
-				// check queue:
-				if (queue_full)
-					timer_aux_set(ENABLE, 100);	// software ISR to execute queued movement	
-			}
+			if (n > 0) next_cn();
+			else position_done();
 			break;
 
 		default:
@@ -615,35 +1061,151 @@ static void compute_c_position(void)
 
 /*===========================================================================*/
 /*
-* Speed control, Cn computation
-* The algorithm is based on the ability to compute the next Cn coefficient,
-* based on the current Cn and the value of n itself. Cn is based on an 
-* arithmetic progression described on the David Austin paper on Real Time 
-* Calculations for Stepper Motors. The boundary for the arithmetic progression
-* is the maximum allowd speed. At that point the motor will not accelerate but
-* remain at a constant speed. 
-*
-* This function is constantly called from the motor timer ISR to compute every
-* time the new value of Cn.
+* Easing movement, Cn computation
+* The time at which every position is reached comes from the easing table:
+* the table is linearly interpolated at the position the period ends and at
+* the one it starts, and the difference scaled to the movement duration.
+* Thus, every period is computed on its own, with no error accumulation, and
+* the movement lasts exactly as planned.
 *
-* The arithmetic progression has slightly different form when the motor is
-* accelerating compared to when the motor is decelerating. The value of n also
-* depends on the current state of the movement. This function handles all these
-* cases, as well as handling the case when multiple movement commands are 
-* issued before the motor stops completely
+* The period computed here is the one after the pulse already timed, thus it
+* starts 'ustep' eighth-steps ahead of the current position. Coarser stepping
+* modes are handled by ustep_update(), as for the ramps.
 */
-static void compute_c_speed(void)
+static void compute_c_ease(void)
 {
-	// limits of the slider: avoid crashing with the boundaries
-	if ((current_pos <= n) && (dir == CCW)) {
-		state = SPEED_DOWN;
-	} else if (((MAX_COUNT - current_pos) <= n) && (dir == CW)) {
+	uint32_t s, t;
+	int32_t remaining = labs(target_pos - current_pos);
+
+	if (remaining == 0) {
+		ease = FALSE;
+		position_done();
+		return;
+	}
+
+	s = ease_len - (uint32_t)remaining + ustep;
+	t = ease_time(s);
+	cn = (float)(ease_time(s + 1) - t) * ease_scale - 1.0;
+	if (cn < cmin) cn = cmin;
+
+	// no cruise phase: speeding up to halfway, slowing down afterwards
+	state = (s < (ease_len >> 1)) ? SPEED_UP : SPEED_DOWN;
+}
+
+/*===========================================================================*/
+/*
+* Handwheel, Cn computation
+* The target may move anywhere at any time, thus the distance to it is 
+* checked on every step against the braking distance (n):
+* - farther: speed up, or keep the max speed.
+* - about the braking distance: slow down to land right on the target, as
+*	position control does.
+* - closer, or behind: slow down at the nominal rate. Once at the slowest
+*	ramp speed, turn around if the target is behind.
+* Once the target is reached, the timer is stopped until the next detent.
+*/
+static void compute_c_handwheel(void)
+{
+	int32_t steps_ahead;
+
+	if (dir == CW) steps_ahead = target_pos - current_pos;
+	else steps_ahead = current_pos - target_pos;
+
+	if (steps_ahead > (int32_t)brake_dist()) {
+		if (cn > cmin) {
+			ramp_set(SPEED_UP);
+			n += ustep;
+			next_cn();
+			if (cn <= cmin) {
+				cn = cmin;
+				state = SPEED_FLAT;
+			}
+		} else {
+			cn = cmin;
+			ramp_set(SPEED_FLAT);
+		}
+	} else if ((steps_ahead >= 0) && (steps_ahead + HANDWHEEL_SLACK >= (int32_t)brake_dist())) {
 		state = SPEED_DOWN;
+		n = (uint16_t)steps_ahead;
+		if (n > 0) next_cn();
+		else handwheel_idle();
+	} else if (n > 0) {
+		ramp_set(SPEED_DOWN);
+		next_cn();
+		if (n > ustep) n -= ustep;
+		else n = 0;
+	} else {
+		turn_around();
+	}
+}
+
+/*===========================================================================*/
+/*
+* Handwheel target reached: the timer is stopped, but the driver is kept
+* enabled, unless the mode is being left. Called from the motor timer ISR.
+*/
+static void handwheel_idle(void)
+{
+	cn = c0;
+	timer_speed_set(DISABLE, 0);
+	state = SPEED_HALT;
+	ustep_reset();
+	event_post(MOTOR_EVT_DONE);
+
+	if (hw_gear == 0) {
+		ctl = POSITION_CONTROL;
+		drv_release();
 	}
+}
+
+/*===========================================================================*/
+/*
+* Position control, end of movement: the motor is halted right after the 
+* last pulse. Called from the motor timer ISR.
+*/
+static void position_done(void)
+{
+	cn = c0;
+	timer_speed_set(DISABLE, (uint32_t)c0);	
+	state = SPEED_HALT;
+	ustep_reset();
+	
+	event_post(MOTOR_EVT_DONE);
+
+	// the next queued command starts right away, with the
+	// driver still enabled.
+	if (!queue_next())
+		drv_release();
+}
+
+/*===========================================================================*/
+/*
+* Speed control, Cn computation
+* The algorithm is based on the ability to compute the next Cn coefficient,
+* based on the current Cn and the value of n itself. Cn is based on an 
+* arithmetic progression described on the David Austin paper on Real Time 
+* Calculations for Stepper Motors. The boundary for the arithmetic progression
+* is the maximum allowd speed. At that point the motor will not accelerate but
+* remain at a constant speed. 
+*
+* This function is constantly called from the motor timer ISR to compute every
+* time the new value of Cn.
+*
+* The arithmetic progression has slightly different form when the motor is
+* accelerating compared to when the motor is decelerating. The value of n also
+* depends on the current state of the movement. This function handles all these
+* cases, as well as handling the case when multiple movement commands are 
+* issued before the motor stops completely
+*/
+static void compute_c_speed(void)
+{
+	// limits of the slider: avoid crashing with the boundaries
+	if (brake_pos_reached()) ramp_set(SPEED_DOWN);
 
 	switch (state) {
 		case SPEED_UP:
-			n++;
+			n += ustep;
+			brake_pos_set();
 			next_cn();
 			if (cn <= cmin) {
 				cn = cmin;
@@ -661,26 +1223,31 @@ static void compute_c_speed(void)
 				if (!speed_stop) {			// if motor is not issued a stop instruction
 					if (cn >= c_target) {
 						cmin = cn;
-						state = SPEED_FLAT;
+						ramp_set(SPEED_FLAT);
 					}
 				}
+			} else if (reverse && speed_start_allowed((dir == CW) ? CCW : CW)) {
+				speed_reverse();
 			} else {
 				cn = c0;
-				timer_speed_set(DISABLE, (uint16_t)c0);	
+				timer_speed_set(DISABLE, (uint32_t)c0);	
 				state = SPEED_HALT;
+				ustep_reset();
 				
-				drv_set(DISABLE);
+				event_post(MOTOR_EVT_DONE);
 
-				char str[6];
-				ltoa(current_pos, str, 10);
-				uart_send_string("\n\rpos: ");
-				uart_send_string(str);
+				// the next queued command starts right away, with the
+				// driver still enabled.
+				if (!queue_next())
+					drv_release();
 
-				if (queue_full)
-					timer_aux_set(ENABLE, 100);	// software ISR to execute queued movement	
+				defer(motor_job, JOB_LOG_POS);
 			}
-			if (n > 0)
-				n--;
+			if (n > ustep)
+				n -= ustep;
+			else
+				n = 0;
+			brake_pos_set();
 			break;
 
 		default:
@@ -697,67 +1264,683 @@ static void compute_c_speed(void)
 * - Quadratic speed profile:
 *	- Motor accelerating
 *	- Motor deceleating
+* When the driver runs a coarser stepping mode, every pulse spans 'ustep'
+* eighth-steps, thus the progression advances that many terms at once. It is
+* a first order approximation, good enough since coarser modes are only 
+* selected at high speeds, where n is large.
+* The quadratic recurrence is too coarse for the first terms: up to 
+* MOTION_Q_LEN, the exact ratio between consecutive periods is used instead
+* (see tools/motion_gen.c). Slowing down, n counts the steps left, thus the
+* same ratios apply, reversed.
+* Easing profiles run the linear ramp whenever they can't time the whole
+* movement: speed control, and easing movements cut short.
 */
 static void next_cn(void)
 {
-	if (speed_profile == PROFILE_LINEAR) {
+	float k = (float)ustep;
+	float r;
+
+	if ((speed_profile == PROFILE_LINEAR) || PROFILE_EASING(speed_profile)) {
 		if (state == SPEED_UP) 
-			cn = cn - (2.0 * cn) / (4.0 * (float)n + 1.0);
+			cn = cn - (2.0 * k * cn) / (4.0 * (float)n + 1.0);
 		else 
-			cn = cn - (2.0 * cn) / (4.0 * (float)n * (-1.0) + 1.0);
+			cn = cn - (2.0 * k * cn) / (4.0 * (float)n * (-1.0) + 1.0);
 	} else if (speed_profile == PROFILE_QUADRATIC) {
-		if (n == 1) {
-			cn = 0.9 * c0;		// correction for quadratic profile. See David Austin paper
+		if ((n < MOTION_Q_LEN) && (ustep == 1)) {
+			r = (float)pgm_read_word(&motion_q_ratio[n - 1]) * (1.0 / 65536.0);
+			if (state == SPEED_UP)
+				cn = cn * r;
+			else
+				cn = cn / r;
 		} else {
 			if (state == SPEED_UP)
-				cn = cn - (6.0 * cn) / (9.0 * (float)n + 3.0);
+				cn = cn - (6.0 * k * cn) / (9.0 * (float)n + 3.0);
 			else
-				cn = cn - (6.0 * cn) / (9.0 * (float)n * (-1.0) + 3.0);
+				cn = cn - (6.0 * k * cn) / (9.0 * (float)n * (-1.0) + 3.0);
 		}
 	}	
 }
 
+/*===========================================================================*/
+/*
+* Microstep switching reset: back to eighth stepping. Only called while the
+* motor is not stepping.
+*/
+static void ustep_reset(void)
+{
+	ustep = 1;
+	ustep_next = 1;
+	drv_step_mode(MODE_EIGHTH_STEP);
+}
+
+/*===========================================================================*/
+/*
+* Microstep switching. Chooses the stepping mode of the pulse that follows
+* the one being timed, and the timer period before it. Called from the motor
+* timer ISR once the next cn has been computed.
+*
+* The faster the motor runs, the coarser the stepping mode: the ISR then runs
+* 2, 4 or 8 times less often for the same speed. Switching rules:
+* - a coarser mode is only selected at a translator index multiple of its
+*	step size, so the driver always lands on a valid microstep phase.
+* - a finer mode may be selected at any time.
+* - in position control (and handwheel), pulses never span more eighth-steps
+*	than the ones left to reach the target position.
+*/
+static void ustep_update(void)
+{
+	uint32_t c = (uint32_t)cn;
+	int32_t remaining = INT32_MAX;
+	uint8_t phase, k;
+
+	if (state == SPEED_HALT) return;
+
+	// position & translator index once the 'ustep' pulse is issued
+	if ((ctl == POSITION_CONTROL) || (ctl == HANDWHEEL_CONTROL)) {
+		remaining = labs(target_pos - current_pos) - ustep;
+		if (remaining < 0) remaining = 0;
+	}
+	if (dir == CW) phase = ustep_phase + ustep;
+	else phase = ustep_phase - ustep;
+
+	k = ustep_next;
+	if ((c < CN_QUARTER_UP) && (k < 8)) {
+		// speeding up: choose the coarsest mode the speed allows, if the
+		// translator index is aligned to it. Otherwise keep trying.
+		uint8_t kmax = (c < CN_FULL_UP) ? 8 : (c < CN_HALF_UP) ? 4 : 2;
+		while ((kmax > k) && ((phase & (kmax - 1)) || (remaining < kmax)))
+			kmax >>= 1;
+		if (kmax > k) k = kmax;
+	}
+	if (k > 1) {
+		// slowing down
+		uint8_t kmin = (c > CN_QUARTER_DN) ? 1 : (c > CN_HALF_DN) ? 2 :
+			(c > CN_FULL_DN) ? 4 : 8;
+		if (k > kmin) k = kmin;
+		// no pulse left (remaining 0): eighth stepping, as once halted
+		while ((k > 1) && (k > remaining)) k >>= 1;
+	}
+
+	ustep_next = k;
+	cp = ((c + 1) * k) - 1;
+	cn_ticks = c;
+}
+
+/*===========================================================================*/
+/*
+* Status snapshot update. Must be called from the motor timer ISR, or with
+* interrupts disabled. See motor_get_status()
+*/
+static void status_publish(void)
+{
+	status_seq++;
+	status.position = current_pos;
+	status.target = target_pos;
+	status.cn = cn_ticks;
+	status.n = n;
+	status.state = state;
+	status.dir = dir;
+	status_seq++;
+}
+
+/*===========================================================================*/
+/*
+* Braking point: position at which the motor must start decelerating to stop
+* right at the target position. It only depends on the target and on the 
+* steps taken to reach the current speed (n), thus it only needs to be
+* recomputed when any of them changes: on every step while speeding up or
+* slowing down, and when the target changes. When cruising, the ISR just
+* compares it against the current position.
+*
+* Speed control uses the slider rail end as target, to avoid crashing.
+*/
+static void brake_pos_set(void)
+{
+	if (dir == CW) brake_pos = target_pos - (int32_t)brake_dist();
+	else brake_pos = target_pos + (int32_t)brake_dist();
+}
+
+/*===========================================================================*/
+/*
+* Steps to stop along the deceleration ramp, from the current speed. While
+* slowing down, n already counts them.
+*/
+static uint16_t brake_dist(void)
+{
+	uint32_t d;
+
+	if (state == SPEED_DOWN) return n;
+	d = ((uint32_t)n * decel_ratio) >> 12;
+	return (d > 0xFFFF) ? 0xFFFF : (uint16_t)d;
+}
+
+/*===========================================================================*/
+/*
+* Ramp state change. n counts the steps of the acceleration ramp up to the
+* current speed, and the steps left to stop while slowing down: it's switched
+* over whenever the motor starts or stops slowing down. Same speed, same 
+* period (cn): the recurrence just goes on at the other rate. See 
+* motor_set_decel_percent().
+*/
+static void ramp_set(uint8_t s)
+{
+	if ((s == SPEED_DOWN) && (state != SPEED_DOWN))
+		n = brake_dist();
+	else if ((s != SPEED_DOWN) && (state == SPEED_DOWN))
+		n = ((uint32_t)n * accel_ratio) >> 12;
+	state = s;
+}
+
+/*===========================================================================*/
+/*
+* Stop along the deceleration ramp, i.e. before a direction change. Called 
+* with interrupts disabled.
+*/
+static void ramp_stop(void)
+{
+	if (dir == CW) target_pos = current_pos + (int32_t)brake_dist();
+	else target_pos = current_pos - (int32_t)brake_dist();
+	brake_pos_set();
+}
+
+/*===========================================================================*/
+static uint8_t brake_pos_reached(void)
+{
+	if (dir == CW) return (current_pos >= brake_pos);
+	else return (current_pos <= brake_pos);
+}
+
+/*===========================================================================*/
+/*
+* Stream sample: direction and timer period of the next pulse. Periods are 
+* limited to the max speed. 
+*/
+static void stream_set(uint16_t c, uint8_t flags)
+{
+	if (c < (uint16_t)CMIN_SPEED_MAX) c = (uint16_t)CMIN_SPEED_MAX;
+
+	if ((flags & STREAM_FLAG_CW) && (dir != CW)) drv_dir(CW, &dir);
+	else if (!(flags & STREAM_FLAG_CW) && (dir != CCW)) drv_dir(CCW, &dir);
+
+	stream_flags = flags;
+	cn_ticks = c;
+}
+
+/*===========================================================================*/
+/*
+* Stream playback, from the motor timer ISR: the sample just timed is issued
+* and the next one loaded. The stream stops right away when it ends, when a
+* stop is requested, or before a step beyond the slider limits.
+*/
+static void stream_step(void)
+{
+	uint16_t c;
+	uint8_t f;
+	int8_t x;
+
+	if (!(stream_flags & STREAM_FLAG_WAIT)) {
+		if (((dir == CW) && (current_pos >= MAX_COUNT)) ||
+			((dir == CCW) && (current_pos <= 0)))
+			speed_stop = TRUE;
+		else
+			pulse();
+	}
+
+	x = speed_stop ? STREAM_STOPPED : stream_pop(&c, &f);
+	if (x != STREAM_SAMPLE) {
+		timer_speed_set(DISABLE, 0);
+		state = SPEED_HALT;
+		ctl = POSITION_CONTROL;
+		target_pos = current_pos;
+		stream_close(x);
+		event_post(MOTOR_EVT_DONE);
+		drv_release();
+		return;
+	}
+
+	stream_set(c, f);
+	timer_speed_set_raw(cn_ticks);
+}
+
+/*===========================================================================*/
+/*
+* Easing movement start, towards target_pos. The position follows an easing
+* curve of time, x = D * E(t / T), from standstill to standstill: there's no
+* acceleration, cruise or deceleration phase, the speed changes all along.
+* The duration T is the shortest one that keeps the peak speed within the
+* max speed (cmin), and the peak acceleration within the linear ramp one.
+* Leaves the first period in cn.
+*/
+static void ease_start(void)
+{
+	float v, a, t_speed, t_accel;
+
+	if (speed_profile == PROFILE_SINE) {
+		ease_table = motion_ease_sine;
+		v = EASE_SINE_V;
+		a = EASE_SINE_A;
+	} else {
+		ease_table = motion_ease_smooth;
+		v = EASE_SMOOTH_V;
+		a = EASE_SMOOTH_A;
+	}
+
+	ease_len = labs(target_pos - current_pos);
+	ease_step = ((uint32_t)EASE_SEGMENTS << 16) / ease_len;
+
+	t_speed = v * (float)ease_len * (cmin + 1.0);
+	t_accel = f * sqrt(a * (float)ease_len / (float)accel);
+	ease_scale = ((t_speed > t_accel) ? t_speed : t_accel) / 4294967296.0;
+	ease = TRUE;
+
+	cn = (float)ease_time(1) * ease_scale - 1.0;
+	if (cn < cmin) cn = cmin;
+}
+
+/*===========================================================================*/
+/*
+* Easing movement cut short (new target, stop): it goes on as a linear ramp
+* from the current speed. n is set to the steps the ramp takes to reach that
+* speed, thus the braking point is the right one to stop from it.
+*/
+static void ease_cancel(void)
+{
+	if (!ease) return;
+	ease_ramp(ease_steps(cn + 1.0));
+}
+
+/*===========================================================================*/
+/*
+* Steps the linear ramp takes to reach the speed of period 'c' (cn + 1)
+*/
+static uint16_t ease_steps(float c)
+{
+	float steps = (f * f) / (2.0 * (float)accel * c * c);
+
+	return (steps < 65535.0) ? (uint16_t)steps + 1 : 0xFFFF;
+}
+
+/*===========================================================================*/
+/*
+* Easing movement cut short, with the ramp length already computed: see
+* ease_cancel(). Called with interrupts disabled.
+*/
+static void ease_ramp(uint16_t steps)
+{
+	ease = FALSE;
+	n = steps;
+	if (state == SPEED_DOWN) {
+		state = SPEED_UP;		// n is an acceleration ramp length
+		ramp_set(SPEED_DOWN);
+	}
+	brake_pos_set();
+}
+
+/*===========================================================================*/
+/*
+* Time at which the easing movement reaches 's' eighth-steps, as a fraction
+* of its duration (32-bit fixed point). Integer interpolation between the 
+* two table samples around the position.
+*/
+static uint32_t ease_time(uint32_t s)
+{
+	uint32_t x;
+	uint16_t i, a, b;
+
+	if (s >= ease_len) s = ease_len;
+	x = s * ease_step;
+	i = (uint16_t)(x >> 16);
+	if (i >= EASE_SEGMENTS)
+		return (uint32_t)pgm_read_word(&ease_table[EASE_SEGMENTS]) << 16;
+
+	a = pgm_read_word(&ease_table[i]);
+	b = pgm_read_word(&ease_table[i + 1]);
+	return ((uint32_t)a << 16) + (uint32_t)(b - a) * (uint16_t)x;
+}
+
 /*===========================================================================*/
 /*
 * Based on a speed percentage, get the minimum value of Cn, which is equivalent
-* to the maximum speed allowed
+* to the maximum speed allowed. Values are precomputed at build time.
 */
 static float get_cmin(uint8_t percent)
 {
 	// check for a valid value and state
 	if ((percent > 100) || (percent == 0)) return -1.0;
 
-	float a, b;
-
-	a = (float)percent;
-	a = a / 100.0;		// percentage
-	b = ACCEL_MAX * a;		// Fraction of max speed
-
-	return (f / b) - 1.0;
+	return (float)pgm_read_dword(&motion_cmin[percent]);
 }
 
 /*===========================================================================*/
 /*
 * Queue motion. If the slider is moving in a certain direction and requires to
-* change direction, queue the motion to procede with the motor stop
+* change direction, queue the motion to procede with the motor stop.
+* It supersedes any other queued command. Called with interrupts disabled.
 */
 static void queue_position_motion(int32_t p) 
 {
-	queue_pos = p;
-	queue_full = TRUE;
-	DEBUG("\n\r>");	// Debug
+	struct motor_cmd_s c = {
+		.pos = p,
+		.speed = 0,
+		.accel = MOTOR_CMD_KEEP,
+		.profile = MOTOR_CMD_KEEP,
+		.ctl = POSITION_CONTROL,
+		.dwell = 0
+	};
+
+	queue_tail = queue_head;
+	queue_put(&c);
 }
 
 /*===========================================================================*/
 /*
-* Queue motion. If the slider is moving in a certain direction and requires to
-* change direction, queue the motion to procede with the motor stop
+* Adds a command at the queue head. Called with interrupts disabled.
+*/
+static int8_t queue_put(const struct motor_cmd_s *c)
+{
+	uint8_t next = (queue_head + 1) & QUEUE_MASK;
+
+	if (next == queue_tail) return -1;	// full
+
+	queue[queue_head] = *c;
+	queue_head = next;
+
+	return 0;
+}
+
+/*===========================================================================*/
+/*
+* Starts the next queued command. Called once the motor is halted: from the
+* motor timer ISR as soon as the previous movement completes, or from the
+* foreground with interrupts disabled. The first step of the new movement 
+* comes c0 timer ticks later.
+* Commands that can't be started (i.e. already at the target) are skipped.
+* Returns TRUE if the motor timer was started, either for a movement or for
+* a dwell. FALSE if there's nothing else to do.
 */
-static void queue_speed_motion(int8_t s)
+static uint8_t queue_next(void)
 {
-	queue_speed = s;
-	queue_full = TRUE;
-	DEBUG("\n\r>>");	// Debug
+	struct motor_cmd_s *c;
+
+	while (queue_tail != queue_head) {
+		c = &queue[queue_tail];
+
+		if (c->dwell) {
+			// wait first. The same command is started once the dwell is over
+			dwell = c->dwell;
+			c->dwell = 0;
+			state = SPEED_DWELL;
+			timer_speed_set(ENABLE, DWELL_TICKS);
+			return TRUE;
+		}
+		queue_tail = (queue_tail + 1) & QUEUE_MASK;
+
+		// settings can only be changed while the motor is halted
+		if (c->profile != MOTOR_CMD_KEEP) motor_set_speed_profile(c->profile);
+		if (c->accel != MOTOR_CMD_KEEP) motor_set_accel_percent(c->accel);
+
+		if (c->ctl == POSITION_CONTROL) {
+			if (c->speed > 0) motor_set_maxspeed_percent((uint8_t)c->speed);
+			if (c->pos != current_pos) {
+				ctl = POSITION_CONTROL;
+				target_pos = c->pos;
+				position_start();
+				return TRUE;
+			}
+		} else if (c->ctl == SPEED_CONTROL) {
+			if (speed_start(c->speed)) return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/*===========================================================================*/
+/*
+* Blending. If the next queued command is a position command further away in
+* the same direction, with no dwell and no parameter changes, the current
+* target is just moved forward: the motor doesn't stop in between. Called
+* from the motor timer ISR.
+*/
+static void queue_blend(void)
+{
+	struct motor_cmd_s *c = &queue[queue_tail];
+
+	if ((c->ctl != POSITION_CONTROL) || (c->dwell) || (c->speed > 0) ||
+		(c->accel != MOTOR_CMD_KEEP) || (c->profile != MOTOR_CMD_KEEP))
+		return;
+
+	if (((dir == CW) && (c->pos > target_pos)) ||
+		((dir == CCW) && (c->pos < target_pos))) {
+		target_pos = c->pos;
+		brake_pos_set();
+		queue_tail = (queue_tail + 1) & QUEUE_MASK;
+	}
+}
+
+/*===========================================================================*/
+/*
+* Position control start, towards target_pos. The first step is issued by
+* the motor timer ISR, c0 ticks later. Called while the motor is halted,
+* from the motor timer ISR or with interrupts disabled. The driver must
+* already be enabled.
+*/
+static void position_start(void)
+{
+	if (target_pos > current_pos) drv_dir(CW, &dir);
+	else drv_dir(CCW, &dir);
+
+	n = 0;
+	brake_pos_set();
+	cn = c0;
+	ease = FALSE;
+	if (PROFILE_EASING(speed_profile) && (ctl == POSITION_CONTROL)) ease_start();
+	cp = (uint32_t)cn;
+	cn_ticks = cp;
+	state = SPEED_UP;
+	// handwheel: the first pulse comes right away (direction setup time
+	// only) and the ramp starts from it, as if the motor had been moving
+	if (ctl == HANDWHEEL_CONTROL) timer_speed_set(ENABLE, HANDWHEEL_LEAD);
+	else timer_speed_set(ENABLE, cp);
+	if (ease) {
+		// the ISR loads cp right after the first pulse: the second period
+		compute_c_ease();
+		cp = (uint32_t)cn;
+	} else if (ctl != HANDWHEEL_CONTROL) {
+		quadratic_start();
+	}
+	event_post(MOTOR_EVT_START);
+}
+
+/*===========================================================================*/
+/*
+* New target while moving, already in target_pos. A new target supersedes
+* any queued command. All possible cases of target position vs current
+* position & movement direction:
+*	- target_pos >= current_pos: moving CW - towards the final position -
+*		check closeness to target; moving CCW - away from the final position
+*	- target_pos < current_pos: moving CW - away from the final position;
+*		moving CCW - towards the final position - check closeness to target
+* Too close to stop, or going away: stop and start over towards the target.
+* Called with interrupts disabled.
+*/
+static void position_redirect(void)
+{
+	int32_t d = target_pos - current_pos;
+
+	queue_tail = queue_head;
+	ease_cancel();
+	brake_pos_set();	// new target, new braking point
+
+	if (dir == CCW) d = -d;
+	if ((d < 0) || (d < (int32_t)brake_dist())) {
+		queue_position_motion(target_pos);
+		ramp_stop();
+	}
+	status_publish();
+}
+
+/*===========================================================================*/
+/*
+* Quadratic ramp start, once the timer runs the first period. The ISR loads
+* cp right after the first pulse, thus the second period is computed up 
+* front: otherwise c0 would run twice, and the whole ramp would lag one 
+* period behind. The linear ramp accounts for it in c0 instead.
+*/
+static void quadratic_start(void)
+{
+	if (speed_profile != PROFILE_QUADRATIC) return;
+
+	n = 1;
+	next_cn();
+	cp = (uint32_t)cn;
+}
+
+/*===========================================================================*/
+/*
+* Speed control start. Same as position_start(), but the slider rail end is
+* the target: the braking point is computed as for position control.
+* Returns FALSE if the motor can't move any further in that direction.
+*/
+static uint8_t speed_start(int8_t s)
+{
+	uint8_t d = (s > 0) ? CW : CCW;
+
+	if ((s == 0) || !speed_start_allowed(d)) return FALSE;
+
+	drv_dir(d, &dir);
+	ctl = SPEED_CONTROL;
+	ease = FALSE;
+	reverse = FALSE;
+	speed_set = s;
+	cmin = get_cmin((s > 0) ? s : -s);
+	speed_stop = FALSE;
+	target_pos = (dir == CW) ? MAX_COUNT : 0;
+
+	n = 0;
+	brake_pos_set();
+	cn = c0;
+	cp = (uint32_t)c0;
+	cn_ticks = cp;
+	state = SPEED_UP;
+	timer_speed_set(ENABLE, cp);
+	quadratic_start();
+	event_post(MOTOR_EVT_START);
+
+	return TRUE;
+}
+
+/*===========================================================================*/
+/*
+* Speed control reversal, from the motor timer ISR. The motor just slowed
+* down to the slowest ramp speed, the same it starts from: instead of being
+* halted, it goes on the other way as if it was started again. The pulse
+* already timed is the first one in the new direction, one slow period 
+* after the last one in the old direction: time enough for the driver to
+* take the direction change.
+*/
+static void speed_reverse(void)
+{
+	turn_around();
+	reverse = FALSE;
+	speed_stop = FALSE;
+	cmin = cmin_reverse;
+	target_pos = (dir == CW) ? MAX_COUNT : 0;
+}
+
+/*===========================================================================*/
+/*
+* Direction change at the slowest ramp speed, from the motor timer ISR: the
+* ramp starts over the other way, the timer keeps running.
+*/
+static void turn_around(void)
+{
+	drv_dir((dir == CW) ? CCW : CW, &dir);
+	n = 0;
+	cn = c0;
+	state = SPEED_UP;
+
+	start_pos = current_pos;
+	event_dir = dir;
+	event_post(MOTOR_EVT_REVERSE);
+}
+
+/*===========================================================================*/
+/*
+* Stamps a motion event. Called from the motor timer ISR, or with interrupts
+* disabled. A movement start also resets the step count, and it's reported
+* as a reversal too if it goes opposite to the previous movement.
+*/
+static void event_post(uint8_t type)
+{
+	uint8_t next;
+	struct motor_event_s *e;
+
+	if (type == MOTOR_EVT_START) {
+		start_pos = current_pos;
+		if (dir != event_dir) {
+			event_dir = dir;
+			event_post(MOTOR_EVT_REVERSE);
+		}
+	}
+	event_state = state;
+
+	next = (event_head + 1) & EVENT_MASK;
+	if (next != event_tail) {
+		e = &event[event_head];
+		e->time = uptime_ms;
+		e->position = current_pos;
+		e->steps = labs(current_pos - start_pos);
+		e->type = type;
+		event_head = next;
+	}
+
+	if (event_hook) defer(event_hook, type);
+}
+
+/*===========================================================================*/
+/*
+* Movement phase changes, checked once per step by the motor timer ISR.
+*/
+static void event_check(void)
+{
+	if (state == event_state) return;
+
+	if (state == SPEED_FLAT) event_post(MOTOR_EVT_CRUISE);
+	else if (state == SPEED_DOWN) event_post(MOTOR_EVT_DECEL);
+	else event_state = state;
+}
+
+/*===========================================================================*/
+/*
+* Deferred work of the motor module. Runs out of the motor timer ISR, with
+* interrupts enabled. See defer.c
+*/
+static void motor_job(uint8_t job)
+{
+	char str[12];
+
+	switch (job) {
+
+		case JOB_LOG_POS:
+			ltoa(motor_get_position(), str, 10);
+			uart_send_string_p(PSTR("\n\rpos: "));
+			uart_send_string(str);
+			break;
+
+		default:
+			break;
+	}
+}
+
+/*===========================================================================*/
+/*
+* Check limits before starting a speed control motion.
+*/
+static uint8_t speed_start_allowed(uint8_t d)
+{
+	return (((current_pos >= 0) && (current_pos < MAX_COUNT) && (d == CW)) ||
+		((current_pos > 0) && (current_pos <= MAX_COUNT) && (d == CCW)));
 }
 
 /*===========================================================================*/
@@ -771,8 +1954,13 @@ static void pulse(void)
 	DRV_STEP_PORT |= (1<<DRV_STEP_PIN);
 	_delay_us(2);
 	DRV_STEP_PORT &= ~(1<<DRV_STEP_PIN);
-	if (dir == CW) current_pos++;
-	else current_pos--;
+	if (dir == CW) {
+		current_pos += ustep;
+		ustep_phase += ustep;
+	} else {
+		current_pos -= ustep;
+		ustep_phase -= ustep;
+	}
 }
 
 /******************************************************************************
@@ -792,30 +1980,51 @@ static void pulse(void)
 * Motor timer interrupt. Whenever a new pulse needs to be issued (based on the
 * value of Cn), this ISR triggers. It steps the motor, sets the new Cn value
 * and computes the future Cn value.
+*
+* The stepping mode of the next pulse is applied right after the current
+* pulse, and the timer period loaded is the one computed for that mode.
 */
 ISR(TIMER1_COMPA_vect) 
 {
+	// waiting before the next queued command, in 1ms ticks
+	if (state == SPEED_DWELL) {
+		if (--dwell == 0) {
+			timer_speed_set(DISABLE, 0);
+			state = SPEED_HALT;
+			if (!queue_next())
+				drv_release();
+			status_publish();
+		}
+		return;
+	}
+
+	// host stream playback, sample by sample
+	if (state == SPEED_STREAM) {
+		stream_step();
+		status_publish();
+		return;
+	}
+
 	pulse();
+	if (ustep_next != ustep) {
+		ustep = ustep_next;
+		if (ustep == 1) drv_step_mode(MODE_EIGHTH_STEP);
+		else if (ustep == 2) drv_step_mode(MODE_QUARTER_STEP);
+		else if (ustep == 4) drv_step_mode(MODE_HALF_STEP);
+		else drv_step_mode(MODE_FULL_STEP);
+	}
 	// set the new timing delay (based on computation of cn)
-	timer_speed_set_raw((uint16_t)cn);
+	timer_speed_set_raw(cp);
 	// compute the timing delay for the next cycle
-	if (ctl == POSITION_CONTROL) compute_c_position();
-	else if (ctl == SPEED_CONTROL) compute_c_speed();
+	if (ctl == POSITION_CONTROL) {
+		if (ease) compute_c_ease();
+		else compute_c_position();
+	} else if (ctl == SPEED_CONTROL) {
+		compute_c_speed();
+	} else if (ctl == HANDWHEEL_CONTROL) {
+		compute_c_handwheel();
+	}
+	ustep_update();
+	event_check();
+	status_publish();
 }
-
-/*===========================================================================*/
-/*
-* Miscelaneous Timer. Used to generate "software-like" interrupts.
-* When a movement has been queued, the way to trigger the new movement is by
-* enablig this interrupt at the end of the current movement. It will trigger
-* the missing movement using the non-blocking function (either for a speed
-* movement or a position movement)
-*/
-ISR(TIMER0_COMPA_vect) 
-{
-	timer_aux_set(DISABLE, 100);
-	if (ctl == POSITION_CONTROL) motor_move_to_pos(queue_pos, ABS, TRUE);
-	else if (ctl == SPEED_CONTROL) motor_move_at_speed(queue_speed);
-	queue_full = FALSE;
-	DEBUG("\n\rTMR0");
-}
\ No newline at end of file
@@ -7,37 +7,107 @@
 ******************************************************************************/
 
 #include "config.h"
+#include "defer.h"
 #include "driver.h"
 #include "encoder.h"
+#include "stream.h"
 #include "timers.h"
 #include "uart.h"
+#include "units.h"
+#include "util.h"
 
 /******************************************************************************
 ***************** G L O B A L   S C O P E   V A R I A B L E S *****************
 ******************************************************************************/
 
-#define SPEED_MAX 			8000.0		// Valid for MODE_EIGHTH_STEP
-#define ACCEL_MAX 			8000.0		// Valid for MODE_EIGHTH_STEP
-#define ACCEL_MIN 			1862.0		// Valid for 2MHz timer frequency
-#define SPEED_MIN 		((float)F_MOTOR/(CMIN_MAX + 1.0))
+// SPEED_MAX, SPEED_MIN, ACCEL_MAX, ACCEL_MIN and the slider dimensions
+// (STEPS_PER_REV, CMS_PER_REV, MAX_COUNT...) are generated at build time
+// from the makefile motion parameters. See tools/motion_gen.c
 
 #define PROFILE_LINEAR		0x01
 #define PROFILE_QUADRATIC	0x02
+#define PROFILE_SINE		0x03	// easing: whole movement, see motor.c
+#define PROFILE_SMOOTH		0x04	// easing: whole movement, see motor.c
+
+#define PROFILE_EASING(p)	(((p) == PROFILE_SINE) || ((p) == PROFILE_SMOOTH))
 
 #define REL 				0x11
 #define ABS 				0x12
 
 #define POSITION_CONTROL	0x71
 #define SPEED_CONTROL 		0x70
+#define STREAM_CONTROL		0x72
+#define HANDWHEEL_CONTROL	0x73
 
 #define SOFT_STOP 			0x30
 #define HARD_STOP 			0x31
 
-#define CMIN_MAX  		65535.0		// 2^16 - 1: max OCR1A value
-#define MAX_LENGHT_CMS	((int32_t) 80)
-#define CMS_PER_REV 	((int32_t) 4)
-#define STEPS_PER_REV	((int32_t) 1600)	// EIGHTH stepping
-#define MAX_COUNT		(MAX_LENGHT_CMS * (STEPS_PER_REV / CMS_PER_REV))
+// Motion states, as reported by motor_get_status()
+#define SPEED_UP			0xF1
+#define SPEED_FLAT			0xF2
+#define SPEED_DOWN			0xF3
+#define SPEED_HALT 			0xF0
+#define SPEED_DWELL			0xF4
+#define SPEED_STREAM		0xF5	// playing back a host stream (see stream.c)
+
+// Motion events
+#define MOTOR_EVT_START		0x01	// movement started
+#define MOTOR_EVT_REVERSE	0x02	// started or turned opposite to the previous one
+#define MOTOR_EVT_CRUISE	0x03	// max speed reached
+#define MOTOR_EVT_DECEL		0x04	// deceleration started
+#define MOTOR_EVT_DONE		0x05	// movement completed, or halted
+#define MOTOR_EVENT_LEN		8		// power of 2
+
+// Motion command queue
+#define MOTOR_QUEUE_LEN		8		// power of 2
+#define MOTOR_CMD_KEEP		0xFF	// accel/profile: keep current setting
+
+#define CMIN_MAX  		((float)TIMER_SPEED_MAX)	// max timer period (prescaler 1024)
+
+// Microstep switching: speeds (in eighth-steps/s) above which the driver
+// is switched to a coarser stepping mode. Positions and speeds are always
+// expressed in eighth-steps, whatever the stepping mode actually running.
+// Going back to a finer mode happens below USTEP_HYSTERESIS times the speed.
+#define USTEP_SPEED_QUARTER	3000.0
+#define USTEP_SPEED_HALF	6000.0
+#define USTEP_SPEED_FULL	12000.0
+#define USTEP_HYSTERESIS	0.9
+
+/******************************************************************************
+***************** S T R U C T U R E   D E C L A R A T I O N S ****************
+******************************************************************************/
+
+// Motion status snapshot. Consistent as a whole: all fields belong to the
+// same step of the motor timer ISR.
+struct motor_status_s {
+	int32_t position;
+	int32_t target;
+	uint32_t cn;		// eighth-step timer period
+	uint16_t n;
+	uint8_t state;
+	uint8_t dir;
+};
+
+// Motion event, stamped when it happens in the motor timer ISR
+struct motor_event_s {
+	uint32_t time;		// milliseconds since boot
+	int32_t position;
+	uint32_t steps;		// eighth-steps since the movement started
+	uint8_t type;		// MOTOR_EVT_xxx
+};
+
+// Queued motion command. Commands are executed one after the other, as each
+// movement completes. Consecutive position commands in the same direction,
+// with no dwell nor parameter changes, are blended without stopping.
+struct motor_cmd_s {
+	int32_t pos;		// target position (position control)
+	int8_t speed;		// position control: max speed %, 0 keeps current
+						// speed control: signed speed %
+	uint8_t accel;		// accel %, or MOTOR_CMD_KEEP
+	uint8_t profile;	// PROFILE_xxx, or MOTOR_CMD_KEEP
+	uint8_t ctl;		// POSITION_CONTROL or SPEED_CONTROL
+	uint16_t dwell;		// milliseconds to wait before starting the movement
+};
 
 /******************************************************************************
 ******************** F U N C T I O N   P R O T O T Y P E S ********************
@@ -48,12 +118,24 @@ void motor_init(void);
 void motor_move_to_pos(int32_t p, uint8_t mode, uint8_t limits);
 int8_t motor_move_to_pos_block(int32_t pos, uint8_t mode, uint8_t limits);
 void motor_move_at_speed(int8_t s);
-
-uint16_t motor_get_speed(void);
+int8_t motor_queue_push(const struct motor_cmd_s *c);
+uint8_t motor_queue_free(void);
+void motor_queue_flush(void);
+int8_t motor_event_get(struct motor_event_s *e);
+void motor_event_flush(void);
+void motor_event_hook(defer_fn_t fn);
+int8_t motor_stream_start(void);
+int8_t motor_handwheel(uint16_t gear);
+void motor_handwheel_feed(int8_t detents);
+
+uint32_t motor_get_speed(void);
 int8_t motor_get_speed_percent(void);
+int8_t motor_get_speed_setpoint(void);
 int16_t motor_get_accel(void);
+int16_t motor_get_decel(void);
 uint8_t motor_get_profile(void);
 int32_t motor_get_position(void);
+void motor_get_status(struct motor_status_s *s);
 uint8_t motor_get_dir(void);
 
 void motor_stop(uint8_t type);
@@ -62,8 +144,13 @@ void motor_set_position(int32_t p);
 int8_t motor_set_maxspeed_percent(uint8_t speed);
 int8_t motor_set_maxspeed(float speed);
 int8_t motor_set_accel_percent(uint8_t accel);
+int8_t motor_set_decel_percent(uint8_t decel);
+int8_t motor_set_stop_percent(uint8_t decel);
 void motor_set_speed_profile(uint8_t p);
 
 uint8_t motor_working(void);
+void motor_halt(void);
+uint8_t motor_fault(void);
+void motor_fault_clear(void);
 
 #endif
\ No newline at end of file
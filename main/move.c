@@ -12,8 +12,10 @@
 ******************************************************************************/
 
 #include "move.h"
+#include "menu.h"
 
 #include <util/delay.h>
+#include <util/atomic.h>
 #include <avr/pgmspace.h>
 #include <stdlib.h>
 
@@ -21,6 +23,13 @@
 *******************	C O N S T A N T S  D E F I N I T I O N S ******************
 ******************************************************************************/
 
+// Handwheel gears, eighth-steps per encoder detent: 0.2, 1, 5 and 20 mm
+#define STEPS_PER_MM	((STEPS_PER_REV / CMS_PER_REV) / 10)
+#define GEARS			4
+static const uint16_t gears[GEARS] PROGMEM = {
+	STEPS_PER_MM / 5, STEPS_PER_MM, STEPS_PER_MM * 5, STEPS_PER_MM * 20
+};
+
 // Automatic movement motor states.
 enum {
 	ST_MOVE_TO_XO,
@@ -32,11 +41,25 @@ enum {
 	ST_IDLE
 };
 
+/******************************************************************************
+****************** V A R I A B L E S   D E F I N I T I O N S ******************
+******************************************************************************/
+
+// Next automatic movement leg, issued by the motor event hook as soon as the
+// current one is completed. See leg_hook()
+volatile static int32_t leg_pos;
+volatile static uint8_t leg_armed;	// flag
+
 /******************************************************************************
 ******************* F U N C T I O N   D E F I N I T I O N S *******************
 ******************************************************************************/
 
 static int8_t homing_cycle(void);
+static uint8_t move_done(void);
+static void leg_hook(uint8_t type);
+static void leg_arm(int32_t pos);
+static void leg_issue(void);
+static int8_t speed_detent(uint8_t ev);
 
 /*===========================================================================*/
 /*
@@ -70,13 +93,12 @@ int8_t homing(void)
 int8_t manual_speed(void)
 {
 	int8_t i = 0;
-	uint16_t x, xi = 0;
-	struct btn_s *btn = button_get();
-	struct enc_s *encoder = encoder_get();
+	uint16_t xi = 0;
+	uint8_t ev;
 
 	// LCD screen:
 	lcd_screen(SCREEN_MOTOR_SPEED);
-	lcd_update_speed(motor_get_speed());
+	lcd_update_speed(units_speed(motor_get_speed()));
 	uart_send_string_p(PSTR("\n\r> Speed Control"));
 
 	// Trim motor parameters
@@ -85,41 +107,24 @@ int8_t manual_speed(void)
 
 	while(TRUE){
 
-		// timing for loop execution
-		clear_millis();
-		x = 0;
-		while(!x) x = millis();
+		ev = menu_event();
 		xi++;
 		
-		if(encoder->update){
-			encoder->update = FALSE;
-
-			if(encoder->dir == CW) {
-				i = motor_get_speed_percent() + 5;
-				if ((i > 0) && (i < 5)) i = 0;	// force zero speed when transitioning from + to -
-			} else if (encoder->dir == CCW) {
-				i = motor_get_speed_percent() - 5;
-				if ((i > -5) && (i < 0)) i = 0;	// force zero speed when transitioning from + to -
-			}
-			
-			if(i > 100) i = 100;
-			else if(i < -100) i = -100;
-
+		if ((ev == MENU_EVT_CW) || (ev == MENU_EVT_CCW)) {
+			i = speed_detent(ev);
 			motor_move_at_speed(i);
 		}
 
 		// update display every 100ms
 		if (xi == 100) {
-			lcd_update_speed(motor_get_speed());
+			lcd_update_speed(units_speed(motor_get_speed()));
 			xi = 0;
 		}
 		
-		// Check encoder button
-		if(btn->query) button_check();
-		
-		// Check action to be taken
-		if(btn->action && btn->delay3){
-			btn->action = FALSE;
+		// Limit switch hit: the motor was already halted by its ISR
+		if (motor_fault()) break;
+
+		if (ev == MENU_EVT_HOLD) {
 			motor_move_at_speed(0);
 			break;
 		}
@@ -131,57 +136,54 @@ int8_t manual_speed(void)
 /*===========================================================================*/
 /*
 * Manual position: handles the manual position control performed by the user
-* through the rotary encoder. It constantly polls the rotary encoder state to
-* read changes in position, and issues a new position movement.
+* through the rotary encoder, as an electronic handwheel. Encoder detents are
+* fed to the motor straight from the encoder ISR (see motor_handwheel()), 
+* thus this loop doesn't add any latency: it only updates the display.
 *
-* With the encoder button the user can return to the main menu
+* With a short press of the encoder button the gear is changed, the slider
+* travel per detent. With a long one the user can return to the main menu.
 */
 uint8_t manual_position(void)
 {
-	uint16_t x, xi = 0;
-	struct btn_s *btn = button_get();
-	struct enc_s *encoder = encoder_get();
+	uint16_t xi = 0;
+	uint8_t g = 1;
+	uint8_t ev;
 
 	// LCD screen:
 	lcd_screen(SCREEN_MOTOR_POSITION);
-	lcd_update_position(motor_get_position());
+	lcd_update_position(units_mm(motor_get_position()));
+	lcd_update_gear(pgm_read_word(&gears[g]));
 	uart_send_string_p(PSTR("\n\r> Position Control"));
 
 	// Trim motor parameters
 	motor_set_maxspeed_percent(100);
 	motor_set_accel_percent(50);
+	if (motor_handwheel(pgm_read_word(&gears[g])) < 0) return 0;
 
 	while(TRUE){
 
-		// timing for loop execution
-		clear_millis();
-		x = 0;
-		while(!x) x = millis();
+		// detents were already fed to the motor: encoder events are ignored
+		ev = menu_event();
 		xi++;
-		
-		if(encoder->update){
-			encoder->update = FALSE;
-
-			if(encoder->dir == CW) motor_move_to_pos(600, REL, TRUE);
-			else if (encoder->dir == CCW) motor_move_to_pos(-600, REL, TRUE);			
-		}
 
 		// update display every 100ms
 		if (xi == 100) {
-			lcd_update_position(motor_get_position());
+			lcd_update_position(units_mm(motor_get_position()));
 			xi = 0;
 		}
 		
-		// Check encoder button
-		if(btn->query) button_check();
-		
-		// Check action to be taken
-		if(btn->action && btn->delay3){
-			btn->action = FALSE;
-			motor_move_at_speed(0);
+		// Limit switch hit: the motor was already halted by its ISR
+		if (motor_fault()) break;
+
+		if (ev == MENU_EVT_PRESS) {
+			if (++g == GEARS) g = 0;
+			motor_handwheel(pgm_read_word(&gears[g]));
+			lcd_update_gear(pgm_read_word(&gears[g]));
+		} else if (ev == MENU_EVT_HOLD) {
 			break;
 		}
 	}
+	motor_handwheel(0);
 
 	return 0;
 }
@@ -201,10 +203,9 @@ uint8_t manual_position(void)
 int32_t user_set_position(uint8_t p)
 {
 	int8_t i = 0;
-	uint16_t x, xi = 0;
+	uint16_t xi = 0;
 	uint8_t out = TRUE;
-	struct btn_s *btn = button_get();
-	struct enc_s *encoder = encoder_get();
+	uint8_t ev;
 
 	// LCD screen:
 	if (p) {	// If TRUE
@@ -214,7 +215,7 @@ int32_t user_set_position(uint8_t p)
 		lcd_screen(SCREEN_INITIAL_POSITION);
 		uart_send_string_p(PSTR("\n\r> Final Position"));
 	}
-	lcd_update_position(motor_get_position());
+	lcd_update_position(units_mm(motor_get_position()));
 
 	// Trim motor parameters
 	motor_set_speed_profile(PROFILE_LINEAR);
@@ -223,47 +224,30 @@ int32_t user_set_position(uint8_t p)
 
 	while(TRUE){
 
-		// timing for loop execution
-		clear_millis();
-		x = 0;
-		while(!x) x = millis();
+		ev = menu_event();
 		xi++;
 		
-		if(encoder->update){
-			encoder->update = FALSE;
-
-			if(encoder->dir == CW) {
-				i = motor_get_speed_percent() + 5;
-				if ((i > 0) && (i < 5)) i = 0;	// force zero speed when transitioning from + to -
-			} else if (encoder->dir == CCW) {
-				i = motor_get_speed_percent() - 5;
-				if ((i > -5) && (i < 0)) i = 0;	// force zero speed when transitioning from + to -
-			}
-
-			if(i > 100) i = 100;
-			else if(i < -100) i = -100;
-
+		if ((ev == MENU_EVT_CW) || (ev == MENU_EVT_CCW)) {
+			i = speed_detent(ev);
 			motor_move_at_speed(i);
 		}
 
 		// update display every 100ms
 		if (xi == 100) {
-			lcd_update_position(motor_get_position());
+			lcd_update_position(units_mm(motor_get_position()));
 			xi = 0;
 		}
 		
-		// Check encoder button
-		if(btn->query) button_check();
-		
-		// Check action to be taken
-		if((btn->action) && (btn->state == BTN_RELEASED) && (!btn->delay1)){
-			btn->action = FALSE;
-			out = TRUE;
+		// Limit switch hit: the motor was already halted by its ISR
+		if (motor_fault()) {
+			out = FALSE;
 			break;
 		}
 
-		if(btn->action && btn->delay3){
-			btn->action = FALSE;
+		if (ev == MENU_EVT_PRESS) {
+			out = TRUE;
+			break;
+		} else if (ev == MENU_EVT_HOLD) {
 			out = FALSE;
 			break;
 		}
@@ -281,8 +265,7 @@ int32_t user_set_position(uint8_t p)
 int8_t user_go_to_init(int32_t pos)
 {
 	int8_t out = FALSE;
-	uint16_t x, xi = 0;
-	struct btn_s *btn = button_get();
+	uint8_t ev;
 
 	// LCD screen:
 	lcd_screen(SCREEN_WAIT_TO_GO);
@@ -292,28 +275,16 @@ int8_t user_go_to_init(int32_t pos)
 	// Max speed is computed and set properly in user_gogogo()
 	motor_set_maxspeed_percent(100);
 	
-	motor_move_to_pos_block(pos, ABS, TRUE);
+	if (motor_move_to_pos_block(pos, ABS, TRUE) < 0) return -1;
 
 	while (TRUE) {
 
-		// timing for loop execution
-		clear_millis();
-		x = 0;
-		while(!x) x = millis();
-		xi++;
+		ev = menu_event();
 
-		// Check encoder button
-		if(btn->query) button_check();
-		
-		// Check action to be taken
-		if((btn->action) && (btn->state == BTN_RELEASED) && (!btn->delay1)){
-			btn->action = FALSE;
+		if (ev == MENU_EVT_PRESS) {
 			out = TRUE;
 			break;
-		}
-
-		if(btn->action && btn->delay3){
-			btn->action = FALSE;
+		} else if (ev == MENU_EVT_HOLD) {
 			out = -1;
 			break;
 		}
@@ -338,16 +309,21 @@ int8_t user_go_to_init(int32_t pos)
 *
 * The display is updated periodically with the elapsed time and percentage of 
 * movement completed
+*
+* The next leg is not issued by the polling loop: it's armed beforehand, and
+* the motor event hook issues it right after the completion event is stamped
+* (see leg_hook()). The loop only follows the legs to count them.
 */
 int8_t user_gogogo(struct auto_s m)
 {
 	int8_t out = FALSE;
-	uint16_t x, xi = 0;
+	uint16_t xi = 0;
 	uint16_t secs = 0;
-	int32_t total_steps, percentage;
+	int32_t total_steps;
 	uint8_t n_move = 0;
 	int32_t steps_completed = 0;
-	struct btn_s *btn = button_get();
+	struct motor_status_s st;
+	uint8_t ev;
 	int8_t state = 0;
 	//debug
 	char str[12];
@@ -355,17 +331,17 @@ int8_t user_gogogo(struct auto_s m)
 	DEBUG_P("\n\r> Go go go!");
 
 	// Percentage calculation:
-	total_steps = fabs(m.final_pos - m.initial_pos);
+	total_steps = labs(m.final_pos - m.initial_pos);
 	if (m.reps > 1) total_steps *= 2 * (int32_t)m.reps;
 	// debug:
 	ltoa(total_steps, str, 10);
-	DEBUG("\n\rtot steps: ");
+	DEBUG_P("\n\rtot steps: ");
 	DEBUG(str);
 	ltoa(m.initial_pos, str, 10);
-	DEBUG(" | init: ");
+	DEBUG_P(" | init: ");
 	DEBUG(str);
 	ltoa(m.final_pos, str, 10);
-	DEBUG(" | final: ");
+	DEBUG_P(" | final: ");
 	DEBUG(str);
 
 	// LCD screen:
@@ -375,25 +351,25 @@ int8_t user_gogogo(struct auto_s m)
 	
 	//debug
 	ltoa(m.speed, str, 10);
-	DEBUG("\n\rspd: ");
+	DEBUG_P("\n\rspd: ");
 	DEBUG(str);
 	ltoa(total_steps, str, 10);
-	DEBUG(" | total: ");
+	DEBUG_P(" | total: ");
 	DEBUG(str);
 
 	// Trim motor parameters.
-	motor_set_speed_profile(PROFILE_LINEAR);
-	motor_set_maxspeed((float)m.speed);
+	motor_set_speed_profile(m.profile);
+	motor_set_maxspeed((float)m.speed / AUTO_SPEED_SCALE);
 	motor_set_accel_percent((uint8_t)m.accel);
 
 	uint8_t current_rep = 0;
 
+	leg_armed = FALSE;
+	motor_event_hook(leg_hook);
+
 	while(TRUE){
 
-		// timing for loop execution
-		clear_millis();
-		x = 0;
-		while(!x) x = millis();
+		ev = menu_event();
 		xi++;
 
 		// movement coordination based on a series of states that depend on
@@ -401,36 +377,49 @@ int8_t user_gogogo(struct auto_s m)
 		switch (state) {
 			case ST_MOVE_TO_XO:
 				// Go without blocking movement
+				motor_event_flush();
 				motor_move_to_pos(m.final_pos, ABS, TRUE);
+				if ((m.reps != 1) || m.loop) leg_arm(m.initial_pos);
 				state = ST_POLLING_XO;
 				break;
 
 			case ST_POLLING_XO:
-				// poll until it reaches the final position.
-				if (motor_get_position() == m.final_pos) {
+				// wait for the movement completion event. The next 
+				// movement was issued by the event hook already.
+				if (move_done()) {
 					n_move++;
-					if ((m.reps == 1) && (!m.loop))	
+					if ((m.reps == 1) && (!m.loop)) {
 						state = ST_FINISH;	
-					else	
-						state = ST_MOVE_TO_XI;	
+					} else {
+						leg_issue();
+						if ((m.reps != current_rep + 1) || m.loop)
+							leg_arm(m.final_pos);
+						state = ST_POLLING_XI;
+					}
 				}
 				break;
 
 			case ST_MOVE_TO_XI:
 				// Go without blocking movement
+				motor_event_flush();
 				motor_move_to_pos(m.initial_pos, ABS, TRUE);
+				if ((m.reps != current_rep + 1) || m.loop) leg_arm(m.final_pos);
 				state = ST_POLLING_XI;
 				break;
 
 			case ST_POLLING_XI:
-				// poll until it reaches the final position.
-				if (motor_get_position() == m.initial_pos) {
+				// wait for the movement completion event. The next 
+				// movement was issued by the event hook already.
+				if (move_done()) {
 					n_move++;
 					current_rep++;
-					if ((m.reps == current_rep) && (!m.loop))
+					if ((m.reps == current_rep) && (!m.loop)) {
 						state = ST_FINISH;
-					else
-						state = ST_MOVE_TO_XO;
+					} else {
+						leg_issue();
+						if ((m.reps != 1) || m.loop) leg_arm(m.initial_pos);
+						state = ST_POLLING_XO;
+					}
 				}
 				break;
 
@@ -456,36 +445,42 @@ int8_t user_gogogo(struct auto_s m)
 			xi = 0;
 			lcd_update_time_moving(secs);
 			if (!m.loop) {
-				// Compute steps completed
-				steps_completed = fabs(m.final_pos - m.initial_pos) * n_move;
+				// Compute steps completed. Position and direction must
+				// belong to the same step: use a single status snapshot
+				motor_get_status(&st);
+				steps_completed = labs(m.final_pos - m.initial_pos) * n_move;
 				if (m.final_pos > m.initial_pos) {
-					if (motor_get_dir() == CW)
-						steps_completed += motor_get_position() - m.initial_pos;
+					if (st.dir == CW)
+						steps_completed += st.position - m.initial_pos;
 					else
-						steps_completed += m.final_pos - motor_get_position();
+						steps_completed += m.final_pos - st.position;
 				} else {
-					if (motor_get_dir() == CW)
-						steps_completed += motor_get_position() - m.final_pos;
+					if (st.dir == CW)
+						steps_completed += st.position - m.final_pos;
 					else
-						steps_completed += m.initial_pos - motor_get_position();
+						steps_completed += m.initial_pos - st.position;
 				}
 				ltoa(steps_completed, str, 10);
-				uart_send_string("\n\rcompleted: ");
+				uart_send_string_p(PSTR("\n\rcompleted: "));
 				uart_send_string(str);
-				percentage = (steps_completed * 100) / total_steps;
-				lcd_update_percent((int8_t)percentage);
+				if (steps_completed < 0) steps_completed = 0;
+				lcd_update_percent((int8_t)units_percent(steps_completed, total_steps));
 			}			
 		}
 		
-		// Check encoder button
-		if(btn->query) button_check();
-		
-		// Check action to be taken
-		if((btn->action) && (btn->state == BTN_RELEASED) && (!btn->delay1)){
-			btn->action = FALSE;
+		// Limit switch hit: the motor was already halted by its ISR
+		if (motor_fault()) {
+			out = FALSE;
+			break;
+		}
+
+		if (ev == MENU_EVT_PRESS) {
 			if (timer_speed_check()) {
-				// motor still moving. PANIC BUTTON.
-				motor_stop(HARD_STOP);
+				// motor still moving. PANIC BUTTON: brakes at the 
+				// emergency rate, nothing else is run afterwards.
+				leg_armed = FALSE;
+				motor_queue_flush();
+				motor_stop(SOFT_STOP);
 				state = ST_STOP;
 			} else {
 				// motor already finished. Repeat movement
@@ -494,14 +489,17 @@ int8_t user_gogogo(struct auto_s m)
 			}
 		}
 
-		if(btn->action && btn->delay3){
-			btn->action = FALSE;
+		if (ev == MENU_EVT_HOLD) {
 			out = -1;
+			leg_armed = FALSE;
 			motor_stop(SOFT_STOP);
 			break;
 		}
 	}
 
+	motor_event_hook(NULL);
+	leg_armed = FALSE;
+
 	return out;
 }
 
@@ -509,6 +507,90 @@ int8_t user_gogogo(struct auto_s m)
 --------------------- I N T E R N A L   F U N C T I O N S ---------------------
 -----------------------------------------------------------------------------*/
 
+/*===========================================================================*/
+/*
+* Reads the pending motor events up to the first completion. Returns TRUE if
+* a movement was completed. Zero length legs are completed as soon as they
+* are issued: the completion events are read one per call, not merged.
+*/
+static uint8_t move_done(void)
+{
+	struct motor_event_s e;
+
+	while (motor_event_get(&e) == 0) {
+		if (e.type == MOTOR_EVT_DONE) return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*===========================================================================*/
+/*
+* Motor event hook, run as deferred work right after the motor timer ISR that
+* stamped the event (see motor_event_hook()). The armed leg is issued on
+* completion, without waiting for the next menu loop.
+*/
+static void leg_hook(uint8_t type)
+{
+	if ((type != MOTOR_EVT_DONE) || !leg_armed) return;
+
+	leg_armed = FALSE;
+	motor_move_to_pos(leg_pos, ABS, TRUE);
+}
+
+/*===========================================================================*/
+/*
+* Arms the next leg, issued by leg_hook() once the current one is completed
+*/
+static void leg_arm(int32_t pos)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		leg_pos = pos;
+		leg_armed = TRUE;
+	}
+}
+
+/*===========================================================================*/
+/*
+* Issues the armed leg if the hook did not: the deferred work queue was full,
+* or the leg was completed before it was armed.
+*/
+static void leg_issue(void)
+{
+	uint8_t armed;
+	int32_t pos;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		armed = leg_armed;
+		pos = leg_pos;
+		leg_armed = FALSE;
+	}
+	if (armed) motor_move_to_pos(pos, ABS, TRUE);
+}
+
+/*===========================================================================*/
+/*
+* Speed control detent: the speed setpoint goes up or down 5%, through zero
+* when the direction changes, within +/-100%.
+*/
+static int8_t speed_detent(uint8_t ev)
+{
+	int8_t i;
+
+	if (ev == MENU_EVT_CW) {
+		i = motor_get_speed_setpoint() + 5;
+		if ((i > 0) && (i < 5)) i = 0;	// force zero speed when transitioning from + to -
+	} else {
+		i = motor_get_speed_setpoint() - 5;
+		if ((i > -5) && (i < 0)) i = 0;	// force zero speed when transitioning from + to -
+	}
+
+	if(i > 100) i = 100;
+	else if(i < -100) i = -100;
+
+	return i;
+}
+
 /*===========================================================================*/
 /*
 * Sequence of Homing movements that move towards the beginning of the slider
@@ -518,6 +600,9 @@ static int8_t homing_cycle(void){
 	
 	int8_t x = -1;
 
+	// Homing is the recovery point after a limit switch fault
+	motor_fault_clear();
+
 	// Shortcut: 
 	// If encoder button is pressed, jump the HOMING routine and exit successfully
 	if (button_test()) {
@@ -525,7 +610,7 @@ static int8_t homing_cycle(void){
 		x = 0;
 	}
 
-	motor_set_maxspeed_percent(30);	// 30% of max speed
+	motor_set_maxspeed_percent(15);	// 15% of max speed
 	motor_set_accel_percent(30);	// 30% of max accel
 	// Check state of the switch. If it's pressed, get away from it
 	if (limit_switch_test())
@@ -538,6 +623,7 @@ static int8_t homing_cycle(void){
 		goto exit;
 	}
 	limit_switch_ISR(DISABLE);		// disable ISR while slider pulls back again
+	motor_fault_clear();			// expected hit: re-arm the motor
 	uart_send_string_p(PSTR("|"));
 	_delay_ms(100);
 
@@ -548,13 +634,14 @@ static int8_t homing_cycle(void){
 
 	// approach the switch again, but slower
 	limit_switch_ISR(ENABLE);		// enable ISR again
-	motor_set_maxspeed_percent(10);	// 10% of max speed
+	motor_set_maxspeed_percent(5);	// 5% of max speed
 	motor_set_accel_percent(10);	// 10% of max accel
 	if (motor_move_to_pos_block(-1600, REL, FALSE) >= 0) {	// move up to 1600 steps
 		uart_send_string_p(PSTR("ERROR. Can't detect limit"));
 		goto exit;
 	}
 	limit_switch_ISR(DISABLE);		// disable ISR while slider pulls back again
+	motor_fault_clear();			// expected hit: re-arm the motor
 	uart_send_string_p(PSTR("|"));
 	_delay_ms(200);
 
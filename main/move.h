@@ -16,6 +16,14 @@
 
 #include <stdint.h>
 
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+// Automatic movement speed units: steps/s times AUTO_SPEED_SCALE, so that
+// speeds below 1 step/s (movements lasting hours) are not truncated.
+#define AUTO_SPEED_SCALE	100
+
 /******************************************************************************
 ***************** S T R U C T U R E   D E C L A R A T I O N S ****************
 ******************************************************************************/
@@ -23,10 +31,11 @@
 struct auto_s {
 	int32_t initial_pos;
 	int32_t final_pos;
-	int32_t speed;
+	int32_t speed;		// steps/s * AUTO_SPEED_SCALE
 	uint8_t reps;
 	uint8_t loop;		// flag
 	int8_t accel;
+	uint8_t profile;	// PROFILE_xxx
 	uint8_t go; 		// flag
 };
 
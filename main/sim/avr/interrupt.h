@@ -0,0 +1,14 @@
+/*
+* Host simulator stand-in for <avr/interrupt.h>. Interrupt handlers are plain
+* functions, called by the simulator when their virtual event happens.
+*/
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define ISR(vect, ...)	void vect(void); void vect(void)
+#define sei()			(SREG |= 0x80)
+#define cli()			(SREG &= ~0x80)
+
+#endif /* SIM_AVR_INTERRUPT_H */
@@ -0,0 +1,58 @@
+/*
+* Host simulator stand-in for <avr/io.h>. The registers used by the firmware
+* are plain variables, defined in sim.c, and the bit positions are the ones 
+* of the ATmega328p.
+*/
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+
+#define SIM_REG8(x)		extern volatile uint8_t x;
+#define SIM_REG16(x)	extern volatile uint16_t x;
+
+SIM_REG8(PORTB) SIM_REG8(PORTC) SIM_REG8(PORTD)
+SIM_REG8(DDRB) SIM_REG8(DDRC) SIM_REG8(DDRD)
+SIM_REG8(PINB) SIM_REG8(PINC) SIM_REG8(PIND)
+SIM_REG8(TCCR0A) SIM_REG8(TCCR0B) SIM_REG8(TIMSK0) SIM_REG8(TIFR0)
+SIM_REG8(OCR0A) SIM_REG8(TCNT0)
+SIM_REG8(TCCR1A) SIM_REG8(TCCR1B) SIM_REG8(TIMSK1) SIM_REG8(TIFR1)
+SIM_REG16(OCR1A) SIM_REG16(TCNT1)
+SIM_REG8(TCCR2A) SIM_REG8(TCCR2B) SIM_REG8(TIMSK2) SIM_REG8(TIFR2)
+SIM_REG8(OCR2A) SIM_REG8(TCNT2)
+SIM_REG8(GTCCR) SIM_REG8(SREG)
+
+enum { PORTB0, PORTB1, PORTB2, PORTB3, PORTB4, PORTB5, PORTB6, PORTB7 };
+enum { PORTC0, PORTC1, PORTC2, PORTC3, PORTC4, PORTC5, PORTC6 };
+enum { PORTD0, PORTD1, PORTD2, PORTD3, PORTD4, PORTD5, PORTD6, PORTD7 };
+enum { DDB0, DDB1, DDB2, DDB3, DDB4, DDB5, DDB6, DDB7 };
+enum { DDC0, DDC1, DDC2, DDC3, DDC4, DDC5, DDC6 };
+enum { DDD0, DDD1, DDD2, DDD3, DDD4, DDD5, DDD6, DDD7 };
+
+// Timer 0
+#define WGM00		0
+#define WGM01		1
+#define CS00		0
+#define CS01		1
+#define CS02		2
+#define OCIE0A		1
+#define OCF0A		1
+// Timer 1
+#define WGM12		3
+#define CS10		0
+#define CS11		1
+#define CS12		2
+#define OCIE1A		1
+#define OCF1A		1
+// Timer 2
+#define WGM21		1
+#define CS20		0
+#define CS21		1
+#define CS22		2
+#define OCIE2A		1
+#define OCF2A		1
+// General Timer/Counter control
+#define PSRSYNC		0
+#define PSRASY		1
+
+#endif /* SIM_AVR_IO_H */
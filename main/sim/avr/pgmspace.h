@@ -0,0 +1,17 @@
+/*
+* Host simulator stand-in for <avr/pgmspace.h>. Program memory is just memory.
+*/
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s)				(s)
+#define pgm_read_byte(a)	(*(const uint8_t *)(a))
+#define pgm_read_word(a)	(*(const uint16_t *)(a))
+#define pgm_read_dword(a)	(*(const uint32_t *)(a))
+#define pgm_read_ptr(a)		(*(void * const *)(a))
+
+#endif /* SIM_AVR_PGMSPACE_H */
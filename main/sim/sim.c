@@ -0,0 +1,1592 @@
+/*
+* Motion simulator.
+* Host tool. Runs the motor module (motor.c), along with the timers, driver
+* and deferred work modules, against a virtual motor timer: whenever the
+* firmware starts the timer or loads a period, the simulator computes when
+* the next compare match happens and calls the motor timer ISR right then.
+* Virtual time is kept in base motor timer ticks, thus a whole rail long
+* movement is simulated in a few milliseconds, with the exact same step
+* timing the firmware produces.
+*
+* Usage:
+*	sim [-p <position>] [-s <speed %>] [-a <accel %>] [-D <decel %>] 
+*		[-P L|Q|S|E] [-t csv|vcd]
+*	sim -r [-p <position>] [-s <speed %>]
+*	sim -e [-p <position>] [-B <baseline>] [-u]
+*	sim -b [-p <position>]
+*	sim -v
+*	sim -w
+*	sim -d
+*	sim -k
+*	sim -y
+*	sim -q
+*
+* A movement from the origin to the given position (default: the whole rail)
+* is simulated. With -t, a per-step trace is written to stdout: time,
+* position, timer period and motion state, as CSV or VCD (waveform viewers).
+* With -D, the deceleration is set apart from the acceleration.
+* With -r, every speed profile and acceleration percent is simulated, and
+* the achieved peak speed, acceleration and duration are reported.
+*
+* With -e, every speed profile, acceleration and speed percent is simulated,
+* and the timer periods actually generated are compared against the exact
+* timing of the nominal ramp: constant acceleration (linear profile), or
+* position growing with the cube of time (quadratic profile). Some movements
+* with the deceleration set apart are checked too, against their own nominal
+* ramps. The relative errors of every movement are written as CSV to stdout,
+* and a summary to stderr once done. The exit status is non-zero if any of
+* them gets beyond its limit, thus any change to the profile math can be 
+* checked against them:
+*	- the first, second and last periods of the ramps are off by design (first
+*	order corrections, one period pipeline): fixed limits below.
+*	- the rest of the ramp periods, worst and mean errors: the baseline file
+*	(default sim/accuracy.csv) holds the worst ones for every profile and 
+*	speed percent, any acceleration. A little slack is allowed over them.
+* With -u, the baseline file is written from this run instead: after a 
+* deliberate change of the ramps, once the figures are checked.
+* Easing profiles (sine, ease in-out) are checked against their curve 
+* instead: the max deviation of the position at every step, relative to the
+* movement length.
+*
+* With -b, the cost of the motor timer ISR is measured for every profile, 
+* on the host CPU: only relative figures are meaningful, i.e. the easing 
+* profiles against the linear one.
+*
+* With -v, manual speed reversals are simulated: cruising at some speed, the
+* encoder is turned the other way at a steady pace, just like the manual 
+* speed menu does (see move.c), as many detents as it takes to command the
+* opposite speed. The time to the first step the other way, to the opposite
+* speed, and the speed finally reached are reported.
+*
+* With -w, the encoder-to-motion latency of the position control is measured
+* for some handwheel gears: the encoder is turned at a steady pace from rest,
+* then turned back as many detents. Both the handwheel mode (detents fed from
+* the encoder ISR) and the former polled path (one relative movement per
+* detent, issued by the 1ms menu loop) are simulated. Reported: the time from
+* the first edge to the first step, from the edge that leaves the commanded 
+* position behind the slider to the first step back, from the last edge to 
+* the last step, and the final offset from the start position (detents lost).
+*
+* With -d, back-to-back movements are simulated for some driver hold times 
+* (see drv_release()) and pauses between them: the busy wait to enable the
+* driver, the time from the command to the first step, and how many 
+* movements found the driver still enabled are reported.
+*
+* With -k, smooth stops are simulated once cruising at 40% speed, for some
+* accelerations: braking along the deceleration ramp (the emergency rate set
+* as slow as it) and at the default emergency rate. The stopping distance
+* and time are reported.
+*
+* With -y, some sliders synchronised over the UART bus are simulated (see
+* sync.c): a master, and slaves with their own clock error, powered on at
+* different times. The bus is one way, thus each slider is simulated in turn
+* from power on, in its own clock time: the master's frames are recorded, 
+* and then fed to every slave at the true time they're received. All of them
+* start a movement at the shared instant. Reported: the phase error of the
+* slave clock at the last beacon before the start, and its max once locked,
+* and the skew of the first and last steps against the master's.
+*
+* With -q, hundreds of mixed commands are chained through the motion command
+* queue (see motor_queue_push()), kept full while it drains: position moves
+* with and without dwell, some continuing the movement (blended), and some
+* changing the speed, acceleration or profile. For every movement started
+* after another one, the gap from the last step of the previous movement to
+* the first step of the new one is measured, dwell aside. The exit status is
+* non-zero if any gap exceeds the first step interval of the new movement:
+* the time its own ramp takes to the first step.
+*/
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "motor.h"
+#include "sync.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+#define TICKS_PER_MS	(F_MOTOR / 1000)
+#define TICKS_PER_US	(F_MOTOR / 1000000)
+#define EVENTS_MAX		10000000UL	// runaway movement guard
+
+// Accuracy limits: relative error of the ramp periods that are off by 
+// design, any movement. The linear first period is short on purpose (0.676
+// correction), the quadratic one is the reference. The linear second one 
+// comes from the one period pipeline (c0 runs twice), the quadratic ramp 
+// computes it up front. Slowing down, the pipeline ends both ramps one 
+// period early: the last period is the nominal one before last.
+#define ERR_FIRST_LINEAR		0.33
+#define ERR_SECOND_LINEAR		0.64
+#define ERR_SECOND_QUADRATIC	0.001
+#define ERR_LAST_LINEAR			0.60
+#define ERR_LAST_QUADRATIC		0.75
+// Rest of the ramp periods: the baseline ones, times the slack, plus a 
+// floor for the rounding of the baseline file.
+#define ERR_SLACK				1.10
+#define ERR_FLOOR				0.0001
+#define ERR_DEV_EASE			0.003	// position deviation, over the length
+#define BASE_FILE				"sim/accuracy.csv"
+#define BASE_LEN				256		// baseline entries
+
+#define BENCH_RUNS		50
+#define DETENT_MS		20			// encoder pace, reversal simulation
+#define REVERSAL_MS		10000		// reversal simulation time limit
+#define HW_DETENTS		10			// handwheel simulation, each way
+#define HW_MS			10000		// handwheel simulation time limit
+#define HOLD_MOVES		10			// hold policy simulation, movements
+#define HOLD_STEPS		400			// eighth-steps each
+#define DECEL_RUNS		5			// asymmetric ramps check, percents
+#define STOP_SPEED		40			// stop distance simulation, speed %
+#define SYNC_ARM_MS		15000		// sync simulation: master arms the start
+#define SYNC_SIM_MS		20000		// sync simulation time, each slider
+#define SYNC_SETTLE		4			// beacons to settle, once locked
+#define BUS_LEN			1024		// bytes on the sync bus
+#define CHAR_TICKS		((10 * F_MOTOR + BAUD / 2) / BAUD)	// UART byte
+#define GENERAL_TICKS	(F_MOTOR / (F_CPU / 128))	// general timer tick
+#define CHAIN_CMDS		500			// queue simulation, commands
+#define CHAIN_DWELL_MS	50			// max dwell of a command
+
+#define TRACE_NONE		0
+#define TRACE_CSV		1
+#define TRACE_VCD		2
+
+/******************************************************************************
+***************** S T R U C T U R E   D E C L A R A T I O N S ****************
+******************************************************************************/
+
+// Movement figures, computed from the simulated steps
+struct sim_result_s {
+	double speed_peak;		// eighth-steps/s
+	double accel;			// eighth-steps/s^2, from start to peak speed
+	double decel;			// eighth-steps/s^2, from peak speed to stop
+	double duration;		// seconds, from start to last step
+	int32_t position;		// final position
+	uint32_t events;		// motor timer ISR calls
+	double err_first;		// relative error of the first period (linear)
+	double err_second;		// relative error of the second period
+	double err_last;		// relative error of the last period
+	double err_up;			// max relative error of the other periods speeding
+	double err_down;		// up, and slowing down
+	double err_mean;		// mean relative error of them
+	double dev;				// max position deviation from the easing curve
+	double isr_ns;			// host time spent in the motor timer ISR
+};
+
+// Accuracy baseline: worst errors of the ramp periods, the ones off by design
+// aside, of a movement kind at a speed percent (see accuracy())
+struct sim_base_s {
+	char name[16];			// profile, and the deceleration if set apart
+	int speed;
+	double err[3];			// up, down, mean
+};
+
+// Byte on the sync bus, and when it's received: true time, motor timer ticks
+struct sim_byte_s {
+	uint64_t t;
+	char c;
+};
+
+// Sync simulation figures of a slider. True times, motor timer ticks
+struct sim_sync_s {
+	double t_first;			// first step of the movement
+	double t_last;			// last step
+	double err_start;		// phase error at the last beacon before start, us
+	double err_max;			// max phase error once locked, us
+	int beacons;			// beacons since locked, before start
+};
+
+/******************************************************************************
+****************** V A R I A B L E S   D E F I N I T I O N S ******************
+******************************************************************************/
+
+// Registers
+volatile uint8_t PORTB, PORTC, PORTD, DDRB, DDRC, DDRD, PINB, PINC, PIND;
+volatile uint8_t TCCR0A, TCCR0B, TIMSK0, TIFR0, OCR0A, TCNT0;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t OCR1A, TCNT1;
+volatile uint8_t TCCR2A, TCCR2B, TIMSK2, TIFR2, OCR2A, TCNT2;
+volatile uint8_t GTCCR, SREG;
+
+static uint64_t now;				// virtual time, motor timer ticks
+static uint64_t next;				// next motor timer compare match
+static uint8_t trace = TRACE_NONE;
+static uint8_t bench = FALSE;
+static uint8_t sim_speed;			// max speed percent of the movement
+static uint8_t sim_accel;			// acceleration percent
+static uint8_t sim_dec;				// deceleration percent
+static volatile uint8_t limit_switch;
+unsigned long sim_busy_us;			// busy waits (util/delay.h), us
+
+// Sync simulation
+static uint64_t next_ms;			// next general timer compare match
+static uint64_t last_ms;			// last one
+static struct sim_byte_s bus[BUS_LEN];
+static uint16_t bus_len;
+static uint8_t bus_rec;				// bytes sent are recorded on the bus
+static uint8_t in_background;
+static uint64_t step_first, step_last;
+static int32_t step_pos;
+static struct sim_base_s base[BASE_LEN];
+static int base_len;
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+void TIMER1_COMPA_vect(void);
+void TIMER0_COMPA_vect(void);
+void TIMER2_COMPA_vect(void);
+void USART_TX_vect(void);
+
+static void usage(const char *name);
+static uint8_t timer_running(void);
+static uint32_t timer_period(void);
+static void sim_reset(uint8_t profile, uint8_t accel, uint8_t speed);
+static void sim_move(int32_t pos, struct sim_result_s *r);
+static void trace_header(void);
+static void trace_step(const struct motor_status_s *s, uint32_t period);
+static const char *state_name(uint8_t state);
+static void report(int32_t pos, uint8_t speed);
+static double ref_time(uint8_t profile, double p, double k);
+static double rel_error(double t, double ref);
+static double ease_duration(uint8_t profile, double len);
+static double ease_ref(uint8_t profile, double t);
+static int accuracy(int32_t pos, const char *file, uint8_t update);
+static struct sim_base_s *base_find(const char *name, int speed, uint8_t add);
+static int base_load(const char *file);
+static int base_save(const char *file);
+static double base_check(const char *name, int speed,
+	const struct sim_result_s *r, uint8_t update);
+static void benchmark(int32_t pos);
+static void sim_speed_cmd(int8_t s);
+static void reversal(void);
+static void sim_detent(uint8_t polled, int8_t d, uint16_t gear);
+static void handwheel(void);
+static void hold_policy(void);
+static void sim_decel(uint8_t decel);
+static void stop_distance(void);
+static void sync_run(uint64_t t);
+static void sync_job(uint8_t arg);
+static void sync_slider(uint8_t master, double ppm, double boot_ms,
+	struct sim_sync_s *r);
+static void sync_bus(void);
+static void chain_cmd(struct motor_cmd_s *c, int32_t prev, int8_t *dir);
+static int chain(void);
+static const char *profile_name(uint8_t profile);
+
+/*===========================================================================*/
+int main(int argc, char *argv[])
+{
+	struct sim_result_s r;
+	int32_t pos = MAX_COUNT;
+	uint8_t profile = PROFILE_LINEAR;
+	int speed = 100, accel = 100, decel = -1;
+	uint8_t table = FALSE, check = FALSE, rev = FALSE, hw = FALSE, hold = FALSE;
+	uint8_t stop = FALSE, sync = FALSE, queue = FALSE, update = FALSE;
+	const char *file = BASE_FILE;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:s:a:D:P:t:reB:ubvwdkyq")) != -1) {
+		switch (opt) {
+			case 'p': pos = strtol(optarg, NULL, 10); break;
+			case 's': speed = strtol(optarg, NULL, 10); break;
+			case 'a': accel = strtol(optarg, NULL, 10); break;
+			case 'D': decel = strtol(optarg, NULL, 10); break;
+			case 'P':
+				if (optarg[0] == 'L') profile = PROFILE_LINEAR;
+				else if (optarg[0] == 'Q') profile = PROFILE_QUADRATIC;
+				else if (optarg[0] == 'S') profile = PROFILE_SINE;
+				else if (optarg[0] == 'E') profile = PROFILE_SMOOTH;
+				else usage(argv[0]);
+				break;
+			case 't':
+				if (strcmp(optarg, "csv") == 0) trace = TRACE_CSV;
+				else if (strcmp(optarg, "vcd") == 0) trace = TRACE_VCD;
+				else usage(argv[0]);
+				break;
+			case 'r': table = TRUE; break;
+			case 'e': check = TRUE; break;
+			case 'B': file = optarg; break;
+			case 'u': update = TRUE; break;
+			case 'b': bench = TRUE; break;
+			case 'v': rev = TRUE; break;
+			case 'w': hw = TRUE; break;
+			case 'd': hold = TRUE; break;
+			case 'k': stop = TRUE; break;
+			case 'y': sync = TRUE; break;
+			case 'q': queue = TRUE; break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if ((speed < 1) || (speed > 100) || (accel < 0) || (accel > 100) ||
+		(decel < -1) || (decel > 100) || (pos <= 0) || (pos > MAX_COUNT))
+		usage(argv[0]);
+
+	if (table) {
+		trace = TRACE_NONE;
+		report(pos, (uint8_t)speed);
+		return 0;
+	}
+	if (check) {
+		trace = TRACE_NONE;
+		return accuracy(pos, file, update);
+	}
+	if (bench) {
+		trace = TRACE_NONE;
+		benchmark(pos);
+		return 0;
+	}
+	if (rev) {
+		trace = TRACE_NONE;
+		reversal();
+		return 0;
+	}
+	if (hw) {
+		trace = TRACE_NONE;
+		handwheel();
+		return 0;
+	}
+	if (hold) {
+		trace = TRACE_NONE;
+		hold_policy();
+		return 0;
+	}
+	if (stop) {
+		trace = TRACE_NONE;
+		stop_distance();
+		return 0;
+	}
+	if (sync) {
+		trace = TRACE_NONE;
+		sync_bus();
+		return 0;
+	}
+	if (queue) {
+		trace = TRACE_NONE;
+		return chain();
+	}
+
+	sim_reset(profile, (uint8_t)accel, (uint8_t)speed);
+	if (decel >= 0) sim_decel((uint8_t)decel);
+	trace_header();
+	sim_move(pos, &r);
+
+	if (trace == TRACE_NONE) {
+		printf("position: %ld, events: %lu\n", (long)r.position,
+			(unsigned long)r.events);
+		printf("peak speed: %.1f steps/s, accel: %.1f steps/s^2 "
+			"(nominal %d), duration: %.3f s\n",
+			r.speed_peak, r.accel, motor_get_accel(), r.duration);
+		printf("decel: %.1f steps/s^2 (nominal %d)\n", r.decel,
+			motor_get_decel());
+	}
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+--------------------- I N T E R N A L   F U N C T I O N S ---------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-p position] [-s speed %%] [-a accel %%] "
+		"[-D decel %%] [-P L|Q|S|E] [-t csv|vcd]\n"
+		"       %s -r [-p position] [-s speed %%]\n"
+		"       %s -e [-p position] [-B baseline] [-u]\n"
+		"       %s -b [-p position]\n"
+		"       %s -v\n"
+		"       %s -w\n"
+		"       %s -d\n"
+		"       %s -k\n"
+		"       %s -y\n"
+		"       %s -q\n", name, name, name, name, name, name, name, name, name, name);
+	exit(1);
+}
+
+/*===========================================================================*/
+static uint8_t timer_running(void)
+{
+	return TCCR1B & ((1<<CS12) | (1<<CS11) | (1<<CS10));
+}
+
+/*===========================================================================*/
+/*
+* Virtual motor timer period, in base motor timer ticks: compare value and
+* prescaler currently loaded (CTC mode).
+*/
+static uint32_t timer_period(void)
+{
+	uint8_t shift;
+
+	switch (timer_running()) {
+		case (1<<CS11): shift = 0; break;					// 1/8
+		case (1<<CS11) | (1<<CS10): shift = 3; break;		// 1/64
+		case (1<<CS12): shift = 5; break;					// 1/256
+		default: shift = 7; break;							// 1/1024
+	}
+
+	return ((uint32_t)OCR1A + 1) << shift;
+}
+
+/*===========================================================================*/
+/*
+* Deferred work: the auxiliary timer ISR is run right away once armed.
+*/
+static void soft_interrupt(void)
+{
+	if (TCCR0B & ((1<<CS02) | (1<<CS01) | (1<<CS00)))
+		TIMER0_COMPA_vect();
+}
+
+/*===========================================================================*/
+static void sim_reset(uint8_t profile, uint8_t accel, uint8_t speed)
+{
+	now = 0;
+	next = 0;
+	uptime_ms = 0;
+	timer_speed_init();
+	defer_init();
+	drv_set(DISABLE);					// as init.c leaves it
+	motor_init();
+	motor_set_speed_profile(profile);
+	motor_set_accel_percent(accel);
+	motor_set_maxspeed_percent(speed);
+	sim_speed = speed;
+	sim_accel = accel;
+	sim_dec = accel;
+}
+
+/*===========================================================================*/
+/*
+* Simulates a movement until the motor timer is stopped. The counter is
+* cleared by the firmware whenever it (re)starts the timer: it's used as a
+* marker to know the next compare match is one period away from now.
+*
+* Every period is also compared against the nominal ramp timing: from the
+* start position while speeding up, and to the target while slowing down.
+* The quadratic ramp is scaled to its first period, since it has no nominal
+* acceleration. Easing movements are compared against their curve.
+*/
+static void sim_move(int32_t pos, struct sim_result_s *r)
+{
+	struct motor_status_s s;
+	uint64_t t_start, t_last, t_prev, t_peak = 0;
+	int32_t p_start, p_last, p_prev;
+	uint8_t profile = motor_get_profile();
+	uint8_t s_prev;
+	double v, k = (double)motor_get_accel(), t, ref, e, e_sum = 0.0;
+	double kd = (double)motor_get_decel();
+	uint64_t t_fall = 0;
+	double len = 0.0, t_ease = 1.0;
+	uint32_t e_count = 0;
+	struct timespec b0, b1;
+
+	memset(r, 0, sizeof(*r));
+	motor_get_status(&s);
+	p_start = s.position;
+	p_last = s.position;
+	p_prev = s.position;
+	t_start = now;
+	t_last = now;
+	t_prev = now;
+
+	if (PROFILE_EASING(profile)) {
+		len = (double)labs(pos - p_start);
+		t_ease = ease_duration(profile, len);
+	}
+
+	TCNT1 = 1;
+	motor_move_to_pos(pos, ABS, TRUE);
+	if (timer_running() && (TCNT1 == 0)) next = now + timer_period();
+	soft_interrupt();
+	motor_get_status(&s);
+	s_prev = s.state;
+
+	while (timer_running() && (r->events < EVENTS_MAX)) {
+		now = next;
+		uptime_ms = now / TICKS_PER_MS;
+		if (bench) {
+			clock_gettime(CLOCK_MONOTONIC, &b0);
+			TIMER1_COMPA_vect();
+			clock_gettime(CLOCK_MONOTONIC, &b1);
+			r->isr_ns += (b1.tv_sec - b0.tv_sec) * 1e9 + (b1.tv_nsec - b0.tv_nsec);
+		} else {
+			TIMER1_COMPA_vect();
+		}
+		r->events++;
+		if (timer_running()) next = now + timer_period();
+
+		motor_get_status(&s);
+		t = (double)(now - t_prev) / F_MOTOR;
+		if (PROFILE_EASING(profile)) {
+			ref = len * ease_ref(profile, (double)(now - t_start) / F_MOTOR / t_ease);
+			e = fabs((double)labs(s.position - p_start) - ref) / len;
+			if (e > r->dev) r->dev = e;
+		} else if (r->events == 1) {
+			if (profile == PROFILE_QUADRATIC) {
+				k = t;
+				kd = k * (double)motion_c0q[sim_dec] / (double)motion_c0q[sim_accel];
+			}
+			else r->err_first = rel_error(t, ref_time(profile, s.position - p_start, k));
+		} else if (s_prev == SPEED_UP) {
+			ref = ref_time(profile, s.position - p_start, k) -
+				ref_time(profile, p_prev - p_start, k);
+			e = rel_error(t, ref);
+			if (r->events == 2) {
+				r->err_second = e;
+			} else {
+				if (e > r->err_up) r->err_up = e;
+				e_sum += e;
+				e_count++;
+			}
+		} else if (s_prev == SPEED_DOWN) {
+			ref = ref_time(profile, labs(pos - p_prev), kd) -
+				ref_time(profile, labs(pos - s.position), kd);
+			e = rel_error(t, ref);
+			if (s.position == pos) {
+				r->err_last = e;
+			} else {
+				if (e > r->err_down) r->err_down = e;
+				e_sum += e;
+				e_count++;
+			}
+		}
+		s_prev = s.state;
+		p_prev = s.position;
+		t_prev = now;
+
+		if (s.position != p_last) {
+			v = (double)labs(s.position - p_last) * F_MOTOR / (double)(now - t_last);
+			if (v > r->speed_peak) {
+				r->speed_peak = v;
+				t_peak = now;
+			}
+			if (v >= 0.99 * r->speed_peak) t_fall = now;
+			p_last = s.position;
+			t_last = now;
+		}
+		trace_step(&s, timer_running() ? (uint32_t)(next - now) : 0);
+		soft_interrupt();
+	}
+
+	if (e_count) r->err_mean = e_sum / e_count;
+	r->position = s.position;
+	r->duration = (double)(t_last - t_start) / F_MOTOR;
+	if (t_peak > t_start)
+		r->accel = r->speed_peak * F_MOTOR / (double)(t_peak - t_start);
+	if (t_last > t_fall)
+		r->decel = r->speed_peak * F_MOTOR / (double)(t_last - t_fall);
+}
+
+/*===========================================================================*/
+/*
+* Deceleration set apart, right after sim_reset()
+*/
+static void sim_decel(uint8_t decel)
+{
+	motor_set_decel_percent(decel);
+	sim_dec = decel;
+}
+
+/*===========================================================================*/
+static void trace_header(void)
+{
+	if (trace == TRACE_CSV) {
+		printf("time_us,position,interval,state\n");
+	} else if (trace == TRACE_VCD) {
+		printf("$timescale 1 ns $end\n");
+		printf("$scope module slider $end\n");
+		printf("$var wire 1 ! step $end\n");
+		printf("$var wire 1 \" dir $end\n");
+		printf("$var integer 32 # position $end\n");
+		printf("$var integer 32 $ interval $end\n");
+		printf("$var integer 8 %% state $end\n");
+		printf("$upscope $end\n$enddefinitions $end\n");
+		printf("#0\n0!\n0\"\nb0 #\nb0 $\nb%s %%\n", "11110000");
+	}
+}
+
+/*===========================================================================*/
+/*
+* One trace record per motor timer ISR: state right after it, and the period
+* until the next one (in motor timer ticks, 0 once stopped).
+*/
+static void trace_step(const struct motor_status_s *s, uint32_t period)
+{
+	uint64_t ns = now * 1000 / TICKS_PER_US;
+	char bin[33];
+
+	if (trace == TRACE_CSV) {
+		printf("%.1f,%ld,%lu,%s\n", (double)now / TICKS_PER_US,
+			(long)s->position, (unsigned long)period, state_name(s->state));
+	} else if (trace == TRACE_VCD) {
+		printf("#%llu\n1!\n%c\"\n", (unsigned long long)ns, s->dir ? '1' : '0');
+		for (int i = 0; i < 32; i++) bin[i] = ((uint32_t)s->position >> (31 - i)) & 1 ? '1' : '0';
+		bin[32] = '\0';
+		printf("b%s #\n", bin);
+		for (int i = 0; i < 32; i++) bin[i] = (period >> (31 - i)) & 1 ? '1' : '0';
+		printf("b%s $\n", bin);
+		for (int i = 0; i < 8; i++) bin[i] = (s->state >> (7 - i)) & 1 ? '1' : '0';
+		bin[8] = '\0';
+		printf("b%s %%\n", bin);
+		printf("#%llu\n0!\n", (unsigned long long)(ns + 1000));	// 1us pulse
+	}
+}
+
+/*===========================================================================*/
+static const char *state_name(uint8_t state)
+{
+	switch (state) {
+		case SPEED_UP: return "UP";
+		case SPEED_FLAT: return "FLAT";
+		case SPEED_DOWN: return "DOWN";
+		case SPEED_HALT: return "HALT";
+		case SPEED_DWELL: return "DWELL";
+		case SPEED_STREAM: return "STREAM";
+		default: return "?";
+	}
+}
+
+/*===========================================================================*/
+/*
+* Every speed profile and acceleration percent, same movement.
+*/
+static void report(int32_t pos, uint8_t speed)
+{
+	struct sim_result_s r;
+	clock_t t = clock();
+	int runs = 0;
+
+	printf("profile,accel_pct,accel_nominal,accel,speed_peak,duration_s,position,events\n");
+	for (uint8_t p = PROFILE_LINEAR; p <= PROFILE_SMOOTH; p++) {
+		for (int a = 0; a <= 100; a++) {
+			sim_reset(p, (uint8_t)a, speed);
+			sim_move(pos, &r);
+			printf("%s,%d,%d,%.1f,%.1f,%.4f,%ld,%lu\n", profile_name(p), a,
+				motor_get_accel(), r.accel, r.speed_peak, r.duration,
+				(long)r.position, (unsigned long)r.events);
+			runs++;
+		}
+	}
+	fprintf(stderr, "%d movements simulated, %.2f ms each\n", runs,
+		1000.0 * (double)(clock() - t) / CLOCKS_PER_SEC / runs);
+}
+
+/*===========================================================================*/
+/*
+* Nominal time to travel p eighth-steps from standstill. 'k' is the linear
+* ramp acceleration, or the quadratic ramp time scale (its first period).
+*/
+static double ref_time(uint8_t profile, double p, double k)
+{
+	if (profile == PROFILE_QUADRATIC) return k * cbrt(p);
+	return sqrt(2.0 * p / k);
+}
+
+/*===========================================================================*/
+static double rel_error(double t, double ref)
+{
+	return fabs(t - ref) / ref;
+}
+
+/*===========================================================================*/
+/*
+* Nominal easing movement duration, seconds: the shortest one within the
+* max speed and the acceleration. Same as the firmware, see motor.c
+*/
+static double ease_duration(uint8_t profile, double len)
+{
+	double v = (profile == PROFILE_SINE) ? EASE_SINE_V : EASE_SMOOTH_V;
+	double a = (profile == PROFILE_SINE) ? EASE_SINE_A : EASE_SMOOTH_A;
+	double cmin = (double)motion_cmin[sim_speed];
+	double t_speed = v * len * (cmin + 1.0) / F_MOTOR;
+	double t_accel = sqrt(a * len / (double)motor_get_accel());
+
+	return (t_speed > t_accel) ? t_speed : t_accel;
+}
+
+/*===========================================================================*/
+/*
+* Easing curves: position fraction at time fraction t. The exact ones, not
+* the firmware tables.
+*/
+static double ease_ref(uint8_t profile, double t)
+{
+	if (t > 1.0) t = 1.0;
+	if (profile == PROFILE_SINE) return (1.0 - cos(M_PI * t)) / 2.0;
+	return t * t * t * (t * (t * 6.0 - 15.0) + 10.0);
+}
+
+/*===========================================================================*/
+/*
+* Profile accuracy: every speed profile, acceleration and speed percent, and
+* some movements with the deceleration set apart. One CSV line per movement
+* with its errors, and the worst ones to stderr at the end. Returns non-zero
+* if any error is beyond its limit, or the baseline can't be read or written.
+*/
+static int accuracy(int32_t pos, const char *file, uint8_t update)
+{
+	struct sim_result_s r;
+	double worst[3][3] = {{0}};		// [profile][first, second, last]
+	double dev[2] = {0};			// [easing profile]
+	double x, x_max = 0.0;
+	char name[16], x_name[16] = "";
+	int x_accel = 0, x_speed = 0, over = 0, moves = 0;
+	int fail = FALSE;
+
+	if (!update && (base_load(file) < 0)) {
+		fprintf(stderr, "can't read the baseline %s (see -u)\n", file);
+		return 1;
+	}
+
+	printf("profile,accel_pct,speed_pct,err_first,err_second,err_last,err_up,"
+		"err_down,err_mean\n");
+	for (uint8_t p = PROFILE_LINEAR; p <= PROFILE_QUADRATIC; p++) {
+		double *w = worst[p];
+
+		// every accel and speed percent, then the deceleration set apart:
+		// some percents of each, every pair
+		for (int i = 0; i < 101 * 100 + DECEL_RUNS * DECEL_RUNS; i++) {
+			if (i < 101 * 100) {
+				sim_reset(p, (uint8_t)(i / 100), (uint8_t)(i % 100 + 1));
+				snprintf(name, sizeof(name), "%s", profile_name(p));
+			} else {
+				int a = (i - 101 * 100) / DECEL_RUNS;
+				int d = (i - 101 * 100) % DECEL_RUNS;
+
+				if (a == d) continue;
+				sim_reset(p, (uint8_t)(a * 100 / (DECEL_RUNS - 1)), 100);
+				sim_decel((uint8_t)(d * 100 / (DECEL_RUNS - 1)));
+				snprintf(name, sizeof(name), "%s/%d", profile_name(p), sim_dec);
+			}
+			sim_move(pos, &r);
+			moves++;
+			printf("%s,%d,%d,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n", name, sim_accel,
+				sim_speed, r.err_first, r.err_second, r.err_last, r.err_up,
+				r.err_down, r.err_mean);
+
+			w[0] = fmax(w[0], r.err_first);
+			w[1] = fmax(w[1], r.err_second);
+			w[2] = fmax(w[2], r.err_last);
+			x = base_check(name, sim_speed, &r, update);
+			if (x > 1.0) over++;
+			if (x > x_max) {
+				x_max = x;
+				strcpy(x_name, name);
+				x_accel = sim_accel;
+				x_speed = sim_speed;
+			}
+		}
+		if ((w[0] > ((p == PROFILE_LINEAR) ? ERR_FIRST_LINEAR : 0.0)) ||
+			(w[1] > ((p == PROFILE_LINEAR) ? ERR_SECOND_LINEAR : ERR_SECOND_QUADRATIC)) ||
+			(w[2] > ((p == PROFILE_LINEAR) ? ERR_LAST_LINEAR : ERR_LAST_QUADRATIC)))
+			fail = TRUE;
+	}
+
+	// easing profiles: deviation from the curve, in the ramp CSV columns
+	for (uint8_t p = PROFILE_SINE; p <= PROFILE_SMOOTH; p++) {
+		double *d = &dev[p - PROFILE_SINE];
+
+		for (int a = 0; a <= 100; a += 5) {
+			for (int v = 5; v <= 100; v += 5) {
+				sim_reset(p, (uint8_t)a, (uint8_t)v);
+				sim_move(pos, &r);
+				printf("%s,%d,%d,0,0,0,%.5f,%.5f,%.5f\n", profile_name(p), a, v,
+					r.dev, r.dev, r.dev);
+				if (r.dev > *d) *d = r.dev;
+				if (r.dev > ERR_DEV_EASE) fail = TRUE;
+			}
+		}
+	}
+	fflush(stdout);
+
+	for (uint8_t p = PROFILE_LINEAR; p <= PROFILE_QUADRATIC; p++) {
+		fprintf(stderr, "%s: first %.2f%% (limit %.2f%%), second %.2f%% (limit "
+			"%.2f%%), last %.2f%% (limit %.2f%%)\n", profile_name(p), 
+			worst[p][0] * 100.0, 
+			((p == PROFILE_LINEAR) ? ERR_FIRST_LINEAR : 0.0) * 100.0,
+			worst[p][1] * 100.0,
+			((p == PROFILE_LINEAR) ? ERR_SECOND_LINEAR : ERR_SECOND_QUADRATIC) * 100.0,
+			worst[p][2] * 100.0,
+			((p == PROFILE_LINEAR) ? ERR_LAST_LINEAR : ERR_LAST_QUADRATIC) * 100.0);
+	}
+	for (uint8_t p = PROFILE_SINE; p <= PROFILE_SMOOTH; p++) {
+		fprintf(stderr, "%s: deviation %.3f%% (limit %.3f%%)\n", profile_name(p),
+			dev[p - PROFILE_SINE] * 100.0, ERR_DEV_EASE * 100.0);
+	}
+
+	if (update) {
+		if (base_save(file) < 0) {
+			fprintf(stderr, "can't write the baseline %s\n", file);
+			return 1;
+		}
+		fprintf(stderr, "baseline %s written: %d entries\n", file, base_len);
+	} else {
+		fprintf(stderr, "baseline %s: %d movements, %d beyond it. Worst: %s "
+			"accel %d%% speed %d%%, at %.0f%% of its limit\n", file, moves, over,
+			x_name, x_accel, x_speed, x_max * 100.0);
+		if (over) fail = TRUE;
+	}
+	fprintf(stderr, "%s\n", fail ? "FAIL" : "PASS");
+
+	return fail ? 1 : 0;
+}
+
+/*===========================================================================*/
+/*
+* Baseline entry of a movement kind and speed percent, or NULL if there's 
+* none. If 'add' is set, a missing one is added, all errors zero.
+*/
+static struct sim_base_s *base_find(const char *name, int speed, uint8_t add)
+{
+	for (int i = 0; i < base_len; i++) {
+		if ((base[i].speed == speed) && (strcmp(base[i].name, name) == 0))
+			return &base[i];
+	}
+	if (!add || (base_len >= BASE_LEN)) return NULL;
+
+	memset(&base[base_len], 0, sizeof(base[0]));
+	snprintf(base[base_len].name, sizeof(base[0].name), "%s", name);
+	base[base_len].speed = speed;
+
+	return &base[base_len++];
+}
+
+/*===========================================================================*/
+/*
+* Baseline file: CSV, one line per entry after the header. Returns -1 if 
+* it can't be read.
+*/
+static int base_load(const char *file)
+{
+	FILE *f = fopen(file, "r");
+	struct sim_base_s b;
+	char line[128];
+
+	if (f == NULL) return -1;
+
+	base_len = 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%15[^,],%d,%lf,%lf,%lf", b.name, &b.speed, &b.err[0],
+			&b.err[1], &b.err[2]) != 5)
+			continue;					// header
+		if (base_len >= BASE_LEN) break;
+		base[base_len++] = b;
+	}
+	fclose(f);
+
+	return base_len ? 0 : -1;
+}
+
+/*===========================================================================*/
+static int base_save(const char *file)
+{
+	FILE *f = fopen(file, "w");
+
+	if (f == NULL) return -1;
+
+	fprintf(f, "name,speed_pct,err_up,err_down,err_mean\n");
+	for (int i = 0; i < base_len; i++) {
+		fprintf(f, "%s,%d,%.5f,%.5f,%.5f\n", base[i].name, base[i].speed,
+			base[i].err[0], base[i].err[1], base[i].err[2]);
+	}
+
+	return (fclose(f) == 0) ? 0 : -1;
+}
+
+/*===========================================================================*/
+/*
+* Ramp errors of a movement against the baseline. Returns the largest one
+* relative to its limit: beyond 1.0, a regression. A missing entry counts as
+* one. If 'update' is set, the baseline takes the worst errors instead.
+*/
+static double base_check(const char *name, int speed,
+	const struct sim_result_s *r, uint8_t update)
+{
+	struct sim_base_s *b = base_find(name, speed, update);
+	double err[3] = {r->err_up, r->err_down, r->err_mean};
+	double x = 0.0;
+
+	if (b == NULL) return 2.0;
+
+	for (int i = 0; i < 3; i++) {
+		if (update) b->err[i] = fmax(b->err[i], err[i]);
+		else x = fmax(x, err[i] / (b->err[i] * ERR_SLACK + ERR_FLOOR));
+	}
+
+	return x;
+}
+
+/*===========================================================================*/
+/*
+* Motor timer ISR cost of every profile: same movement, max speed & accel,
+* run a few times. The host CPU is way faster than the AVR one, thus only
+* the figures relative to the linear profile are meaningful. The cost of
+* reading the clock around every ISR call is measured first, and deducted.
+*/
+static void benchmark(int32_t pos)
+{
+	struct sim_result_s r;
+	struct timespec b0, b1;
+	double ns_linear = 0.0, ns_clock = 0.0;
+
+	for (int i = 0; i < 1000000; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &b0);
+		clock_gettime(CLOCK_MONOTONIC, &b1);
+		ns_clock += (b1.tv_sec - b0.tv_sec) * 1e9 + (b1.tv_nsec - b0.tv_nsec);
+	}
+	ns_clock /= 1000000;
+
+	printf("profile,events,ns_per_isr,ratio,duration_s\n");
+	for (uint8_t p = PROFILE_LINEAR; p <= PROFILE_SMOOTH; p++) {
+		double ns = 0.0;
+		uint32_t events = 0;
+
+		for (int i = 0; i < BENCH_RUNS; i++) {
+			sim_reset(p, 100, 100);
+			sim_move(pos, &r);
+			ns += r.isr_ns;
+			events += r.events;
+		}
+		ns = ns / events - ns_clock;
+		if (p == PROFILE_LINEAR) ns_linear = ns;
+		printf("%s,%lu,%.1f,%.2f,%.3f\n", profile_name(p),
+			(unsigned long)(events / BENCH_RUNS), ns, ns / ns_linear, r.duration);
+	}
+}
+
+/*===========================================================================*/
+/*
+* Speed command at the current virtual time. The timer counter marks 
+* whether the motor timer was (re)started, as in sim_move().
+*/
+static void sim_speed_cmd(int8_t s)
+{
+	TCNT1 = 1;
+	motor_move_at_speed(s);
+	if (timer_running() && (TCNT1 == 0)) next = now + timer_period();
+	soft_interrupt();
+}
+
+/*===========================================================================*/
+/*
+* Manual speed reversals, from every speed down to its opposite. The motor
+* timer ISR and the encoder detents are run in time order.
+*/
+static void reversal(void)
+{
+	struct motor_status_s s;
+
+	printf("speed_pct,detents,first_step_ms,opposite_speed_ms,final_pct\n");
+	for (int v = 10; v <= 70; v += 10) {
+		uint64_t t_cmd, t_detent, t_first = 0, t_speed = 0;
+		int32_t p_prev;
+		int detents = 0;
+		int8_t i = v;
+
+		sim_reset(PROFILE_LINEAR, 100, 100);
+		sim_speed_cmd(v);
+		do {
+			now = next;
+			TIMER1_COMPA_vect();
+			if (timer_running()) next = now + timer_period();
+			soft_interrupt();
+			motor_get_status(&s);
+		} while (timer_running() && (s.state != SPEED_FLAT));
+
+		t_cmd = now;
+		t_detent = now;
+		p_prev = s.position;
+		while (timer_running() && !t_speed &&
+			(now - t_cmd < (uint64_t)REVERSAL_MS * TICKS_PER_MS)) {
+			if ((detents < 2 * v / 5) && (t_detent <= next)) {
+				// one detent the other way, from the setpoint (move.c)
+				now = t_detent;
+				i = motor_get_speed_setpoint() - 5;
+				if ((i > -5) && (i < 0)) i = 0;
+				sim_speed_cmd(i);
+				detents++;
+				t_detent += (uint64_t)DETENT_MS * TICKS_PER_MS;
+				continue;
+			}
+			now = next;
+			TIMER1_COMPA_vect();
+			if (timer_running()) next = now + timer_period();
+			soft_interrupt();
+			motor_get_status(&s);
+			if (!t_first && (s.position < p_prev)) t_first = now;
+			if (t_first && (i == -v) && (s.state == SPEED_FLAT)) t_speed = now;
+			p_prev = s.position;
+		}
+		printf("%d,%d,%.1f,%.1f,%d\n", v, detents,
+			t_first ? (double)(t_first - t_cmd) / TICKS_PER_MS : -1.0,
+			t_speed ? (double)(t_speed - t_cmd) / TICKS_PER_MS : -1.0,
+			motor_get_speed_percent());
+	}
+}
+
+/*===========================================================================*/
+/*
+* One encoder detent at the current virtual time: fed to the handwheel as the
+* encoder ISR does, or issued as a relative movement as the former polled
+* position control did. The timer counter marks a (re)start, see sim_move().
+*/
+static void sim_detent(uint8_t polled, int8_t d, uint16_t gear)
+{
+	TCNT1 = 1;
+	if (polled) motor_move_to_pos((int32_t)d * gear, REL, TRUE);
+	else motor_handwheel_feed(d);
+	if (timer_running() && (TCNT1 == 0)) next = now + timer_period();
+	soft_interrupt();
+}
+
+/*===========================================================================*/
+/*
+* Encoder-to-motion latency of the position control, from the middle of the
+* rail. Edges happen mid-way between two menu loop ticks: the polled path 
+* sees them at the next tick. Same trims as the position control menu.
+*/
+static void handwheel(void)
+{
+	static const uint16_t gear[] = {40, 200, 800};
+	struct sim_result_s r;
+	struct motor_status_s s;
+
+	printf("mode,gear,first_step_ms,reverse_step_ms,settle_ms,final_offset\n");
+	for (uint8_t polled = 0; polled < 2; polled++) {
+		for (uint8_t g = 0; g < sizeof(gear) / sizeof(gear[0]); g++) {
+			uint64_t t0, t_edge = 0, t_in, t_first = 0, t_behind = 0, t_back = 0;
+			uint64_t t_last = 0;
+			int32_t p_start, p_prev;
+			int i = 0, net = 0;
+
+			sim_reset(PROFILE_LINEAR, 100, 100);
+			sim_move(MAX_COUNT / 2, &r);
+			motor_set_accel_percent(50);
+			if (!polled) motor_handwheel(gear[g]);
+			motor_get_status(&s);
+			p_start = s.position;
+			p_prev = s.position;
+			t0 = now + TICKS_PER_MS / 2;
+
+			while (now < t0 + (uint64_t)HW_MS * TICKS_PER_MS) {
+				t_edge = t0 + (uint64_t)i * DETENT_MS * TICKS_PER_MS;
+				t_in = polled ? (t_edge / TICKS_PER_MS + 1) * TICKS_PER_MS : t_edge;
+				if ((i < 2 * HW_DETENTS) && (!timer_running() || (t_in <= next))) {
+					now = t_in;
+					net += (i < HW_DETENTS) ? 1 : -1;
+					sim_detent(polled, (i < HW_DETENTS) ? 1 : -1, gear[g]);
+					if ((i >= HW_DETENTS) && !t_behind && 
+						(p_start + net * gear[g] < p_prev)) t_behind = t_edge;
+					i++;
+					continue;
+				}
+				if (!timer_running()) break;
+				now = next;
+				uptime_ms = now / TICKS_PER_MS;
+				TIMER1_COMPA_vect();
+				if (timer_running()) next = now + timer_period();
+				soft_interrupt();
+				motor_get_status(&s);
+				if (!t_first && (s.position != p_start)) t_first = now;
+				if (t_behind && !t_back && (s.position < p_prev)) t_back = now;
+				if (s.position != p_prev) t_last = now;
+				p_prev = s.position;
+			}
+			if (!polled) motor_handwheel(0);
+
+			printf("%s,%u,%.2f,%.2f,%.2f,%ld\n", polled ? "polled" : "handwheel",
+				gear[g], t_first ? (double)(t_first - t0) / TICKS_PER_MS : -1.0,
+				t_back ? (double)(t_back - t_behind) / TICKS_PER_MS : -1.0,
+				(t_last > t_edge) ? (double)(t_last - t_edge) / TICKS_PER_MS : 0.0,
+				(long)(s.position - p_start));
+		}
+	}
+}
+
+/*===========================================================================*/
+/*
+* Back-to-back movements, forth and back, for every driver hold time and
+* pause. Each one is commanded once the previous one is done and the pause
+* is over, with the 1ms general timer running meanwhile. The busy wait to 
+* enable the driver delays the motor timer start, thus the first step.
+*/
+static void hold_policy(void)
+{
+	static const uint16_t hold[] = {DRV_HOLD_NONE, DRV_HOLD_DEFAULT, DRV_HOLD_ALWAYS};
+	static const uint16_t pause[] = {0, 10, 100, 1000};
+	struct motor_status_s s;
+
+	printf("hold_ms,pause_ms,busy_us,first_step_ms,held\n");
+	for (uint8_t h = 0; h < sizeof(hold) / sizeof(hold[0]); h++) {
+		for (uint8_t p = 0; p < sizeof(pause) / sizeof(pause[0]); p++) {
+			unsigned long busy = 0, b;
+			uint64_t t_cmd, first = 0;
+			int held = 0;
+
+			sim_reset(PROFILE_LINEAR, 100, 100);
+			drv_set_hold(hold[h]);
+			for (int i = 0; i < HOLD_MOVES; i++) {
+				for (uint16_t ms = 0; ms < pause[p]; ms++) {
+					now += TICKS_PER_MS;
+					TIMER2_COMPA_vect();
+				}
+				if (!(DRV_EN_PORT & (1<<DRV_EN_PIN))) held++;
+
+				t_cmd = now;
+				b = sim_busy_us;
+				TCNT1 = 1;
+				motor_move_to_pos((i & 1) ? -HOLD_STEPS : HOLD_STEPS, REL, TRUE);
+				busy += sim_busy_us - b;
+				now += (uint64_t)(sim_busy_us - b) * TICKS_PER_US;
+				if (timer_running() && (TCNT1 == 0)) next = now + timer_period();
+				soft_interrupt();
+				first += next - t_cmd;
+
+				do {
+					now = next;
+					TIMER1_COMPA_vect();
+					if (timer_running()) next = now + timer_period();
+					soft_interrupt();
+					motor_get_status(&s);
+				} while (timer_running());
+			}
+
+			printf("%u,%u,%.1f,%.3f,%d\n", hold[h], pause[p],
+				(double)busy / HOLD_MOVES,
+				(double)first / HOLD_MOVES / TICKS_PER_MS, held);
+		}
+	}
+}
+
+/*===========================================================================*/
+/*
+* Smooth stops once cruising, along a whole rail movement: along the 
+* deceleration ramp (the former smooth stop), then at the default emergency
+* rate.
+*/
+static void stop_distance(void)
+{
+	struct motor_status_s s;
+
+	printf("accel_pct,stop_pct,stop_steps,stop_ms\n");
+	for (int a = 0; a <= 100; a += 25) {
+		for (int k = 0; k < 2; k++) {
+			uint64_t t_stop;
+			int32_t p_stop;
+
+			sim_reset(PROFILE_LINEAR, (uint8_t)a, STOP_SPEED);
+			motor_set_stop_percent(k ? 100 : (uint8_t)a);
+			TCNT1 = 1;
+			motor_move_to_pos(MAX_COUNT, ABS, TRUE);
+			if (timer_running() && (TCNT1 == 0)) next = now + timer_period();
+			soft_interrupt();
+			do {
+				now = next;
+				TIMER1_COMPA_vect();
+				if (timer_running()) next = now + timer_period();
+				soft_interrupt();
+				motor_get_status(&s);
+			} while (timer_running() && (s.state != SPEED_FLAT));
+
+			t_stop = now;
+			p_stop = s.position;
+			motor_stop(SOFT_STOP);
+			while (timer_running()) {
+				now = next;
+				TIMER1_COMPA_vect();
+				if (timer_running()) next = now + timer_period();
+				soft_interrupt();
+			}
+			motor_get_status(&s);
+			printf("%d,%d,%ld,%.1f\n", a, k ? 100 : a, (long)(s.position - p_stop),
+				(double)(now - t_stop) / TICKS_PER_MS);
+		}
+	}
+}
+
+/*===========================================================================*/
+/*
+* Runs the motor and general timers until 't'. The sync background task is
+* run after every general timer tick, as the menu loops do (unless it's the
+* one waiting for the UART). The first and last steps are recorded.
+*/
+static void sync_run(uint64_t t)
+{
+	struct motor_status_s s;
+
+	for (;;) {
+		uint8_t motor = timer_running() && (next <= next_ms);
+		uint64_t ev = motor ? next : next_ms;
+
+		if (ev > t) break;
+		now = ev;
+		TCNT1 = 1;
+		if (motor) {
+			TIMER1_COMPA_vect();
+			if (timer_running()) next = now + timer_period();
+		} else {
+			last_ms = now;
+			TCNT2 = 0;
+			TIMER2_COMPA_vect();
+			next_ms = now + ((uint64_t)OCR2A + 1) * GENERAL_TICKS;
+		}
+		soft_interrupt();
+		if (timer_running() && (TCNT1 == 0)) next = now + timer_period();
+
+		motor_get_status(&s);
+		if (s.position != step_pos) {
+			if (!step_first) step_first = now;
+			step_last = now;
+			step_pos = s.position;
+		}
+		if (!motor && !in_background) {
+			in_background = TRUE;
+			sync_task();
+			in_background = FALSE;
+		}
+	}
+	if (t > now) now = t;
+	TCNT2 = (uint8_t)((now - last_ms) / GENERAL_TICKS);
+}
+
+/*===========================================================================*/
+/*
+* The armed program: half the rail
+*/
+static void sync_job(uint8_t arg)
+{
+	motor_move_to_pos(MAX_COUNT / 2, ABS, TRUE);
+}
+
+/*===========================================================================*/
+/*
+* One slider, from power on until SYNC_SIM_MS of its own clock. Its clock is
+* off by 'ppm', and it's powered on at 'boot_ms' of true time. The master's
+* clock is the true one: its frames are recorded on the bus. Slaves get them
+* right when they're received, in their own clock time.
+*/
+static void sync_slider(uint8_t master, double ppm, double boot_ms,
+	struct sim_sync_s *r)
+{
+	double k = 1.0 + ppm * 1e-6, boot = boot_ms * TICKS_PER_MS, t;
+	uint64_t t_arm = (uint64_t)SYNC_ARM_MS * TICKS_PER_MS;
+	int settle = 0;
+
+	memset(r, 0, sizeof(*r));
+	sim_reset(PROFILE_LINEAR, 100, 100);
+	timer_general_init();
+	timer_general_set(ENABLE);
+	last_ms = 0;
+	next_ms = ((uint64_t)OCR2A + 1) * GENERAL_TICKS;
+	step_first = 0;
+	step_last = 0;
+	step_pos = 0;
+
+	if (master) {
+		bus_len = 0;
+		bus_rec = TRUE;
+		sync_set(SYNC_MASTER);
+		sync_run(t_arm);
+		sync_arm(sync_job);
+	} else {
+		sync_set(SYNC_SLAVE);
+		sync_arm(sync_job);
+		for (uint16_t i = 0; i < bus_len; i++) {
+			t = (bus[i].t - boot) / k;
+			if (t < 0) continue;			// not powered on yet
+			sync_run((uint64_t)t);
+			sync_rx(bus[i].c);
+			if ((i % SYNC_FRAME_LEN) != (SYNC_FRAME_LEN - 1)) continue;
+			if ((bus[i + 1 - SYNC_FRAME_LEN].c != SYNC_BEACON) || 
+				!sync_locked() || step_first) continue;
+			r->err_start = sync_get_error();
+			r->beacons++;
+			if ((++settle > SYNC_SETTLE) && (fabs(r->err_start) > r->err_max))
+				r->err_max = fabs(r->err_start);
+		}
+	}
+	sync_run((uint64_t)SYNC_SIM_MS * TICKS_PER_MS);
+	bus_rec = FALSE;
+
+	r->t_first = boot + step_first * k;
+	r->t_last = boot + step_last * k;
+}
+
+/*===========================================================================*/
+/*
+* Sync bus: the master, then every slave. Clock errors: a 0.5% ceramic
+* resonator both ways, and a 50ppm crystal both ways.
+*/
+static void sync_bus(void)
+{
+	static const double ppm[] = {-5000.0, -50.0, 50.0, 5000.0};
+	static const double boot[] = {340.5, 1234.25, 77.75, 2600.125};
+	struct sim_sync_s m, r;
+
+	sync_slider(TRUE, 0.0, 0.0, &m);
+
+	printf("slider,ppm,boot_ms,beacons,err_start_us,err_max_us,"
+		"start_skew_us,end_skew_us\n");
+	printf("master,0,0,-,-,-,0,0\n");
+	for (uint8_t i = 0; i < sizeof(ppm) / sizeof(ppm[0]); i++) {
+		sync_slider(FALSE, ppm[i], boot[i], &r);
+		printf("slave %u,%.0f,%.3f,%d,%.0f,%.0f,%.1f,%.1f\n", i + 1, ppm[i],
+			boot[i], r.beacons, r.err_start, r.err_max,
+			(r.t_first - m.t_first) / TICKS_PER_US,
+			(r.t_last - m.t_last) / TICKS_PER_US);
+	}
+}
+
+/*===========================================================================*/
+/*
+* Next command of the chain, from the previous target. Pseudo-random, but the
+* same on every run: a third of them continue the movement with nothing else
+* changed (blended). The rest go anywhere on the rail, a quarter of them
+* waiting first, and may change the speed, acceleration or profile.
+*/
+static void chain_cmd(struct motor_cmd_s *c, int32_t prev, int8_t *dir)
+{
+	int32_t step = 200 + rand() % 4000;
+
+	memset(c, 0, sizeof(*c));
+	c->ctl = POSITION_CONTROL;
+	c->accel = MOTOR_CMD_KEEP;
+	c->profile = MOTOR_CMD_KEEP;
+
+	if ((rand() % 3 == 0) && (prev + *dir * step >= 0) &&
+		(prev + *dir * step <= MAX_COUNT)) {
+		c->pos = prev + *dir * step;
+		return;
+	}
+
+	c->pos = rand() % (MAX_COUNT + 1);
+	*dir = (c->pos > prev) ? 1 : -1;
+	if (rand() % 4 == 0) c->dwell = 1 + rand() % CHAIN_DWELL_MS;
+	if (rand() % 3 == 0) c->speed = 10 + rand() % 91;
+	if (rand() % 4 == 0) c->accel = rand() % 101;
+	if (rand() % 5 == 0) c->profile = PROFILE_LINEAR + rand() % 4;
+}
+
+/*===========================================================================*/
+/*
+* Command queue chaining: the queue is topped up after every motor timer ISR,
+* until CHAIN_CMDS commands are pushed, and then drained. Movement ends and
+* starts are told by the motion events. Returns non-zero if any gap between
+* movements, dwell aside, is longer than the new movement's first period.
+*/
+static int chain(void)
+{
+	struct motor_cmd_s c;
+	struct motor_event_s e;
+	struct motor_status_s s;
+	uint64_t t_step = 0, t_end = 0, t_done = 0, t_start = 0, first = 0;
+	double gap, gap_max = 0.0, gap_sum = 0.0, over_max = -1e9;
+	int32_t prev = 0, p_prev = 0;
+	int8_t dir = 1;
+	int pushed = 0, moves = 0, gaps = 0, dwells = 0, fail = FALSE;
+	uint8_t waiting = FALSE, dwelt = FALSE;
+
+	srand(1);
+	sim_reset(PROFILE_LINEAR, 100, 100);
+	motor_event_flush();
+
+	for (;;) {
+		while ((pushed < CHAIN_CMDS) && motor_queue_free()) {
+			chain_cmd(&c, prev, &dir);
+			TCNT1 = 1;
+			if (motor_queue_push(&c) < 0) break;
+			if (timer_running() && (TCNT1 == 0)) next = now + timer_period();
+			prev = c.pos;
+			pushed++;
+		}
+		if (!timer_running()) break;
+
+		now = next;
+		uptime_ms = now / TICKS_PER_MS;
+		TCNT1 = 1;
+		TIMER1_COMPA_vect();
+		if (timer_running()) next = now + timer_period();
+		soft_interrupt();
+
+		motor_get_status(&s);
+		if (s.position != p_prev) {
+			t_step = now;
+			p_prev = s.position;
+			if (waiting && t_start) {
+				// first step of a movement started after another one
+				gap = (double)(now - t_end - (dwelt ? t_start - t_done : 0));
+				gap_max = fmax(gap_max, gap);
+				gap_sum += gap;
+				over_max = fmax(over_max, gap - (double)first);
+				if (gap > (double)first) {
+					fprintf(stderr, "gap of %.1f us at %.3f ms, first period %.1f us\n",
+						gap / TICKS_PER_US, (double)now / TICKS_PER_MS,
+						(double)first / TICKS_PER_US);
+					fail = TRUE;
+				}
+				gaps++;
+				waiting = FALSE;
+			}
+		}
+		while (motor_event_get(&e) == 0) {
+			if (e.type == MOTOR_EVT_DONE) {
+				t_end = t_step;
+				t_done = now;
+				t_start = 0;
+				waiting = TRUE;
+				dwelt = FALSE;
+			} else if (e.type == MOTOR_EVT_START) {
+				moves++;
+				if (dwelt) dwells++;
+				t_start = now;
+				first = next - now;
+			}
+		}
+		if (s.state == SPEED_DWELL) dwelt = TRUE;
+	}
+
+	printf("commands,movements,blended,gaps,after_dwell,gap_max_us,gap_mean_us,"
+		"over_first_max_us\n");
+	printf("%d,%d,%d,%d,%d,%.1f,%.1f,%.1f\n", pushed, moves, pushed - moves,
+		gaps, dwells, gap_max / TICKS_PER_US,
+		gaps ? gap_sum / gaps / TICKS_PER_US : 0.0, over_max / TICKS_PER_US);
+	fprintf(stderr, "%s\n", fail ? "FAIL" : "PASS");
+
+	return fail ? 1 : 0;
+}
+
+/*===========================================================================*/
+static const char *profile_name(uint8_t profile)
+{
+	switch (profile) {
+		case PROFILE_LINEAR: return "linear";
+		case PROFILE_QUADRATIC: return "quadratic";
+		case PROFILE_SINE: return "sine";
+		case PROFILE_SMOOTH: return "smooth";
+		default: return "?";
+	}
+}
+
+/*-----------------------------------------------------------------------------
+------------------------- F I R M W A R E   S T U B S -------------------------
+-----------------------------------------------------------------------------*/
+
+// Modules not simulated: only what the motor module needs from them.
+
+/*===========================================================================*/
+volatile uint8_t *limit_switch_get(void)
+{
+	return &limit_switch;
+}
+
+/*===========================================================================*/
+void cpu_idle(void)
+{
+}
+
+/*===========================================================================*/
+void uart_send_string(const char *s)
+{
+	fputs(s, stderr);
+}
+
+/*===========================================================================*/
+void uart_send_string_p(const char *s)
+{
+	fputs(s, stderr);
+}
+
+/*===========================================================================*/
+/*
+* UART transmitter: one byte time. Recorded on the sync bus, when it's
+* completely shifted out.
+*/
+void uart_send_char(char data)
+{
+	if (bus_rec && (bus_len < BUS_LEN)) {
+		bus[bus_len].t = now + CHAR_TICKS;
+		bus[bus_len].c = data;
+		bus_len++;
+	}
+	sync_run(now + CHAR_TICKS);
+}
+
+/*===========================================================================*/
+/*
+* The Transmit Complete ISR runs once the byte is out
+*/
+void uart_send_sync(char data)
+{
+	uart_send_char(data);
+	USART_TX_vect();
+}
+
+/*===========================================================================*/
+void uart_tx_isr(uint8_t state)
+{
+}
+
+/*===========================================================================*/
+int8_t stream_pop(uint16_t *c, uint8_t *flags)
+{
+	return STREAM_END;
+}
+
+/*===========================================================================*/
+void stream_close(int8_t result)
+{
+}
+
+/*===========================================================================*/
+char *ultoa(unsigned long v, char *s, int radix)
+{
+	char tmp[33];
+	int i = 0, j = 0;
+
+	do {
+		int d = v % radix;
+		tmp[i++] = (d < 10) ? ('0' + d) : ('a' + d - 10);
+		v /= radix;
+	} while (v);
+	while (i) s[j++] = tmp[--i];
+	s[j] = '\0';
+
+	return s;
+}
+
+/*===========================================================================*/
+char *ltoa(long v, char *s, int radix)
+{
+	if (v < 0) {
+		s[0] = '-';
+		ultoa(-(unsigned long)v, s + 1, radix);
+	} else {
+		ultoa(v, s, radix);
+	}
+	return s;
+}
+
+/*===========================================================================*/
+char *utoa(unsigned int v, char *s, int radix)
+{
+	return ultoa(v, s, radix);
+}
+
+/*===========================================================================*/
+char *itoa(int v, char *s, int radix)
+{
+	return ltoa(v, s, radix);
+}
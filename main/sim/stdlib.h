@@ -0,0 +1,15 @@
+/*
+* Host simulator: the host <stdlib.h>, plus the avr-libc conversions used by
+* the firmware (see sim.c)
+*/
+#ifndef SIM_STDLIB_H
+#define SIM_STDLIB_H
+
+#include_next <stdlib.h>
+
+char *ltoa(long v, char *s, int radix);
+char *ultoa(unsigned long v, char *s, int radix);
+char *itoa(int v, char *s, int radix);
+char *utoa(unsigned int v, char *s, int radix);
+
+#endif /* SIM_STDLIB_H */
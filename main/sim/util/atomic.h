@@ -0,0 +1,12 @@
+/*
+* Host simulator stand-in for <util/atomic.h>. The simulator runs the
+* interrupt handlers in between foreground calls, never during them.
+*/
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#define ATOMIC_RESTORESTATE	0
+#define ATOMIC_FORCEON		0
+#define ATOMIC_BLOCK(x)		for (int _sim_atomic = 1; _sim_atomic; _sim_atomic = 0)
+
+#endif /* SIM_UTIL_ATOMIC_H */
@@ -0,0 +1,13 @@
+/*
+* Host simulator stand-in for <util/delay.h>. Busy waits take no virtual time,
+* but they're accounted for in sim_busy_us (see sim.c).
+*/
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+extern unsigned long sim_busy_us;
+
+#define _delay_us(x)	(sim_busy_us += (x))
+#define _delay_ms(x)	(sim_busy_us += (x) * 1000UL)
+
+#endif /* SIM_UTIL_DELAY_H */
@@ -0,0 +1,330 @@
+
+/*
+* Step interval streaming.
+* Plays back motion profiles computed by a host, for the shots that the
+* on-chip speed profiles can't express. The host sends blocks of motor timer
+* periods (OCR1A values, in base motor timer ticks) through the UART, and the
+* motor timer ISR plays them back one by one: each sample is the period 
+* before its eighth-step pulse. Thus, timing is exact to the timer tick.
+*
+* Blocks are received by the UART RX ISR into a double buffer: one is being
+* played back while the other one is being received. Flow control is credit
+* based: the host may send as many blocks as free buffers (STREAM_BLOCKS on
+* open), and a credit is returned as each block is played back.
+*
+* Block format:
+*	STREAM_SYNC, flags, count, first period (16-bit, little endian),
+*	count - 1 deltas, checksum
+* Deltas are signed bytes, the difference to the previous period. If it
+* doesn't fit, STREAM_ESCAPE is sent followed by the absolute period (16-bit,
+* little endian). The checksum is the 8-bit sum of all bytes from flags to
+* the last delta. A block with no samples (count 0) ends the stream.
+* A bad block can't be sent again without breaking the timing: it aborts the
+* stream, as STREAM_ABORT does.
+*
+* Playback starts once both buffers are full, or the stream end is received.
+* If the host doesn't keep up (underrun), the motor is stopped right away.
+* See tools/streamer.c for the host side.
+*/
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "stream.h"
+#include "motor.h"
+
+#include <stdlib.h>
+#include <avr/pgmspace.h>
+
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+_Static_assert(STREAM_BLOCKS == 2, "Stream is double buffered");
+
+// Receiver states
+#define RX_SYNC			0
+#define RX_FLAGS		1
+#define RX_COUNT		2
+#define RX_ABS_L		3
+#define RX_ABS_H		4
+#define RX_DELTA		5
+#define RX_SUM			6
+
+// Deferred work
+#define JOB_START		0x01
+#define JOB_CREDIT		0x02
+#define JOB_REPORT		0x03
+
+/******************************************************************************
+***************** S T R U C T U R E   D E C L A R A T I O N S ****************
+******************************************************************************/
+
+struct stream_block_s {
+	uint16_t c[STREAM_BLOCK_LEN];
+	uint8_t len;
+	uint8_t flags;
+};
+
+/******************************************************************************
+****************** V A R I A B L E S   D E F I N I T I O N S ******************
+******************************************************************************/
+
+static struct stream_block_s block[STREAM_BLOCKS];
+volatile static uint8_t ready;		// full blocks, one bit each
+volatile static uint8_t open;		// receiving
+volatile static uint8_t playing;	// playback started
+volatile static uint8_t end;		// stream end received
+volatile static uint8_t aborted;
+static int8_t result;				// stream_pop() result that ended it
+
+// receiver
+static uint8_t rx_state;
+static uint8_t rx_blk;				// block being received
+static uint8_t rx_flags;
+static uint8_t rx_count;
+static uint8_t rx_len;
+static uint8_t rx_sum;
+static uint8_t rx_abs;				// absolute period, low byte
+static uint16_t rx_last;			// previous period, deltas base
+
+// playback
+static uint8_t play_blk;
+static uint8_t play_idx;
+
+// statistics
+static uint32_t samples;
+static uint16_t errors;			// bad blocks
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static void rx_sample(uint16_t c);
+static void rx_block(void);
+static void rx_abort(void);
+static void stream_job(uint8_t job);
+
+/*===========================================================================*/
+/*
+* Opens a stream: the following received bytes are stream blocks. The motor
+* must be halted. Returns -1 otherwise.
+*/
+int8_t stream_open(void)
+{
+	if (open || playing || motor_working() || motor_fault()) return -1;
+
+	ready = 0;
+	end = FALSE;
+	aborted = FALSE;
+	rx_state = RX_SYNC;
+	rx_blk = 0;
+	play_blk = 0;
+	play_idx = 0;
+	samples = 0;
+	errors = 0;
+	open = TRUE;
+
+	return 0;
+}
+
+/*===========================================================================*/
+/*
+* Stream receiver. Called from the UART RX ISR with every received byte.
+* Returns FALSE if no stream is open, thus the byte is not consumed.
+*/
+uint8_t stream_rx(char c)
+{
+	uint8_t u = (uint8_t)c;
+
+	if (!open) return FALSE;
+
+	if ((rx_state != RX_SYNC) && (rx_state != RX_SUM)) rx_sum += u;
+
+	switch (rx_state) {
+
+		case RX_SYNC:
+			if (c == STREAM_SYNC) {
+				rx_sum = 0;
+				rx_state = RX_FLAGS;
+			} else if (c == STREAM_ABORT) {
+				rx_abort();
+			}
+			break;
+
+		case RX_FLAGS:
+			rx_flags = u;
+			rx_state = RX_COUNT;
+			break;
+
+		case RX_COUNT:
+			if ((u > STREAM_BLOCK_LEN) || (u && (ready & (1 << rx_blk)))) {
+				// no room: the host doesn't follow the credits
+				errors++;
+				rx_abort();
+				break;
+			}
+			rx_count = u;
+			rx_len = 0;
+			rx_state = u ? RX_ABS_L : RX_SUM;
+			break;
+
+		case RX_ABS_L:
+			rx_abs = u;
+			rx_state = RX_ABS_H;
+			break;
+
+		case RX_ABS_H:
+			rx_sample(rx_abs | ((uint16_t)u << 8));
+			break;
+
+		case RX_DELTA:
+			if ((int8_t)u == STREAM_ESCAPE) rx_state = RX_ABS_L;
+			else rx_sample(rx_last + (int8_t)u);
+			break;
+
+		case RX_SUM:
+			rx_state = RX_SYNC;
+			if (u == rx_sum) {
+				rx_block();
+			} else {
+				errors++;
+				rx_abort();
+			}
+			break;
+
+		default:
+			rx_state = RX_SYNC;
+			break;
+	}
+
+	return TRUE;
+}
+
+/*===========================================================================*/
+/*
+* Next sample to be played back. Called from the motor timer ISR. A credit
+* is returned to the host once the last sample of a block is taken.
+*/
+int8_t stream_pop(uint16_t *c, uint8_t *flags)
+{
+	struct stream_block_s *b = &block[play_blk];
+
+	if (aborted) return STREAM_STOPPED;
+	if (!(ready & (1 << play_blk))) return end ? STREAM_END : STREAM_UNDERRUN;
+
+	*c = b->c[play_idx];
+	*flags = b->flags;
+	samples++;
+
+	if (++play_idx >= b->len) {
+		play_idx = 0;
+		ready &= ~(1 << play_blk);
+		play_blk ^= 1;
+		defer(stream_job, JOB_CREDIT);
+	}
+
+	return STREAM_SAMPLE;
+}
+
+/*===========================================================================*/
+/*
+* Stream finished: STREAM_END, STREAM_UNDERRUN, or STREAM_STOPPED if it was aborted (by
+* the host, by a hard stop or by the slider limits). The result is reported
+* to the host out of interrupt context. Called from the motor timer ISR or
+* the UART RX ISR.
+*/
+void stream_close(int8_t r)
+{
+	open = FALSE;
+	playing = FALSE;
+	result = r;
+	defer(stream_job, JOB_REPORT);
+}
+
+/*-----------------------------------------------------------------------------
+--------------------- I N T E R N A L   F U N C T I O N S ---------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+static void rx_sample(uint16_t c)
+{
+	block[rx_blk].c[rx_len++] = c;
+	rx_last = c;
+	rx_state = (rx_len < rx_count) ? RX_DELTA : RX_SUM;
+}
+
+/*===========================================================================*/
+/*
+* Block received and checked. Playback starts once both buffers are full.
+*/
+static void rx_block(void)
+{
+	struct stream_block_s *b = &block[rx_blk];
+
+	if (rx_count == 0) {
+		end = TRUE;
+	} else {
+		b->len = rx_count;
+		b->flags = rx_flags;
+		ready |= (1 << rx_blk);
+		rx_blk ^= 1;
+	}
+
+	if (playing) return;
+
+	if (end && !ready) {
+		stream_close(STREAM_END);		// empty stream
+	} else if (end || (ready == ((1 << STREAM_BLOCKS) - 1))) {
+		playing = TRUE;
+		if (defer(stream_job, JOB_START) < 0) stream_close(STREAM_STOPPED);
+	}
+}
+
+/*===========================================================================*/
+/*
+* Stream aborted by the host or by a bad block. Once playing, the motor timer
+* ISR stops the motor and closes the stream.
+*/
+static void rx_abort(void)
+{
+	rx_state = RX_SYNC;
+	if (playing) aborted = TRUE;
+	else stream_close(STREAM_STOPPED);
+}
+
+/*===========================================================================*/
+/*
+* Deferred work of the stream module. Runs out of the ISRs, with interrupts
+* enabled. See defer.c
+*/
+static void stream_job(uint8_t job)
+{
+	char str[12];
+
+	switch (job) {
+
+		case JOB_START:
+			if (motor_stream_start() < 0) stream_close(STREAM_STOPPED);
+			break;
+
+		case JOB_CREDIT:
+			uart_send_char(STREAM_CREDIT);
+			break;
+
+		case JOB_REPORT:
+			if (result == STREAM_END) uart_send_string_p(PSTR("\n\rstream end"));
+			else if (result == STREAM_UNDERRUN) uart_send_string_p(PSTR("\n\rstream underrun"));
+			else uart_send_string_p(PSTR("\n\rstream stopped"));
+			ultoa(samples, str, 10);
+			uart_send_string_p(PSTR(" samples: "));
+			uart_send_string(str);
+			utoa(errors, str, 10);
+			uart_send_string_p(PSTR(" errors: "));
+			uart_send_string(str);
+			break;
+
+		default:
+			break;
+	}
+}
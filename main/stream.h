@@ -0,0 +1,45 @@
+
+#ifndef STREAM_H
+#define STREAM_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "config.h"
+#include "defer.h"
+
+#include <stdint.h>
+
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+// Stream protocol. See stream.c and tools/streamer.c
+#define STREAM_BLOCK_LEN	64		// samples per block
+#define STREAM_BLOCKS		2		// double buffer: credits granted on open
+#define STREAM_SYNC			'S'		// block start
+#define STREAM_ABORT		'X'		// abort the stream, instead of a block
+#define STREAM_CREDIT		'+'		// block played back: one more can be sent
+#define STREAM_ESCAPE		(-128)	// delta escape: absolute interval follows
+
+// Block flags
+#define STREAM_FLAG_CW		0x01	// direction of the block steps
+#define STREAM_FLAG_WAIT	0x02	// no steps, the intervals are just waited
+
+// stream_pop() results
+#define STREAM_SAMPLE		0
+#define STREAM_END			1
+#define STREAM_UNDERRUN		-1
+#define STREAM_STOPPED		-2		// aborted, hard stop or slider limits
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+int8_t stream_open(void);
+uint8_t stream_rx(char c);
+int8_t stream_pop(uint16_t *c, uint8_t *flags);
+void stream_close(int8_t result);
+
+#endif /* STREAM_H */
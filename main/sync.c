@@ -0,0 +1,477 @@
+
+/*
+* Master/slave synchronisation of several sliders.
+* The sliders share one UART bus: the master transmitter drives the receivers
+* of all the slaves. Every slider keeps a sync clock, a milliseconds count
+* driven by the 1ms general timer. The master broadcasts its own clock in a
+* beacon frame every SYNC_PERIOD_MS, and the slaves discipline their 1ms
+* time base to it. Then, the master broadcasts a start frame: the instant,
+* in sync clock time, at which every slider starts its armed program.
+*
+* Frame format:
+*	type, time (32-bit, little endian), phase, CRC
+* The type is a control character, never found in console text. The time is
+* a sync clock count, and the phase is the general timer count within that
+* millisecond, in ticks of 8us. The CRC-8 (polynomial 0x07) covers the type,
+* time and phase bytes. Start frames don't use the phase.
+*
+* Beacons are stamped when their type byte is received: the master takes its
+* clock once the byte is completely shifted out, which is right when the
+* slaves' receivers get it. The slave takes its own clock in the RX ISR, and
+* the difference is the phase error of its clock. The master stamps in the 
+* UART Transmit Complete ISR too, rather than once the sender sees the flag:
+* any interrupt in between would delay the stamp, and the PI loop would take
+* it for phase error. Both stamps are only delayed by an ISR already running
+* (deferred work runs with interrupts enabled, see defer.c).
+* The first beacon sets the slave clock, and the second one measures its
+* frequency error. From then on, a PI loop corrects half the phase error
+* over the next period, and integrates a quarter of it into the frequency
+* error. The correction dithers the general timer period one tick shorter or
+* longer every millisecond (see timer_general_trim()), thus up to 0.8%: the
+* ceramic resonator tolerance fits. Errors beyond SYNC_STEP_MS set the clock
+* again, as the first beacon.
+*
+* The bus also carries the master's console output. It's printable text,
+* thus the slaves never take it for a frame, and it reaches their consoles as
+* command lines (see console.c).
+*
+* The armed program is started from the general timer ISR as deferred work,
+* thus with the same latency on every slider. The slaves shorten or stretch
+* the motor timer periods by the same rate as the general timer (see
+* timer_speed_trim()): steps are timed by the disciplined clock too, and
+* the movements last the same on every slider.
+*/
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "sync.h"
+#include "timers.h"
+#include "uart.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+#define TICKS_PER_MS	125			// general timer ticks (8us) per ms
+#define PERIOD_SHIFT	10			// log2(SYNC_PERIOD_MS)
+#define FRAME_DATA		(SYNC_FRAME_LEN - 2)	// time and phase bytes
+#define SYNC_STEP_MS	16			// phase error that sets the clock again
+
+_Static_assert(SYNC_PERIOD_MS == (1 << PERIOD_SHIFT), "Beacons period");
+
+// Rate of the clock corrections: Q16 general timer ticks per millisecond.
+// A phase error in ticks, spread over the beacons period, is shifted left
+// by RATE_SHIFT.
+#define RATE_ONE		((int32_t)1 << 16)
+#define RATE_MAX		(RATE_ONE - 1)		// one tick every millisecond
+#define RATE_SHIFT		(16 - PERIOD_SHIFT)
+#define KP_SHIFT		1					// proportional gain: 1/2
+#define KI_SHIFT		2					// integral gain: 1/4
+
+// Slave acquisition
+#define ACQ_NONE		0			// no beacon yet
+#define ACQ_FREQ		1			// clock set, measuring its frequency
+#define ACQ_LOCKED		2
+
+// Receiver states
+#define RX_TYPE			0
+#define RX_DATA			1
+#define RX_CRC			2
+
+#define CRC_POLY		0x07		// CRC-8: x^8 + x^2 + x + 1
+
+/******************************************************************************
+****************** V A R I A B L E S   D E F I N I T I O N S ******************
+******************************************************************************/
+
+volatile static uint8_t mode = SYNC_OFF;
+volatile static uint32_t t_ms;		// sync clock
+volatile static uint8_t beacon_due;	// master: beacon to be sent
+
+// slave clock discipline
+static uint8_t acquire;
+static int32_t freq;				// frequency error correction, rate
+static int32_t rate;				// total correction
+static int32_t acc;					// correction dithering accumulator
+static int8_t trim;					// general timer trim loaded
+static int16_t err;					// last phase error, ticks
+
+// start
+static defer_fn_t start_fn;
+volatile static uint8_t armed;		// waiting for the start frame
+volatile static uint8_t scheduled;	// start instant known
+volatile static uint32_t t_start;
+
+// receiver
+static uint8_t rx_state;
+static uint8_t rx_type;
+static uint8_t rx_len;
+static uint8_t rx_crc;
+static uint8_t rx_data[FRAME_DATA];
+static uint32_t rx_ms;				// type byte stamp
+static uint8_t rx_phase;
+
+// transmitter: type byte stamp, taken by the Transmit Complete ISR
+volatile static uint8_t tx_stamped;
+volatile static uint32_t tx_ms;
+volatile static uint8_t tx_phase;
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static void stamp(uint32_t *m, uint8_t *phase);
+static void send_frame(uint8_t type, uint32_t t);
+static void rx_frame(void);
+static uint8_t crc8(uint8_t crc, uint8_t b);
+static void beacon(uint32_t t, uint8_t phase);
+static int32_t rate_clamp(int32_t r);
+static void rate_set(int32_t r);
+
+/*===========================================================================*/
+/*
+* Sync mode: SYNC_OFF, SYNC_MASTER or SYNC_SLAVE. A slave sets its clock
+* again from the next beacon. Any armed program is disarmed.
+*/
+void sync_set(uint8_t m)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		mode = m;
+		beacon_due = FALSE;
+		acquire = ACQ_NONE;
+		freq = 0;
+		rate = 0;
+		acc = 0;
+		err = 0;
+		armed = FALSE;
+		scheduled = FALSE;
+		rx_state = RX_TYPE;
+		trim = 0;
+		timer_general_trim(0);
+		timer_speed_trim(0);
+	}
+}
+
+/*===========================================================================*/
+uint8_t sync_get_mode(void)
+{
+	return mode;
+}
+
+/*===========================================================================*/
+/*
+* Slave clock disciplined. Always TRUE for the master.
+*/
+uint8_t sync_locked(void)
+{
+	if (mode == SYNC_MASTER) return TRUE;
+
+	return (mode == SYNC_SLAVE) && (acquire == ACQ_LOCKED);
+}
+
+/*===========================================================================*/
+/*
+* Phase error of the slave clock at the last beacon, microseconds. Positive
+* if the master clock was ahead.
+*/
+int16_t sync_get_error(void)
+{
+	int16_t e;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		e = err;
+	}
+	if (e > (INT16_MAX / 8)) return INT16_MAX;
+	if (e < (INT16_MIN / 8)) return INT16_MIN;
+
+	return e * 8;
+}
+
+/*===========================================================================*/
+/*
+* Arms a function to be started at the shared instant, as deferred work.
+* The master broadcasts it SYNC_LEAD_MS ahead, the slaves wait for the
+* master's start frame. Returns -1 if sync is off.
+*/
+int8_t sync_arm(defer_fn_t fn)
+{
+	uint32_t t;
+
+	if (mode == SYNC_OFF) return -1;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		start_fn = fn;
+		scheduled = FALSE;
+		armed = TRUE;
+		t = t_ms;
+	}
+
+	if (mode == SYNC_MASTER) {
+		t += SYNC_LEAD_MS;
+		send_frame(SYNC_START, t);
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			t_start = t;
+			scheduled = TRUE;
+		}
+	}
+
+	return 0;
+}
+
+/*===========================================================================*/
+/*
+* Sync frames receiver. Called from the UART RX ISR with every received byte.
+* Returns FALSE if the byte is not consumed: not a slave, or not a frame.
+*/
+uint8_t sync_rx(char c)
+{
+	uint8_t u = (uint8_t)c;
+
+	if (mode != SYNC_SLAVE) return FALSE;
+
+	switch (rx_state) {
+
+		case RX_TYPE:
+			if ((u != SYNC_BEACON) && (u != SYNC_START)) return FALSE;
+			stamp(&rx_ms, &rx_phase);
+			rx_type = u;
+			rx_len = 0;
+			rx_crc = crc8(0, u);
+			rx_state = RX_DATA;
+			break;
+
+		case RX_DATA:
+			rx_data[rx_len++] = u;
+			rx_crc = crc8(rx_crc, u);
+			if (rx_len == FRAME_DATA) rx_state = RX_CRC;
+			break;
+
+		case RX_CRC:
+			rx_state = RX_TYPE;
+			if (u == rx_crc) rx_frame();
+			break;
+	}
+
+	return TRUE;
+}
+
+/*===========================================================================*/
+/*
+* Sync background task: the master sends the beacon when it's due. It shares
+* the UART transmitter with the console, thus it's run by the console
+* background task.
+*/
+void sync_task(void)
+{
+	if (!beacon_due) return;
+	beacon_due = FALSE;
+
+	send_frame(SYNC_BEACON, 0);
+}
+
+/*===========================================================================*/
+/*
+* Sync clock tick. Called from the 1ms general timer ISR.
+* Slaves dither the next timer period, the master flags the beacons due. The
+* armed program is started once the start instant is reached.
+*/
+void sync_tick(void)
+{
+	int8_t t = 0;
+
+	t_ms++;
+
+	if (mode == SYNC_SLAVE) {
+		acc += rate;
+		if (acc >= RATE_ONE) {
+			acc -= RATE_ONE;
+			t = -1;				// one tick shorter: the clock catches up
+		} else if (acc <= -RATE_ONE) {
+			acc += RATE_ONE;
+			t = 1;
+		}
+		if (t != trim) {
+			trim = t;
+			timer_general_trim(t);
+		}
+	} else if ((mode == SYNC_MASTER) && !(t_ms & (SYNC_PERIOD_MS - 1))) {
+		beacon_due = TRUE;
+	}
+
+	if (scheduled && ((int32_t)(t_ms - t_start) >= 0)) {
+		scheduled = FALSE;
+		armed = FALSE;
+		defer(start_fn, 0);
+	}
+}
+
+/*-----------------------------------------------------------------------------
+--------------------- I N T E R N A L   F U N C T I O N S ---------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+/*
+* Sync clock and phase right now.
+*/
+static void stamp(uint32_t *m, uint8_t *phase)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*m = t_ms;
+		*phase = TCNT2;
+		// timer already wrapped, but its ISR not served yet
+		if ((TIFR2 & (1<<OCF2A)) && (*phase < OCR2A)) (*m)++;
+	}
+}
+
+/*===========================================================================*/
+/*
+* Sends a frame. Beacons are stamped once their type byte is shifted out, by
+* the Transmit Complete ISR.
+*/
+static void send_frame(uint8_t type, uint32_t t)
+{
+	uint8_t b[FRAME_DATA];
+	uint8_t crc, phase = 0;
+
+	tx_stamped = FALSE;
+	uart_send_sync((char)type);
+	if (type == SYNC_BEACON) {
+		while (!tx_stamped);
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			t = tx_ms;
+			phase = tx_phase;
+		}
+	}
+
+	b[0] = (uint8_t)t;
+	b[1] = (uint8_t)(t >> 8);
+	b[2] = (uint8_t)(t >> 16);
+	b[3] = (uint8_t)(t >> 24);
+	b[4] = phase;
+	crc = crc8(0, type);
+	for (uint8_t i = 0; i < FRAME_DATA; i++) {
+		uart_send_char((char)b[i]);
+		crc = crc8(crc, b[i]);
+	}
+	uart_send_char((char)crc);
+}
+
+/*===========================================================================*/
+/*
+* Frame received. Called from the RX ISR.
+*/
+static void rx_frame(void)
+{
+	uint32_t t = (uint32_t)rx_data[0] | ((uint32_t)rx_data[1] << 8) |
+		((uint32_t)rx_data[2] << 16) | ((uint32_t)rx_data[3] << 24);
+
+	if (rx_type == SYNC_BEACON) {
+		beacon(t, rx_data[4]);
+	} else if (armed && (acquire == ACQ_LOCKED)) {
+		t_start = t;
+		scheduled = TRUE;
+	}
+}
+
+/*===========================================================================*/
+/*
+* Beacon received: master clock and phase when the slave stamped rx_ms and
+* rx_phase. Called from the RX ISR.
+*/
+static void beacon(uint32_t t, uint8_t phase)
+{
+	int32_t d = (int32_t)(t - rx_ms);
+	int32_t e;
+
+	if ((acquire == ACQ_NONE) || (d > SYNC_STEP_MS) || (d < -SYNC_STEP_MS)) {
+		// set the clock, the phase within the millisecond is left
+		t_ms += d;
+		err = (int16_t)phase - rx_phase;
+		rate_set(freq);
+		acquire = ACQ_FREQ;
+		return;
+	}
+
+	e = (d * TICKS_PER_MS) + phase - rx_phase;
+
+	if (acquire == ACQ_FREQ) {
+		// the phase drifted over a whole period, with no correction but the
+		// frequency one. The whole milliseconds are set at once, the rest is
+		// corrected over the next period
+		freq = rate_clamp(freq + ((e - err) << RATE_SHIFT));
+		t_ms += d;
+		e -= d * TICKS_PER_MS;
+		rate_set(rate_clamp(freq + (e << RATE_SHIFT)));
+		acquire = ACQ_LOCKED;
+	} else {
+		freq = rate_clamp(freq + ((e << RATE_SHIFT) >> KI_SHIFT));
+		rate_set(rate_clamp(freq + ((e << RATE_SHIFT) >> KP_SHIFT)));
+	}
+	err = (int16_t)e;
+}
+
+/*===========================================================================*/
+/*
+* CRC-8 update with one more byte, MSB first. Called from the RX ISR too:
+* bitwise, no table in RAM.
+*/
+static uint8_t crc8(uint8_t crc, uint8_t b)
+{
+	crc ^= b;
+	for (uint8_t i = 0; i < 8; i++) {
+		if (crc & 0x80) crc = (crc << 1) ^ CRC_POLY;
+		else crc <<= 1;
+	}
+
+	return crc;
+}
+
+/*===========================================================================*/
+static int32_t rate_clamp(int32_t r)
+{
+	if (r > RATE_MAX) return RATE_MAX;
+	if (r < -RATE_MAX) return -RATE_MAX;
+
+	return r;
+}
+
+/*===========================================================================*/
+/*
+* Clock correction rate. The motor timer periods are trimmed by the same
+* fraction: rate ticks (Q16) in the TICKS_PER_MS of a millisecond.
+*/
+static void rate_set(int32_t r)
+{
+	rate = r;
+	timer_speed_trim((int16_t)(r / TICKS_PER_MS));
+}
+
+/******************************************************************************
+*******************************************************************************
+
+					I N T E R R U P T   H A N D L E R S
+
+*******************************************************************************
+******************************************************************************/
+
+/*===========================================================================*/
+/*
+* UART Transmit Complete: the frame type byte sent by uart_send_sync() is 
+* completely shifted out. One shot.
+*/
+ISR(USART_TX_vect)
+{
+	uint32_t m;
+	uint8_t phase;
+
+	stamp(&m, &phase);
+	uart_tx_isr(DISABLE);
+	tx_ms = m;
+	tx_phase = phase;
+	tx_stamped = TRUE;
+}
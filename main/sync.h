@@ -0,0 +1,43 @@
+
+#ifndef SYNC_H
+#define SYNC_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "config.h"
+#include "defer.h"
+
+#include <stdint.h>
+
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+// Sync modes
+#define SYNC_OFF			0
+#define SYNC_MASTER			1
+#define SYNC_SLAVE			2
+
+// Sync protocol. See sync.c
+#define SYNC_BEACON			0x01	// clock beacon frame (SOH)
+#define SYNC_START			0x02	// start frame (STX)
+#define SYNC_FRAME_LEN		7		// type, time, phase, CRC
+#define SYNC_PERIOD_MS		1024	// beacons period, power of 2
+#define SYNC_LEAD_MS		100		// start frame to start instant
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+void sync_set(uint8_t mode);
+uint8_t sync_get_mode(void);
+uint8_t sync_locked(void);
+int16_t sync_get_error(void);
+int8_t sync_arm(defer_fn_t fn);
+uint8_t sync_rx(char c);
+void sync_task(void);
+void sync_tick(void);
+
+#endif /* SYNC_H */
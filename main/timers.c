@@ -8,11 +8,42 @@
 ******************************************************************************/
 
 #include "timers.h"
+#include "driver.h"
+#include "sync.h"
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
+
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+#define SPEED_CS_MASK	((1<<CS12) | (1<<CS11) | (1<<CS10))
+#define GENERAL_TOP		124			// 1ms: 125 ticks of 8us
+
+/******************************************************************************
+****************** V A R I A B L E S   D E F I N I T I O N S ******************
+******************************************************************************/
 
 volatile uint16_t ms = 0;
+volatile uint32_t uptime_ms = 0;		// never cleared
+
+// Motor timer prescaler currently loaded, expressed as the power of two that
+// divides the base motor timer frequency (F_MOTOR): 0, 3, 5 or 7 for the 
+// 8, 64, 256 and 1024 CPU clock prescalers respectively.
+static uint8_t speed_shift;
+
+// Motor timer periods trim: Q16 fraction they are shortened by, and the
+// remainder carried over to the next period. See timer_speed_trim()
+static int16_t speed_trim;
+static int32_t speed_acc;
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static void timer_speed_load(uint32_t t);
 
 /*===========================================================================*/
 /*
@@ -40,20 +71,22 @@ void timer_general_init(void)
 	TCCR2A |= (1 << WGM21);		// Sets CTC mode
 	TIMSK2 |= (1 << OCIE2A); 	// Set interrupts
 	TIFR2 |= (1<<OCF2A);		// Clear any previous interrupt
-	OCR2A = 124;				// Interrupt period T = 1ms
+	OCR2A = GENERAL_TOP;		// Interrupt period T = 1ms
 	TCNT2 = 0;					// Clear counter
 }
 
 /*===========================================================================*/
 /*
 * Auxiliary timer initialization. It's a one-shot timer. it only runs to 
-* trigger the ISR function that handles queued movements.
+* trigger the "software interrupt" that dispatches deferred work (defer.c).
+* Normal mode: the counter keeps running past the compare match, thus its
+* value in the ISR tells how long the interrupt waited to be served.
 * It does NOT start the timer.
 */
 void timer_aux_init(void)
 {
 	// TIMER COUNTER 0: 8-bit counter
-	TCCR0A |= (1<<WGM01);		// CTC mode, TOP: OCR0A
+	TCCR0A &= ~((1<<WGM01) | (1<<WGM00));	// Normal mode
 	TIMSK0 |= (1<<OCIE0A);		// Set interrupts
 	TIFR0 |= (1<<OCF0A);		// Clear any previous interrupt
 	OCR0A = 0;					// Clear timer compare
@@ -63,17 +96,18 @@ void timer_aux_init(void)
 /*===========================================================================*/
 /*
 * Motor timer start/stop.
+* The period is given in base motor timer ticks (F_MOTOR), and the prescaler
+* is chosen according to it. See timer_speed_load()
 */
-void timer_speed_set(uint8_t state, uint16_t t)
+void timer_speed_set(uint8_t state, uint32_t t)
 {
 	TCNT1 = 0;
 	if(state){
-		OCR1A = t;
-		//TCCR1B |= (1<<CS11) | (1<<CS10);	// Prescaler: 1/64. Start timer
-		TCCR1B |= (1<<CS11);				// Prescaler: 1/8. Start timer
+		timer_speed_load(t);		// Start timer
 	} else {
-		TCCR1B &= ~((1<<CS12) | (1<<CS11) | (1<<CS10));
+		TCCR1B &= ~SPEED_CS_MASK;
 		OCR1A = 0;
+		speed_shift = 0;
 	}
 }
 
@@ -81,9 +115,24 @@ void timer_speed_set(uint8_t state, uint16_t t)
 /*
 * Motor timer. Modifies Cn without stopping or resetting the timer.
 */
-void timer_speed_set_raw(uint16_t c){
+void timer_speed_set_raw(uint32_t c){
 
-	OCR1A = c;
+	timer_speed_load(c);
+}
+
+/*===========================================================================*/
+/*
+* Motor timer periods trim: the periods loaded from now on are shortened by
+* r/65536 of their length (longer if negative). Used to time the steps by
+* the disciplined time base (see sync.c), as the general timer trim. The
+* fraction of a tick left over is carried over to the next period.
+*/
+void timer_speed_trim(int16_t r)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		speed_trim = r;
+		speed_acc = 0;
+	}
 }
 
 /*===========================================================================*/
@@ -94,7 +143,7 @@ void timer_general_set(uint8_t state)
 {
 	TCNT2 = 0;
 	if(state){
-		OCR2A = 124;
+		OCR2A = GENERAL_TOP;
 		TCCR2B |= (1<<CS22) | (1<<CS20); // Prescaler: 128. Start timer
 	} else {
 		TCCR2B &= ~((1<<CS22) | (1<<CS21) | (1<<CS20));
@@ -104,20 +153,39 @@ void timer_general_set(uint8_t state)
 
 /*===========================================================================*/
 /*
-* Auxiliary timer start/stop
+* General timer period trim, in ticks of 8us: the periods following are
+* 't' ticks longer than 1ms. Used to discipline the time base (see sync.c).
+* Written from the general timer ISR, it applies to the period just started.
+*/
+void timer_general_trim(int8_t t)
+{
+	OCR2A = GENERAL_TOP + t;
+}
+
+/*===========================================================================*/
+/*
+* Auxiliary timer start/stop. The ISR triggers after 't' ticks of 4us
 */
 void timer_aux_set(uint8_t state, uint8_t t)
 {
-	TCNT0 = 0;
 	if(state){
+		TCNT0 = 0;
 		OCR0A = t;
-		TCCR0B |= (1<<CS00);	// Prescaler: 1. Start timer
+		TCCR0B |= (1<<CS01) | (1<<CS00);	// Prescaler: 64. Start timer
 	} else {
 		TCCR0B &= ~((1<<CS02) | (1<<CS01) | (1<<CS00));
-		OCR0A = 0;
 	}
 }
 
+/*===========================================================================*/
+/*
+* Auxiliary timer count, in ticks of 4us. Not cleared when stopped
+*/
+uint8_t timer_aux_get(void)
+{
+	return TCNT0;
+}
+
 /*===========================================================================*/
 /*
 * Motor timer check. Some functions require to check whether the motor timer
@@ -134,11 +202,77 @@ uint8_t timer_speed_check(void)
 
 /*===========================================================================*/
 /*
-* Retrieve raw value of timer compare register
+* Retrieve the value of timer compare register, scaled back to base motor
+* timer ticks (F_MOTOR) whatever the prescaler currently running.
 */
-uint16_t timer_speed_get(void)
+uint32_t timer_speed_get(void)
 {
-	return OCR1A;
+	uint32_t c = OCR1A;
+
+	if (speed_shift)
+		c = ((c + 1) << speed_shift) - 1;
+
+	return c;
+}
+
+/*-----------------------------------------------------------------------------
+--------------------- I N T E R N A L   F U N C T I O N S ---------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+/*
+* Motor timer period. The period is given in base motor timer ticks (F_MOTOR,
+* prescaler 8), and whenever it doesn't fit in the 16-bit OCR1A register, 
+* a coarser prescaler is selected: 64, 256 or 1024. Thus, periods up to 
+* TIMER_SPEED_MAX ticks (~4.2s) are possible, and the finest resolution is
+* always kept for the periods that fit OCR1A.
+*
+* The prescaler counter is reset whenever the prescaler changes, so that the
+* new period starts with a whole prescaled tick. Timer 0 shares the same
+* prescaler: a reset may delay its count by up to one tick (4us), which is
+* negligible for its purpose.
+*/
+static void timer_speed_load(uint32_t t)
+{
+	uint8_t cs, shift;
+	int32_t d;
+
+	if (speed_trim) {
+		if (t <= 0xFFFF) {
+			speed_acc += (int32_t)t * speed_trim;
+			d = speed_acc >> 16;
+			speed_acc -= d << 16;
+		} else {
+			// tick fractions are negligible: no carry over
+			d = ((int32_t)(t >> 4) * speed_trim) >> 12;
+		}
+		t -= d;
+	}
+
+	if (t <= 0xFFFF) {
+		cs = (1<<CS11);					// Prescaler: 1/8
+		shift = 0;
+	} else if (t < ((uint32_t)0x10000 << 3)) {
+		cs = (1<<CS11) | (1<<CS10);		// Prescaler: 1/64
+		shift = 3;
+	} else if (t < ((uint32_t)0x10000 << 5)) {
+		cs = (1<<CS12);					// Prescaler: 1/256
+		shift = 5;
+	} else {
+		if (t > TIMER_SPEED_MAX) t = TIMER_SPEED_MAX;
+		cs = (1<<CS12) | (1<<CS10);		// Prescaler: 1/1024
+		shift = 7;
+	}
+
+	if (shift)
+		t = ((t + 1) >> shift) - 1;
+
+	OCR1A = (uint16_t)t;
+	if ((TCCR1B & SPEED_CS_MASK) != cs) {
+		TCCR1B = (TCCR1B & ~SPEED_CS_MASK) | cs;
+		GTCCR |= (1<<PSRSYNC);
+	}
+	speed_shift = shift;
 }
 
 /******************************************************************************
@@ -160,4 +294,7 @@ uint16_t timer_speed_get(void)
 ISR(TIMER2_COMPA_vect)
 {
 	ms++;
+	uptime_ms++;
+	drv_tick();
+	sync_tick();
 }
\ No newline at end of file
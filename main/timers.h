@@ -8,11 +8,20 @@
 
 #include <stdint.h>
 
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+// Longest motor timer period, in base motor timer ticks (F_MOTOR). It is the
+// 16-bit OCR1A range stretched by the coarsest prescaler (1024 = 8 * 128).
+#define TIMER_SPEED_MAX		((((uint32_t)0xFFFF + 1) << 7) - 1)
+
 /******************************************************************************
 ********************* E X T E R N A L   V A R I A B L E S *********************
 ******************************************************************************/
 
 extern volatile uint16_t ms;
+extern volatile uint32_t uptime_ms;
 
 /******************************************************************************
 ******************** F U N C T I O N   P R O T O T Y P E S ********************
@@ -20,17 +29,20 @@ extern volatile uint16_t ms;
 
 // Motor timer functions
 void timer_speed_init(void);
-void timer_speed_set(uint8_t state, uint16_t t);
-void timer_speed_set_raw(uint16_t c);
+void timer_speed_set(uint8_t state, uint32_t t);
+void timer_speed_set_raw(uint32_t c);
 uint8_t timer_speed_check(void);
-uint16_t timer_speed_get(void);
+uint32_t timer_speed_get(void);
+void timer_speed_trim(int16_t r);
 
 // General timer functions
 void timer_general_init(void);
 void timer_general_set(uint8_t state);
+void timer_general_trim(int8_t t);
 
 // Auxiliary timer functions
 void timer_aux_init(void);
 void timer_aux_set(uint8_t state, uint8_t t);
+uint8_t timer_aux_get(void);
 
 #endif /* TIMERS_H */
\ No newline at end of file
@@ -0,0 +1,365 @@
+/*
+* Motion parameters generator.
+* Host tool, run from the makefile at build time. It takes the mechanical and
+* timing parameters of the slider and writes to stdout a header with all the
+* constants derived from them, and the declarations of the PROGMEM tables.
+* With -C, the source file defining the tables is written instead: they're
+* compiled once, into a single object. Thus, changing the stepping mode, the
+* belt, the timer prescaler or the limits only requires rebuilding, and the
+* firmware never needs floating point math to derive them at runtime.
+*
+* Usage:
+*	motion_gen -c <f_cpu> -u <usteps> -b <cms/rev> -p <prescaler>
+*		-s <speed max> -a <accel max> -l <length cms> [-C] > motion.h|motion.c
+*
+* Speeds and accelerations are given in (micro)steps/s and steps/s^2.
+*/
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+#define FULL_STEPS_PER_REV	200		// 1.8 degrees stepper motor
+#define OCR_MAX				65535.0	// 16-bit motor timer compare register
+#define TIMER_MAX_SHIFT		7		// coarsest prescaler: 128 times the base one
+#define C0_CORRECTION		0.676	// first ramp period correction, David Austin paper
+#define EASE_SEGMENTS		256		// easing tables resolution, power of 2
+#define Q_HEAD				16		// quadratic ramp periods timed exactly
+
+// Movement durations offered to the user, in seconds. The sequential part is
+// completed with the usual time-lapse durations, and the list is cut at the
+// longest movement the slider can perform at its minimum speed.
+static const uint32_t durations[] = {
+	30, 45, 60, 80, 100, 120, 180, 300, 600, 1200, 2400, 3600, 7200, 14400,
+	21600, 28800, 36000, 43200
+};
+#define SEQUENTIAL_DURATIONS	20
+
+/******************************************************************************
+****************** V A R I A B L E S   D E F I N I T I O N S ******************
+******************************************************************************/
+
+static long f_cpu = 16000000;
+static long usteps = 8;
+static long cms_per_rev = 4;
+static long prescaler = 8;
+static double speed_max = 16000.0;
+static double accel_max = 8000.0;
+static long length_cms = 80;
+static int source = 0;			// -C: tables source instead of the header
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static void usage(const char *name);
+static void fail(const char *msg);
+static void table_begin(const char *type, const char *name, const char *len);
+static void table_item(int i, int per_line, unsigned long v);
+static void table_end(void);
+static double ease_sine(double t);
+static double ease_smooth(double t);
+static void ease_table(const char *name, double (*ease)(double));
+static void ease_peaks(double (*ease)(double), double *v, double *a);
+
+/*===========================================================================*/
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:u:b:p:s:a:l:C")) != -1) {
+		switch (opt) {
+			case 'c': f_cpu = strtol(optarg, NULL, 10); break;
+			case 'u': usteps = strtol(optarg, NULL, 10); break;
+			case 'b': cms_per_rev = strtol(optarg, NULL, 10); break;
+			case 'p': prescaler = strtol(optarg, NULL, 10); break;
+			case 's': speed_max = strtod(optarg, NULL); break;
+			case 'a': accel_max = strtod(optarg, NULL); break;
+			case 'l': length_cms = strtol(optarg, NULL, 10); break;
+			case 'C': source = 1; break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if ((f_cpu <= 0) || (usteps <= 0) || (cms_per_rev <= 0) || (prescaler <= 0) ||
+		(speed_max <= 0.0) || (accel_max <= 0.0) || (length_cms <= 0))
+		fail("all parameters must be positive");
+
+	double f = (double)f_cpu / (double)prescaler;
+	long steps_per_rev = FULL_STEPS_PER_REV * usteps;
+	long max_count = length_cms * (steps_per_rev / cms_per_rev);
+	double cmin_max = (OCR_MAX + 1.0) * (1 << TIMER_MAX_SHIFT) - 1.0;
+	double speed_min = f / (cmin_max + 1.0);
+	// Minimum acceleration: the one whose first ramp period (without the
+	// c0 correction) still fits the compare register at the base prescaler
+	double accel_min = 2.0 * pow(f / OCR_MAX, 2.0);
+	double cmin_speed_max = f / speed_max - 1.0;
+
+	if ((steps_per_rev % cms_per_rev) != 0)
+		fail("steps per revolution must be a multiple of cms per revolution");
+	if (accel_min >= accel_max)
+		fail("max acceleration below the minimum the motor timer can run");
+	if (cmin_speed_max < 1.0)
+		fail("max speed too high for the motor timer frequency");
+
+	// Durations: sequential seconds, then the fixed list up to the longest
+	// movement possible.
+	double t_longest = (double)max_count / speed_min;
+	int t_len = SEQUENTIAL_DURATIONS;
+	for (unsigned i = 0; i < sizeof(durations) / sizeof(durations[0]); i++) {
+		if ((durations[i] > 0xFFFF) || (durations[i] > t_longest)) break;
+		t_len++;
+	}
+
+	printf("/*\n* Motion parameters. GENERATED by tools/motion_gen.c, do not edit.\n");
+	printf("* f_cpu: %ld, usteps: %ld, cms/rev: %ld, prescaler: %ld\n",
+		f_cpu, usteps, cms_per_rev, prescaler);
+	printf("* speed max: %.1f, accel max: %.1f, length: %ld cms\n*/\n\n",
+		speed_max, accel_max, length_cms);
+
+	if (source) {
+		printf("#include \"motion.h\"\n\n");
+	} else {
+		printf("#ifndef MOTION_H_\n#define MOTION_H_\n\n");
+		printf("#include <stdint.h>\n#include <avr/pgmspace.h>\n\n");
+
+		printf("// Motor timer and mechanics\n");
+		printf("#define F_MOTOR 			%ldUL\t// Speed Timer Frequency. Prescaler %ld\n",
+			(long)f, prescaler);
+		printf("#define MOTION_USTEPS		%ld\n", usteps);
+		printf("#define STEPS_PER_REV		((int32_t) %ld)\n", steps_per_rev);
+		printf("#define CMS_PER_REV 		((int32_t) %ld)\n", cms_per_rev);
+		printf("#define MAX_LENGHT_CMS		((int32_t) %ld)\n", length_cms);
+		printf("#define MAX_COUNT			((int32_t) %ld)\n\n", max_count);
+
+		printf("// Speed & acceleration limits\n");
+		printf("#define SPEED_MAX 			%.1f\n", speed_max);
+		printf("#define SPEED_MIN 			%.6f\n", speed_min);
+		printf("#define ACCEL_MAX 			%.1f\n", accel_max);
+		printf("#define ACCEL_MIN 			%.1f\n", accel_min);
+		printf("#define CMIN_SPEED_MAX		%.1f\n", cmin_speed_max);
+		printf("\n");
+
+		printf("// Overflow checks\n");
+		printf("_Static_assert(MAX_COUNT <= 0xFFFF, \"n is 16-bit: ramps can't be longer than the rail\");\n");
+		printf("_Static_assert((MAX_COUNT * 2 * 20 * 100) <= INT32_MAX, \"progress percentage overflows\");\n");
+		printf("_Static_assert((int32_t)ACCEL_MIN < (int32_t)ACCEL_MAX, \"acceleration range is empty\");\n");
+		printf("_Static_assert((int32_t)(SPEED_MIN * 1000) < (int32_t)(SPEED_MAX * 1000), \"speed range is empty\");\n\n");
+
+		double ev, ea;
+		printf("// Easing profiles: peak speed & accel of the normalized curves\n");
+		printf("#define EASE_SEGMENTS		%d\n", EASE_SEGMENTS);
+		ease_peaks(ease_sine, &ev, &ea);
+		printf("#define EASE_SINE_V			%.4f\t// peak speed, times distance / duration\n", ev);
+		printf("#define EASE_SINE_A			%.4f\t// peak accel, times distance / duration^2\n", ea);
+		ease_peaks(ease_smooth, &ev, &ea);
+		printf("#define EASE_SMOOTH_V		%.4f\n", ev);
+		printf("#define EASE_SMOOTH_A		%.4f\n\n", ea);
+
+		printf("// Movement durations the user can choose from\n");
+		printf("#define MOTION_T_LEN		%d\n\n", t_len);
+
+		printf("// Quadratic ramp periods timed by their exact ratio\n");
+		printf("#define MOTION_Q_LEN		%d\n\n", Q_HEAD);
+	}
+
+	// Minimum timer period (max speed) per speed percent. Reciprocal of the
+	// speed, percent 0 being the slowest speed the motor timer can run.
+	printf("// Minimum motor timer period for every max speed percent\n");
+	table_begin("uint32_t", "motion_cmin", "101");
+	for (int p = 0; p <= 100; p++) {
+		double c = (p == 0) ? cmin_max : f / (speed_max * p / 100.0) - 1.0;
+		if (c > cmin_max) c = cmin_max;
+		table_item(p, 8, (unsigned long)c);
+	}
+	table_end();
+
+	// Linear ramp first period per acceleration percent, and the acceleration
+	// the motor actually runs with once c0 is rounded to timer ticks.
+	uint16_t c0[101];
+	printf("// Linear profile first motor timer period for every acceleration percent\n");
+	table_begin("uint16_t", "motion_c0", "101");
+	for (int p = 0; p <= 100; p++) {
+		double a = ((accel_max - accel_min) * p / 100.0) + accel_min;
+		double c = C0_CORRECTION * f * sqrt(2.0 / a);
+		if (c > OCR_MAX) fail("c0 overflows the motor timer compare register");
+		c0[p] = (uint16_t)c;
+		table_item(p, 8, c0[p]);
+	}
+	table_end();
+
+	printf("// Linear profile acceleration for every acceleration percent, steps/s^2\n");
+	table_begin("uint16_t", "motion_accel", "101");
+	for (int p = 0; p <= 100; p++) {
+		double a = 2.0 * pow(f / ((c0[p] + 1.0) / C0_CORRECTION), 2.0);
+		table_item(p, 8, (unsigned)a);
+	}
+	table_end();
+
+	// Quadratic ramp: position grows with the cube of time, x = j * t^3 / 3.
+	// The jerk is chosen so that the ramp up to max speed lasts as long as
+	// the linear one with the same acceleration: j = a^2 / v_max. The first
+	// period (time to the first step) doesn't fit the compare register at
+	// the base prescaler, the motor timer runs it at a coarser one.
+	uint32_t c0q[101];
+	printf("// Quadratic profile first motor timer period for every acceleration percent\n");
+	table_begin("uint32_t", "motion_c0q", "101");
+	for (int p = 0; p <= 100; p++) {
+		double a = ((accel_max - accel_min) * p / 100.0) + accel_min;
+		double c = f * cbrt(3.0 * speed_max / (a * a)) - 1.0;
+		if (c > cmin_max) fail("quadratic c0 overflows the motor timer");
+		c0q[p] = (uint32_t)c;
+		table_item(p, 8, c0q[p]);
+	}
+	table_end();
+
+	// The quadratic recurrence is first order in 1 / n: the first periods it
+	// computes are some percent off, and every later one inherits that. Up
+	// to Q_HEAD, the exact ratio of every period to the previous one is used
+	// instead, times 65536: (cbrt(n + 1) - cbrt(n)) / (cbrt(n) - cbrt(n - 1)),
+	// the first one being cbrt(2) - 1.
+	printf("// Quadratic ramp, period n over period n - 1 (times 65536), from n = 1\n");
+	table_begin("uint16_t", "motion_q_ratio", "MOTION_Q_LEN - 1");
+	for (int n = 1; n < Q_HEAD; n++) {
+		double r = (cbrt(n + 1.0) - cbrt(n)) / (cbrt(n) - cbrt(n - 1.0));
+		table_item(n - 1, 8, (unsigned long)(r * 65536.0 + 0.5));
+	}
+	table_end();
+
+	printf("// Quadratic profile mean acceleration up to max speed, steps/s^2\n");
+	table_begin("uint16_t", "motion_accel_q", "101");
+	for (int p = 0; p <= 100; p++) {
+		double j = 3.0 / pow((c0q[p] + 1.0) / f, 3.0);
+		table_item(p, 8, (unsigned)sqrt(speed_max * j));
+	}
+	table_end();
+
+	// Easing profiles: the position follows a normalized curve of time over
+	// the whole movement. The motor needs the inverse, the time at which 
+	// every position is reached, sampled at evenly spaced positions. Peak
+	// speed and acceleration, relative to a unit movement lasting unit time,
+	// give the shortest duration that keeps within the speed & accel limits.
+	printf("// Easing profiles: time fraction (0..65535) at every position fraction\n");
+	ease_table("motion_ease_sine", ease_sine);
+	ease_table("motion_ease_smooth", ease_smooth);
+
+	printf("// Movement durations the user can choose from, in seconds\n");
+	table_begin("uint16_t", "motion_t", "MOTION_T_LEN");
+	for (int i = 0; i < t_len; i++) {
+		table_item(i, 10, (i < SEQUENTIAL_DURATIONS) ? (unsigned long)(i + 1) :
+			(unsigned long)durations[i - SEQUENTIAL_DURATIONS]);
+	}
+	table_end();
+
+	if (!source) printf("#endif /* MOTION_H_ */\n");
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+--------------------- I N T E R N A L   F U N C T I O N S ---------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s -c f_cpu -u usteps -b cms_per_rev -p prescaler "
+		"-s speed_max -a accel_max -l length_cms [-C]\n", name);
+	exit(1);
+}
+
+/*===========================================================================*/
+static void fail(const char *msg)
+{
+	fprintf(stderr, "motion_gen: %s\n", msg);
+	exit(1);
+}
+
+/*===========================================================================*/
+/*
+* PROGMEM table: its declaration in the header, or its definition in the
+* source, items and all. Items are only written to the source.
+*/
+static void table_begin(const char *type, const char *name, const char *len)
+{
+	if (source) printf("const %s %s[%s] PROGMEM = {", type, name, len);
+	else printf("extern const %s %s[%s] PROGMEM;\n\n", type, name, len);
+}
+
+/*===========================================================================*/
+static void table_item(int i, int per_line, unsigned long v)
+{
+	if (source) printf("%s%s%lu", i ? "," : "", (i % per_line) ? " " : "\n\t", v);
+}
+
+/*===========================================================================*/
+static void table_end(void)
+{
+	if (source) printf("\n};\n\n");
+}
+
+/*===========================================================================*/
+/*
+* Sine easing: half a cosine period. Speed follows a sine arch.
+*/
+static double ease_sine(double t)
+{
+	return (1.0 - cos(M_PI * t)) / 2.0;
+}
+
+/*===========================================================================*/
+/*
+* Smooth easing (smootherstep): fifth order polynomial, speed and 
+* acceleration are both zero at the ends. No jerk kick at start and stop.
+*/
+static double ease_smooth(double t)
+{
+	return t * t * t * (t * (t * 6.0 - 15.0) + 10.0);
+}
+
+/*===========================================================================*/
+/*
+* Inverse easing table, by bisection: the curves are monotonic.
+*/
+static void ease_table(const char *name, double (*ease)(double))
+{
+	table_begin("uint16_t", name, "EASE_SEGMENTS + 1");
+	for (int i = 0; i <= EASE_SEGMENTS; i++) {
+		double x = (double)i / EASE_SEGMENTS, lo = 0.0, hi = 1.0;
+		for (int k = 0; k < 60; k++) {
+			double t = (lo + hi) / 2.0;
+			if (ease(t) < x) lo = t;
+			else hi = t;
+		}
+		table_item(i, 8, (unsigned long)lround(lo * 65535.0));
+	}
+	table_end();
+}
+
+/*===========================================================================*/
+/*
+* Peak speed and acceleration of an easing curve, numerically.
+*/
+static void ease_peaks(double (*ease)(double), double *v, double *a)
+{
+	const double h = 1e-4;
+
+	*v = 0.0;
+	*a = 0.0;
+	for (double t = h; t < 1.0; t += h) {
+		double d1 = (ease(t + h) - ease(t - h)) / (2.0 * h);
+		double d2 = (ease(t + h) - 2.0 * ease(t) + ease(t - h)) / (h * h);
+		if (d1 > *v) *v = d1;
+		if (fabs(d2) > *a) *a = fabs(d2);
+	}
+}
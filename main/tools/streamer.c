@@ -0,0 +1,441 @@
+/*
+* Step interval streamer.
+* Host tool. Sends a precomputed motion profile to the slider stream mode
+* (see stream.c): the profile is split into blocks of motor timer periods,
+* delta encoded, and sent through the serial port following the credits
+* returned by the slider as it plays the blocks back.
+*
+* Usage:
+*	streamer [-d <device>] [-b <baud>] [-f <f_motor>] <profile file>
+*	streamer [-d <device>] [-b <baud>] [-f <f_motor>] -g <seconds> [-a <amplitude>] [-p <period>]
+*
+* Profile file: one sample per line, the motor timer period (OCR1A value, in
+* base motor timer ticks) followed by the direction of its eighth-step: '+'
+* (CW), '-' (CCW), or 'w' if no step is issued (wait). '#' starts a comment.
+*
+* With -g, a test profile is generated instead: back and forth cosine
+* movements of the given amplitude (eighth-steps) and period (seconds).
+*
+* Without -d, nothing is sent: the link is simulated at the given baud rate,
+* and the tool reports whether the slider would run out of samples (underrun)
+* at any point. The exit status is non-zero in that case.
+*/
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+// Stream protocol. Must match stream.h
+#define STREAM_BLOCK_LEN	64
+#define STREAM_BLOCKS		2
+#define STREAM_SYNC			'S'
+#define STREAM_ABORT		'X'
+#define STREAM_CREDIT		'+'
+#define STREAM_ESCAPE		(-128)
+#define STREAM_FLAG_CW		0x01
+#define STREAM_FLAG_WAIT	0x02
+
+#define BLOCK_BYTES_MAX		(4 + 2 + (STREAM_BLOCK_LEN - 1) * 3)
+#define OCR_MAX				0xFFFF
+#define C_MIN				124		// CMIN_SPEED_MAX, max speed period
+#define REPLY_TIMEOUT		10		// seconds
+
+/******************************************************************************
+***************** S T R U C T U R E   D E C L A R A T I O N S ****************
+******************************************************************************/
+
+struct sample_s {
+	uint16_t c;			// OCR1A value: period - 1
+	uint8_t flags;
+};
+
+struct block_s {
+	uint8_t buf[BLOCK_BYTES_MAX];
+	int len;			// bytes
+	int first;			// index of its first sample
+	int count;			// samples
+};
+
+/******************************************************************************
+****************** V A R I A B L E S   D E F I N I T I O N S ******************
+******************************************************************************/
+
+static long baud = 115200;
+static double f_motor = 2000000.0;
+
+static struct sample_s *samples;
+static int n_samples;
+static int max_samples;
+
+static struct block_s *blocks;
+static int n_blocks;
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static void usage(const char *name);
+static void fail(const char *msg);
+static void sample_add(uint16_t c, uint8_t flags);
+static void step_add(int64_t ticks, uint8_t flags);
+static void profile_load(const char *path);
+static void profile_generate(double seconds, long amplitude, double period);
+static void encode(void);
+static int simulate(void);
+static int send_stream(const char *device);
+
+/*===========================================================================*/
+int main(int argc, char *argv[])
+{
+	const char *device = NULL;
+	double seconds = 0.0;
+	long amplitude = 30000;
+	double period = 60.0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:b:f:g:a:p:")) != -1) {
+		switch (opt) {
+			case 'd': device = optarg; break;
+			case 'b': baud = strtol(optarg, NULL, 10); break;
+			case 'f': f_motor = strtod(optarg, NULL); break;
+			case 'g': seconds = strtod(optarg, NULL); break;
+			case 'a': amplitude = strtol(optarg, NULL, 10); break;
+			case 'p': period = strtod(optarg, NULL); break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if ((baud <= 0) || (f_motor <= 0.0))
+		fail("baud rate and motor timer frequency must be positive");
+
+	if (seconds > 0.0) {
+		if ((amplitude <= 0) || (period <= 0.0))
+			fail("amplitude and period must be positive");
+		profile_generate(seconds, amplitude, period);
+	} else if (optind < argc) {
+		profile_load(argv[optind]);
+	} else {
+		usage(argv[0]);
+	}
+
+	if (n_samples == 0) fail("empty profile");
+	encode();
+
+	if (device) return send_stream(device);
+	return simulate();
+}
+
+/*-----------------------------------------------------------------------------
+--------------------- I N T E R N A L   F U N C T I O N S ---------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d device] [-b baud] [-f f_motor] profile\n"
+		"       %s [-d device] [-b baud] [-f f_motor] -g seconds "
+		"[-a amplitude] [-p period]\n", name, name);
+	exit(1);
+}
+
+/*===========================================================================*/
+static void fail(const char *msg)
+{
+	fprintf(stderr, "streamer: %s\n", msg);
+	exit(1);
+}
+
+/*===========================================================================*/
+static void sample_add(uint16_t c, uint8_t flags)
+{
+	if (n_samples == max_samples) {
+		max_samples = max_samples ? (max_samples * 2) : 4096;
+		samples = realloc(samples, max_samples * sizeof(*samples));
+		if (!samples) fail("out of memory");
+	}
+	samples[n_samples].c = c;
+	samples[n_samples].flags = flags;
+	n_samples++;
+}
+
+/*===========================================================================*/
+/*
+* One eighth-step, 'ticks' motor timer ticks after the previous one. Periods
+* that don't fit the compare register are split with wait samples, evenly,
+* so that none of them gets below the max speed period.
+*/
+static void step_add(int64_t ticks, uint8_t flags)
+{
+	int64_t k = (ticks + OCR_MAX) / (OCR_MAX + 1);
+	int64_t chunk = ticks / k;
+
+	if (ticks < (C_MIN + 1)) fail("profile faster than the slider max speed");
+
+	for (int64_t i = 1; i < k; i++) {
+		sample_add((uint16_t)(chunk - 1), STREAM_FLAG_WAIT | (flags & STREAM_FLAG_CW));
+		ticks -= chunk;
+	}
+	sample_add((uint16_t)(ticks - 1), flags);
+}
+
+/*===========================================================================*/
+static void profile_load(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	char line[128];
+	unsigned long c;
+	char d;
+
+	if (!fp) fail("can't open the profile file");
+
+	while (fgets(line, sizeof(line), fp)) {
+		if ((line[0] == '#') || (line[0] == '\n')) continue;
+		if ((sscanf(line, "%lu %c", &c, &d) != 2) || (c > OCR_MAX))
+			fail("bad profile line");
+		if (d == '+') sample_add((uint16_t)c, STREAM_FLAG_CW);
+		else if (d == '-') sample_add((uint16_t)c, 0);
+		else if (d == 'w') sample_add((uint16_t)c, STREAM_FLAG_WAIT);
+		else fail("bad profile direction");
+	}
+	fclose(fp);
+}
+
+/*===========================================================================*/
+/*
+* Test profile: x(t) = A/2 * (1 - cos(wt)), whole cycles only. The time of
+* every eighth-step is computed exactly, and rounded to motor timer ticks
+* with no accumulated error.
+*/
+static void profile_generate(double seconds, long amplitude, double period)
+{
+	double w = 2.0 * M_PI / period;
+	long cycles = lround(seconds / period);
+	int64_t t, t_prev = 0;
+
+	if (cycles < 1) cycles = 1;
+
+	for (long m = 0; m < cycles; m++) {
+		for (long p = 1; p <= amplitude; p++) {			// forth: CW
+			double th = (2.0 * M_PI * m) + acos(1.0 - (2.0 * p / amplitude));
+			t = llround(th / w * f_motor);
+			step_add(t - t_prev, STREAM_FLAG_CW);
+			t_prev = t;
+		}
+		for (long p = amplitude - 1; p >= 0; p--) {		// back: CCW
+			double th = (2.0 * M_PI * (m + 1)) - acos(1.0 - (2.0 * p / amplitude));
+			t = llround(th / w * f_motor);
+			step_add(t - t_prev, 0);
+			t_prev = t;
+		}
+	}
+}
+
+/*===========================================================================*/
+/*
+* Splits the samples into blocks: up to STREAM_BLOCK_LEN samples with the
+* same flags. See stream.c for the block format.
+*/
+static void encode(void)
+{
+	int i = 0;
+
+	blocks = calloc(n_samples, sizeof(*blocks));
+	if (!blocks) fail("out of memory");
+
+	while (i < n_samples) {
+		struct block_s *b = &blocks[n_blocks++];
+		uint8_t flags = samples[i].flags;
+		uint16_t last = samples[i].c;
+		uint8_t sum = 0;
+		int n = 0;
+
+		while (((i + n) < n_samples) && (n < STREAM_BLOCK_LEN) &&
+			(samples[i + n].flags == flags))
+			n++;
+
+		b->first = i;
+		b->count = n;
+		b->buf[0] = STREAM_SYNC;
+		b->buf[1] = flags;
+		b->buf[2] = (uint8_t)n;
+		b->buf[3] = last & 0xFF;
+		b->buf[4] = last >> 8;
+		b->len = 5;
+		for (int k = 1; k < n; k++) {
+			int d = (int)samples[i + k].c - (int)last;
+			last = samples[i + k].c;
+			if ((d > STREAM_ESCAPE) && (d <= 127)) {
+				b->buf[b->len++] = (uint8_t)(int8_t)d;
+			} else {
+				b->buf[b->len++] = (uint8_t)(int8_t)STREAM_ESCAPE;
+				b->buf[b->len++] = last & 0xFF;
+				b->buf[b->len++] = last >> 8;
+			}
+		}
+		for (int k = 1; k < b->len; k++) sum += b->buf[k];
+		b->buf[b->len++] = sum;
+
+		i += n;
+	}
+}
+
+/*===========================================================================*/
+/*
+* Link simulation. Blocks are sent back to back as soon as there's a credit
+* for them. Playback starts once both buffers are full, and a block is freed
+* (credit sent back) once its last sample is taken, when the sample before
+* it is issued. Every block must be in before its first sample is needed.
+*/
+static int simulate(void)
+{
+	double byte_t = 10.0 / (double)baud;		// start + 8 data + stop bits
+	double *ready = malloc(n_blocks * sizeof(double));
+	double *freed = malloc(n_blocks * sizeof(double));
+	double *pop = malloc((n_samples + 1) * sizeof(double));
+	double link = 0.0, t0, margin = 1e9, t_margin = 0.0;
+	long bytes = 0, underruns = 0;
+
+	if (!ready || !freed || !pop) fail("out of memory");
+
+	// reception of the first blocks, then playback timeline
+	for (int b = 0; (b < STREAM_BLOCKS) && (b < n_blocks); b++) {
+		link += blocks[b].len * byte_t;
+		ready[b] = link;
+	}
+	t0 = link;
+	pop[0] = t0;
+	for (int i = 0; i < n_samples; i++)
+		pop[i + 1] = pop[i] + (samples[i].c + 1.0) / f_motor;
+	for (int b = 0; b < n_blocks; b++)
+		freed[b] = pop[(blocks[b].first + blocks[b].count) - 1];
+
+	for (int b = 0; b < n_blocks; b++) {
+		if (b >= STREAM_BLOCKS) {
+			double credit = freed[b - STREAM_BLOCKS] + byte_t;
+			if (credit > link) link = credit;
+			link += blocks[b].len * byte_t;
+			ready[b] = link;
+		}
+		bytes += blocks[b].len;
+
+		double m = pop[blocks[b].first] - ready[b];
+		if ((b >= STREAM_BLOCKS) && (m < margin)) {
+			margin = m;
+			t_margin = pop[blocks[b].first] - t0;
+		}
+		if (m < 0.0) underruns++;
+	}
+	// stream end block, needed once the last sample is issued
+	link += 4 * byte_t;
+	if (link > pop[n_samples]) underruns++;
+
+	printf("samples: %d, blocks: %d, bytes: %ld (%.2f bytes/sample)\n",
+		n_samples, n_blocks, bytes, (double)bytes / n_samples);
+	printf("playback: %.1f s, link: %ld baud, %.0f%% busy\n",
+		pop[n_samples] - t0, baud,
+		100.0 * (bytes * byte_t) / (pop[n_samples] - t0));
+	if (n_blocks > STREAM_BLOCKS)
+		printf("min margin: %.2f ms, at %.1f s\n", margin * 1000.0, t_margin);
+	printf("underruns: %ld\n", underruns);
+
+	free(ready);
+	free(freed);
+	free(pop);
+
+	return underruns ? 1 : 0;
+}
+
+/*===========================================================================*/
+/*
+* Sends the stream through the serial port: opens stream mode with the
+* console command, sends the blocks as credits come back, and waits for the
+* slider report once the stream ends.
+*/
+static int send_stream(const char *device)
+{
+	static const uint8_t end[4] = {STREAM_SYNC, 0, 0, 0};
+	struct termios tio;
+	char reply[128];
+	int len = 0, credits = STREAM_BLOCKS, b = 0;
+	int opened = 0, done = 0;
+	int fd = open(device, O_RDWR | O_NOCTTY);
+
+	if (fd < 0) fail("can't open the serial device");
+	if (baud != 115200) fail("only 115200 baud is supported");
+
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	cfsetspeed(&tio, B115200);
+	tcsetattr(fd, TCSANOW, &tio);
+	tcflush(fd, TCIOFLUSH);
+
+	if (write(fd, "T\r", 2) != 2) fail("serial write failed");
+
+	for (;;) {
+		struct timeval tv = {REPLY_TIMEOUT, 0};
+		fd_set rd;
+		char c;
+		int report = (len >= 6) && (strncmp(reply, "stream", 6) == 0);
+
+		// the report is the last line: it has no line end
+		if (report) {
+			tv.tv_sec = 0;
+			tv.tv_usec = 500000;
+		}
+
+		// send as many blocks as credits, once stream mode is open
+		while (opened && (done == 0) && (credits > 0) && (b < n_blocks)) {
+			if (write(fd, blocks[b].buf, blocks[b].len) != blocks[b].len)
+				fail("serial write failed");
+			credits--;
+			b++;
+		}
+		if (opened && (done == 0) && (b == n_blocks)) {
+			if (write(fd, end, sizeof(end)) != sizeof(end))
+				fail("serial write failed");
+			done = 1;
+		}
+
+		FD_ZERO(&rd);
+		FD_SET(fd, &rd);
+		if (select(fd + 1, &rd, NULL, NULL, &tv) <= 0) {
+			reply[len] = '\0';
+			if (report) {
+				printf("%s\n", reply);
+				break;
+			}
+			c = STREAM_ABORT;
+			if (write(fd, &c, 1) != 1) {}
+			fail("no reply from the slider");
+		}
+		if (read(fd, &c, 1) != 1) fail("serial read failed");
+
+		if (c == STREAM_CREDIT) {
+			credits++;
+		} else if ((c == '\n') || (c == '\r')) {
+			reply[len] = '\0';
+			if (strncmp(reply, "err", 3) == 0) fail("stream mode refused");
+			if (strncmp(reply, "ok", 2) == 0) opened = 1;
+			len = 0;
+		} else if (len < (int)sizeof(reply) - 1) {
+			reply[len++] = c;
+		}
+	}
+	close(fd);
+
+	return (strncmp(reply, "stream end", 10) == 0) ? 0 : 1;
+}
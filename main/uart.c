@@ -57,6 +57,24 @@ void uart_send_char( char data ){
 	while ( !( UCSR0A & (1<<UDRE0)) );
 }
 
+/*===========================================================================*/
+/*
+* Sends a byte, and enables the Transmit Complete interrupt: its ISR runs
+* once the byte and any previous one are completely shifted out, right when
+* the receivers got it. The ISR belongs to the module that needs that 
+* instant (see sync.c), and disables the interrupt. The flag is cleared by
+* writing it one (the error flags must be written zero).
+*/
+void uart_send_sync( char data ){
+
+	/* Wait for empty transmit buffer */
+	while ( !( UCSR0A & (1<<UDRE0)) );
+
+	UCSR0A = (UCSR0A & ((1<<U2X0) | (1<<MPCM0))) | (1<<TXC0);
+	UDR0 = data;
+	uart_tx_isr(ENABLE);
+}
+
 /*===========================================================================*/
 void uart_send_string(const char *s){
 
@@ -100,6 +118,31 @@ void uart_set(uint8_t state){
 	}
 }
 
+/*===========================================================================*/
+/*
+* Receive Complete interrupt enable/disable. The ISR itself belongs to the
+* module consuming the received data (see console.c)
+*/
+void uart_rx_isr(uint8_t state){
+
+	if(state){
+		uart_flush();
+		UCSR0B |= (1<<RXCIE0);
+	} else {
+		UCSR0B &= ~(1<<RXCIE0);
+	}
+}
+
+/*===========================================================================*/
+/*
+* Transmit Complete interrupt enable/disable (see uart_send_sync())
+*/
+void uart_tx_isr(uint8_t state){
+
+	if(state) UCSR0B |= (1<<TXCIE0);
+	else UCSR0B &= ~(1<<TXCIE0);
+}
+
 /*===========================================================================*/
 static uint8_t uart_flush(void){
 
@@ -16,9 +16,12 @@
 
 void uart_init(void);
 void uart_send_char(char data);
+void uart_send_sync(char data);
 void uart_send_string(const char *s);
 void uart_send_string_p(const char *s);
 char uart_read_char(void);
 void uart_set(uint8_t state);
+void uart_rx_isr(uint8_t state);
+void uart_tx_isr(uint8_t state);
 
 #endif /* UART_H */
\ No newline at end of file
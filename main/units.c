@@ -0,0 +1,133 @@
+/*
+* Unit conversions for the readouts: motor timer periods and eighth-step 
+* counts into mm/s, mm and percentages. The UI loops call them several times
+* per second, thus there's no division and no floating point: a reciprocal
+* table and scaled multiplies only (the AVR has a hardware multiplier, but
+* divisions and floats are done in software).
+*/
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "units.h"
+
+#include <avr/pgmspace.h>
+
+/******************************************************************************
+****************** V A R I A B L E S   D E F I N I T I O N S ******************
+******************************************************************************/
+
+// Reciprocals: 2^22 / i, for i = 128..256
+static const uint16_t recip[129] PROGMEM = {
+	32768, 32514, 32264, 32018, 31775, 31536, 31301, 31069,
+	30840, 30615, 30394, 30175, 29959, 29747, 29537, 29331,
+	29127, 28926, 28728, 28533, 28340, 28150, 27962, 27777,
+	27594, 27414, 27236, 27060, 26887, 26715, 26546, 26379,
+	26214, 26052, 25891, 25732, 25575, 25420, 25267, 25116,
+	24966, 24818, 24672, 24528, 24385, 24245, 24105, 23967,
+	23831, 23697, 23564, 23432, 23302, 23173, 23046, 22920,
+	22795, 22672, 22550, 22429, 22310, 22192, 22075, 21960,
+	21845, 21732, 21620, 21509, 21400, 21291, 21183, 21077,
+	20972, 20867, 20764, 20662, 20560, 20460, 20361, 20262,
+	20165, 20068, 19973, 19878, 19784, 19692, 19600, 19508,
+	19418, 19329, 19240, 19152, 19065, 18979, 18893, 18809,
+	18725, 18641, 18559, 18477, 18396, 18316, 18236, 18157,
+	18079, 18001, 17924, 17848, 17772, 17697, 17623, 17549,
+	17476, 17404, 17332, 17261, 17190, 17120, 17050, 16981,
+	16913, 16845, 16777, 16710, 16644, 16578, 16513, 16448,
+	16384
+};
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*===========================================================================*/
+/*
+* k / d, rounded, without any division. The divisor is normalized to 
+* [2^15, 2^16) and its reciprocal is interpolated from the table, the 
+* dividend is cut down to 16 bits: the product fits in 32 bits. Relative
+* error below 1e-4, plenty for a readout.
+*/
+uint32_t units_div(uint32_t k, uint32_t d)
+{
+	int8_t e = 30;			// k / d = (k * r) >> e
+	uint16_t r, r1;
+	uint8_t i;
+
+	if (d == 0) return UINT32_MAX;
+	while (k > 0xFFFF) {
+		k >>= 1;
+		e--;
+	}
+	while (d > 0xFFFF) {
+		d >>= 1;
+		e++;
+	}
+	while (d < 0x8000) {
+		d <<= 1;
+		e--;
+	}
+	if (e < 1) return UINT32_MAX;
+	if (e > 31) return 0;
+
+	i = (d >> 8) - 128;
+	r = pgm_read_word(&recip[i]);
+	r1 = pgm_read_word(&recip[i + 1]);
+	r -= ((uint16_t)(r - r1) * (uint8_t)d) >> 8;
+
+	return ((uint32_t)k * r + ((uint32_t)1 << (e - 1))) >> e;
+}
+
+/*===========================================================================*/
+/*
+* Speed, in 0.1mm/s, of an eighth-step motor timer period (motor_get_speed()).
+* Zero if the motor is stopped.
+*/
+uint16_t units_speed(uint32_t c)
+{
+	if (c == 0) return 0;
+	return (uint16_t)units_div(UNITS_SPEED_K, c + 1);
+}
+
+/*===========================================================================*/
+/*
+* Speed, as a percent of the max speed, of an eighth-step motor timer period
+*/
+uint8_t units_speed_percent(uint32_t c)
+{
+	uint32_t p;
+
+	if (c == 0) return 0;
+	p = units_div(UNITS_PERCENT_K, c + 1);
+	return (p > 100) ? 100 : (uint8_t)p;
+}
+
+/*===========================================================================*/
+/*
+* Position, in mm, of an eighth-step count. Truncated towards zero.
+*/
+int16_t units_mm(int32_t pos)
+{
+	uint16_t mm;
+
+	if (pos < 0) {
+		mm = ((uint32_t)(-pos) * UNITS_MM_K) >> UNITS_MM_SHIFT;
+		return -(int16_t)mm;
+	}
+	mm = ((uint32_t)pos * UNITS_MM_K) >> UNITS_MM_SHIFT;
+	return (int16_t)mm;
+}
+
+/*===========================================================================*/
+/*
+* Progress: part of the total, in percent (0..100).
+*/
+uint8_t units_percent(uint32_t part, uint32_t total)
+{
+	uint32_t p;
+
+	if (part >= total) return 100;
+	p = units_div(part * 100, total);
+	return (uint8_t)p;
+}
@@ -0,0 +1,38 @@
+
+#ifndef UNITS_H
+#define UNITS_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "config.h"
+
+#include <stdint.h>
+
+/******************************************************************************
+********************** M A C R O S   D E F I N I T I O N **********************
+******************************************************************************/
+
+// Speed: motor timer ticks per second, times 0.1mm per eighth-step
+#define UNITS_SPEED_K	((uint32_t)(F_MOTOR * CMS_PER_REV * 100 / STEPS_PER_REV))
+// Speed percent: motor timer ticks per second, times 100 / SPEED_MAX
+#define UNITS_PERCENT_K	((uint32_t)(F_MOTOR * 100.0 / SPEED_MAX + 0.5))
+
+// Position: mm per eighth-step, as a 2^-22 fixed point multiplier
+#define UNITS_MM_SHIFT	22
+#define UNITS_MM_K		((((uint32_t)CMS_PER_REV * 10) << UNITS_MM_SHIFT) / STEPS_PER_REV + 1)
+
+_Static_assert((double)MAX_COUNT * UNITS_MM_K <= UINT32_MAX, "position to mm overflows");
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+uint32_t units_div(uint32_t k, uint32_t d);
+uint16_t units_speed(uint32_t c);
+uint8_t units_speed_percent(uint32_t c);
+int16_t units_mm(int32_t pos);
+uint8_t units_percent(uint32_t part, uint32_t total);
+
+#endif /* UNITS_H */
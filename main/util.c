@@ -9,6 +9,30 @@
 #include "util.h"
 
 #include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+/******************************************************************************
+*******************	C O N S T A N T S  D E F I N I T I O N S ******************
+******************************************************************************/
+
+#define STACK_PAINT		0xC5	// stack painting pattern, see stack_paint()
+
+/******************************************************************************
+****************** V A R I A B L E S   D E F I N I T I O N S ******************
+******************************************************************************/
+
+static void (*background)(void);	// see background_set()
+
+extern uint8_t _end;				// end of .bss: linker symbol
+
+/******************************************************************************
+******************* F U N C T I O N   P R O T O T Y P E S *********************
+******************************************************************************/
+
+void stack_paint(void) __attribute__((naked, used, section(".init1")));
 
 /******************************************************************************
 ******************* F U N C T I O N   D E F I N I T I O N S *******************
@@ -24,4 +48,146 @@ uint16_t millis(void)
 void clear_millis(void)
 {
 	ms = 0;
+}
+
+/*===========================================================================*/
+/*
+* Sleeps until the general timer ticks, and returns millis(). Used as the 
+* time base of the menu loops, instead of polling millis(). The background
+* task, if any, is executed first.
+* Interrupts are disabled while checking, and only re-enabled right before
+* sleeping (the instruction after sei() is always executed), thus a tick
+* can't be missed in between.
+*/
+uint16_t wait_millis(void)
+{
+	uint16_t x;
+
+	if (background) background();
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	cli();
+	while (!(x = ms)) {
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		cli();
+	}
+	sei();
+
+	return x;
+}
+
+/*===========================================================================*/
+/*
+* Milliseconds since boot
+*/
+uint32_t uptime(void)
+{
+	uint32_t t;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		t = uptime_ms;
+	}
+	return t;
+}
+
+/*===========================================================================*/
+/*
+* Microseconds since boot, 8us resolution: general timer count (prescaler 128)
+* on top of the milliseconds count. Wraps every ~71 minutes.
+*/
+uint32_t micros(void)
+{
+	uint32_t m;
+	uint8_t t;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		m = uptime_ms;
+		t = TCNT2;
+		// timer already wrapped, but its ISR not served yet
+		if ((TIFR2 & (1<<OCF2A)) && (t < OCR2A)) m++;
+	}
+	return (m * 1000) + ((uint32_t)t * 8);
+}
+
+/*===========================================================================*/
+/*
+* Background task: executed by the menu loops once per tick, from the main
+* loop context (see wait_millis()). Thus, it may safely use any module, as
+* the menus themselves do. NULL to remove it.
+*/
+void background_set(void (*fn)(void))
+{
+	background = fn;
+}
+
+/*===========================================================================*/
+/*
+* Sleeps until the next interrupt, whichever it is. The general timer wakes
+* the CPU up every millisecond at most.
+*/
+void cpu_idle(void)
+{
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_mode();
+}
+
+/*===========================================================================*/
+/*
+* Free RAM right now: from the end of .bss to the stack pointer. The heap is
+* never used (no malloc), so this gap is the stack's room.
+*/
+uint16_t ram_free(void)
+{
+	return SP - (uint16_t)&_end;
+}
+
+/*===========================================================================*/
+/*
+* Stack bytes never reached since boot: painted bytes above the end of .bss
+* which still hold the pattern. A pushed byte equal to the pattern may hide
+* a few more, thus it's a hint, not a guarantee. Takes ~0.5ms when the stack
+* is shallow: not for ISRs.
+*/
+uint16_t stack_unused(void)
+{
+	const uint8_t *p = &_end;
+
+	while ((p <= (const uint8_t *)RAMEND) && (*p == STACK_PAINT)) p++;
+
+	return p - &_end;
+}
+
+/*===========================================================================*/
+/*
+* Stack high water mark: deepest stack use since boot, in bytes. Interrupts
+* nested on top of the main loop are included. See stack_unused()
+*/
+uint16_t stack_peak(void)
+{
+	return (RAMEND + 1) - (uint16_t)&_end - stack_unused();
+}
+
+/*===========================================================================*/
+/*
+* Stack painting. Runs right after reset, before the stack pointer is even
+* set and before .data and .bss are initialized (section .init1, no call
+* nor return): fills the RAM from the end of .bss to RAMEND with the pattern.
+* Whatever the stack overwrites later is its high water mark.
+*/
+void stack_paint(void)
+{
+	__asm volatile (
+		"	ldi r30, lo8(_end)	\n"
+		"	ldi r31, hi8(_end)	\n"
+		"	ldi r24, %0			\n"
+		"	ldi r25, hi8(%1)	\n"
+		"1:	st Z+, r24			\n"
+		"	cpi r30, lo8(%1)	\n"
+		"	cpc r31, r25		\n"
+		"	brlo 1b				\n"
+		:: "i" (STACK_PAINT), "i" (RAMEND + 1)
+	);
 }
\ No newline at end of file
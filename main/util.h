@@ -16,5 +16,13 @@
 
 uint16_t millis(void);
 void clear_millis(void);
+uint16_t wait_millis(void);
+uint32_t uptime(void);
+uint32_t micros(void);
+void cpu_idle(void);
+void background_set(void (*fn)(void));
+uint16_t ram_free(void);
+uint16_t stack_unused(void);
+uint16_t stack_peak(void);
 
 #endif /* UTIL_H */
\ No newline at end of file